@@ -0,0 +1,335 @@
+/**
+ * Asynchronous load/save on a dedicated I/O thread pool
+ */
+
+#include "async_io.h"
+#include "stb/stb_image.h"
+#include <algorithm>
+#include <utility>
+
+#define NUM_CHANNELS 3
+
+namespace agl {
+
+// Shared between a load task and its handle; flags and byte counts are
+// guarded by the pool's mutex
+struct AsyncLoadState : public std::enable_shared_from_this<AsyncLoadState> {
+  IOPool* pool;
+  std::string filename;
+  bool flip;
+  bool cancelled;
+  size_t reserved;
+  Image image;
+  std::promise<bool> promise;
+  std::shared_future<bool> done;
+
+  AsyncLoadState(IOPool* pool, const std::string& filename, bool flip):
+    pool(pool), filename(filename), flip(flip), cancelled(false), reserved(0) {
+    this->done= this->promise.get_future().share();
+  }
+
+  ~AsyncLoadState() {
+    this->releaseBytes();
+  }
+
+  void releaseBytes() {
+    size_t bytes;
+    {
+      std::lock_guard<std::mutex> lock(this->pool->myMutex);
+      bytes= this->reserved;
+      this->reserved= 0;
+    }
+    if (bytes > 0) this->pool->release(bytes);
+  }
+
+  bool isCancelled() {
+    std::lock_guard<std::mutex> lock(this->pool->myMutex);
+    return this->cancelled;
+  }
+
+  void run() {
+    int width= 0;
+    int height= 0;
+    int components= 0;
+    if (this->isCancelled() ||
+        !stbi_info(this->filename.c_str(), &width, &height, &components)) {
+      this->promise.set_value(false);
+      return;
+    }
+
+    // decoding may resume later on another worker, once there is budget
+    size_t bytes= (size_t) width * height * NUM_CHANNELS;
+    std::shared_ptr<AsyncLoadState> self= this->shared_from_this();
+    this->pool->reserve(bytes, this->cancelled, [self, bytes](bool reserved) {
+      self->decode(reserved ? bytes : 0);
+    });
+  }
+
+  // Decodes the image with bytes reserved for it, 0 when cancelled
+  void decode(size_t bytes) {
+    if (bytes == 0) {
+      this->promise.set_value(false);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(this->pool->myMutex);
+      this->reserved= bytes;
+    }
+
+    bool success= this->image.load(this->filename, this->flip);
+    if (!success || this->isCancelled()) {
+      this->image= Image();
+      this->releaseBytes();
+      success= false;
+    }
+    this->promise.set_value(success);
+  }
+};
+
+struct AsyncSaveState {
+  IOPool* pool;
+  Image image;
+  std::string filename;
+  bool flip;
+  bool cancelled;
+  std::promise<bool> promise;
+  std::shared_future<bool> done;
+
+  AsyncSaveState(IOPool* pool, const Image& image, const std::string& filename, bool flip):
+    pool(pool), image(image), filename(filename), flip(flip), cancelled(false) {
+    this->done= this->promise.get_future().share();
+  }
+
+  void run() {
+    bool cancelled;
+    {
+      std::lock_guard<std::mutex> lock(this->pool->myMutex);
+      cancelled= this->cancelled;
+    }
+    bool success= !cancelled && this->image.save(this->filename, this->flip);
+
+    // the copy was counted against the budget when it was made
+    size_t bytes= this->image.bytes();
+    this->image= Image();
+    this->pool->release(bytes);
+    this->promise.set_value(success);
+  }
+};
+
+AsyncLoad::AsyncLoad() {
+}
+
+AsyncLoad::AsyncLoad(const std::shared_ptr<AsyncLoadState>& state): myState(state) {
+}
+
+bool AsyncLoad::valid() const {
+  return this->myState != nullptr;
+}
+
+bool AsyncLoad::ready() const {
+  return this->myState == nullptr ||
+    this->myState->done.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void AsyncLoad::wait() const {
+  if (this->myState != nullptr) this->myState->done.wait();
+}
+
+void AsyncLoad::cancel() {
+  if (this->myState == nullptr) return;
+  {
+    std::lock_guard<std::mutex> lock(this->myState->pool->myMutex);
+    this->myState->cancelled= true;
+  }
+  // finish it now if it is waiting for budget
+  this->myState->pool->resumeDeferred();
+}
+
+bool AsyncLoad::get(Image& image) {
+  if (this->myState == nullptr) return false;
+  bool success= this->myState->done.get();
+  if (success) {
+    bool cancelled;
+    {
+      std::lock_guard<std::mutex> lock(this->myState->pool->myMutex);
+      cancelled= this->myState->cancelled;
+    }
+    success= !cancelled;
+    if (success) image= std::move(this->myState->image);
+  }
+
+  // the image now belongs to the caller
+  this->myState->releaseBytes();
+  this->myState.reset();
+
+  return success;
+}
+
+AsyncSave::AsyncSave() {
+}
+
+AsyncSave::AsyncSave(const std::shared_ptr<AsyncSaveState>& state): myState(state) {
+}
+
+bool AsyncSave::valid() const {
+  return this->myState != nullptr;
+}
+
+bool AsyncSave::ready() const {
+  return this->myState == nullptr ||
+    this->myState->done.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void AsyncSave::wait() const {
+  if (this->myState != nullptr) this->myState->done.wait();
+}
+
+void AsyncSave::cancel() {
+  if (this->myState == nullptr) return;
+  std::lock_guard<std::mutex> lock(this->myState->pool->myMutex);
+  this->myState->cancelled= true;
+}
+
+bool AsyncSave::get() {
+  if (this->myState == nullptr) return false;
+  bool success= this->myState->done.get();
+  this->myState.reset();
+
+  return success;
+}
+
+IOPool::IOPool(int threads, size_t maxInFlightBytes): myStopping(false),
+  myMaxInFlight(maxInFlightBytes), myInFlight(0) {
+  for (int i= 0; i < std::max(1, threads); i++) {
+    this->myWorkers.emplace_back(&IOPool::workerLoop, this);
+  }
+}
+
+IOPool::~IOPool() {
+  {
+    std::lock_guard<std::mutex> lock(this->myMutex);
+    this->myStopping= true;
+  }
+  // loads waiting for budget all go through now
+  this->resumeDeferred();
+  this->myWork.notify_all();
+  for (std::thread& worker : this->myWorkers) worker.join();
+}
+
+IOPool& IOPool::shared() {
+  static IOPool pool(2, 0);
+  return pool;
+}
+
+AsyncLoad IOPool::loadAsync(const std::string& filename, bool flip) {
+  std::shared_ptr<AsyncLoadState> state= std::make_shared<AsyncLoadState>(this, filename, flip);
+  this->submit([state]() { state->run(); });
+
+  return AsyncLoad(state);
+}
+
+AsyncSave IOPool::saveAsync(const Image& image, const std::string& filename, bool flip) {
+  std::shared_ptr<AsyncSaveState> state= std::make_shared<AsyncSaveState>(this, image, filename, flip);
+  {
+    // the copy is in flight until it is written; it is already made, so
+    // it is counted without waiting for budget
+    std::lock_guard<std::mutex> lock(this->myMutex);
+    this->myInFlight+= state->image.bytes();
+  }
+  this->submit([state]() { state->run(); });
+
+  return AsyncSave(state);
+}
+
+void IOPool::setMaxInFlightBytes(size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(this->myMutex);
+    this->myMaxInFlight= bytes;
+  }
+  this->resumeDeferred();
+}
+
+size_t IOPool::maxInFlightBytes() const {
+  std::lock_guard<std::mutex> lock(this->myMutex);
+  return this->myMaxInFlight;
+}
+
+size_t IOPool::inFlightBytes() const {
+  std::lock_guard<std::mutex> lock(this->myMutex);
+  return this->myInFlight;
+}
+
+void IOPool::submit(const std::function<void()>& task) {
+  {
+    std::lock_guard<std::mutex> lock(this->myMutex);
+    this->myQueue.push_back(task);
+  }
+  this->myWork.notify_one();
+}
+
+void IOPool::workerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(this->myMutex);
+      this->myWork.wait(lock, [this]() { return this->myStopping || !this->myQueue.empty(); });
+      if (this->myQueue.empty()) return; // stopping and drained
+      task= std::move(this->myQueue.front());
+      this->myQueue.pop_front();
+    }
+    task();
+  }
+}
+
+void IOPool::reserve(size_t bytes, const bool& cancelled, const std::function<void(bool)>& resume) {
+  {
+    std::lock_guard<std::mutex> lock(this->myMutex);
+    this->myDeferred.push_back(DeferredLoad{bytes, &cancelled, resume});
+  }
+  this->resumeDeferred();
+}
+
+void IOPool::release(size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(this->myMutex);
+    this->myInFlight-= bytes;
+  }
+  this->resumeDeferred();
+}
+
+void IOPool::resumeDeferred() {
+  bool queued= false;
+  {
+    std::lock_guard<std::mutex> lock(this->myMutex);
+    // first come, first served: a load that does not fit holds back the
+    // ones behind it, except those that were cancelled
+    bool blocked= false;
+    for (auto it= this->myDeferred.begin(); it != this->myDeferred.end();) {
+      std::function<void(bool)> resume= it->resume;
+      if (*it->cancelled) {
+        this->myQueue.push_back([resume]() { resume(false); });
+      } else if (!blocked && (this->myStopping || this->myMaxInFlight == 0 || this->myInFlight == 0 ||
+          this->myInFlight + it->bytes <= this->myMaxInFlight)) {
+        this->myInFlight+= it->bytes;
+        this->myQueue.push_back([resume]() { resume(true); });
+      } else {
+        blocked= true;
+        ++it;
+        continue;
+      }
+      it= this->myDeferred.erase(it);
+      queued= true;
+    }
+  }
+  if (queued) this->myWork.notify_all();
+}
+
+AsyncLoad loadAsync(const std::string& filename, bool flip) {
+  return IOPool::shared().loadAsync(filename, flip);
+}
+
+AsyncSave saveAsync(const Image& image, const std::string& filename, bool flip) {
+  return IOPool::shared().saveAsync(image, filename, flip);
+}
+
+}  // namespace agl
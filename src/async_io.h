@@ -0,0 +1,153 @@
+#ifndef AGL_ASYNC_IO_H_
+#define AGL_ASYNC_IO_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "image.h"
+
+namespace agl {
+
+class IOPool;
+struct AsyncLoadState;
+struct AsyncSaveState;
+
+/**
+ * @brief Handle to a load running on an IOPool
+ *
+ * The decoded image counts against the pool's in-flight byte cap until it
+ * is taken with get() or the load is cancelled.
+ */
+class AsyncLoad {
+ public:
+  AsyncLoad();
+  explicit AsyncLoad(const std::shared_ptr<AsyncLoadState>& state);
+
+  // False for a default-constructed handle
+  bool valid() const;
+
+  // True once get() will not block
+  bool ready() const;
+  void wait() const;
+
+  // A load that has not started yet never runs; a running one is
+  // discarded when it finishes. get() then returns false.
+  void cancel();
+
+  /**
+   * @brief Wait for the load and move the result into image
+   * @return false if the file could not be loaded or the load was cancelled
+   */
+  bool get(Image& image);
+
+ private:
+  std::shared_ptr<AsyncLoadState> myState;
+};
+
+/**
+ * @brief Handle to a save running on an IOPool
+ */
+class AsyncSave {
+ public:
+  AsyncSave();
+  explicit AsyncSave(const std::shared_ptr<AsyncSaveState>& state);
+
+  bool valid() const;
+  bool ready() const;
+  void wait() const;
+
+  // A save that has not started yet never writes the file
+  void cancel();
+
+  // Wait for the save, returns false if it failed or was cancelled
+  bool get();
+
+ private:
+  std::shared_ptr<AsyncSaveState> myState;
+};
+
+/**
+ * @brief Dedicated thread pool for image decoding and encoding
+ *
+ * Keeps slow disks and codecs off the threads that do the processing.
+ * Loads reserve their decoded size (from the file header) before decoding
+ * and hold it until the caller takes the image, so at most
+ * maxInFlightBytes of decoded images are waiting at any time. A load that
+ * does not fit is set aside, in order, until enough is released; it never
+ * holds a thread meanwhile, so saves and other work keep running. One load
+ * is always allowed through so a single oversized image cannot stall it.
+ *
+ * The pool must outlive the handles it returns.
+ */
+class IOPool {
+ public:
+  // maxInFlightBytes of 0 means no cap
+  explicit IOPool(int threads = 2, size_t maxInFlightBytes = 0);
+
+  // Finishes the queued work (cancelled tasks are skipped) and joins
+  virtual ~IOPool();
+
+  IOPool(const IOPool&) = delete;
+  IOPool& operator=(const IOPool&) = delete;
+
+  AsyncLoad loadAsync(const std::string& filename, bool flip = false);
+
+  // The image is copied, so the caller may keep modifying it
+  AsyncSave saveAsync(const Image& image, const std::string& filename, bool flip = true);
+
+  void setMaxInFlightBytes(size_t bytes);
+  size_t maxInFlightBytes() const;
+
+  // Decoded bytes currently reserved by loads and saves
+  size_t inFlightBytes() const;
+
+  // Pool used by the free loadAsync/saveAsync functions (2 threads, no cap)
+  static IOPool& shared();
+
+ private:
+  friend class AsyncLoad;
+  friend class AsyncSave;
+  friend struct AsyncLoadState;
+  friend struct AsyncSaveState;
+
+  // A load waiting for budget; resume(true) once bytes are reserved for
+  // it, resume(false) if it was cancelled first
+  struct DeferredLoad {
+    size_t bytes;
+    const bool* cancelled;
+    std::function<void(bool)> resume;
+  };
+
+  void submit(const std::function<void()>& task);
+  void workerLoop();
+
+  // Reserves bytes and resumes at once if they fit under the cap and no
+  // earlier load is waiting, otherwise sets the load aside
+  void reserve(size_t bytes, const bool& cancelled, const std::function<void(bool)>& resume);
+  void release(size_t bytes);
+
+  // Queues the waiting loads that now fit or were cancelled
+  void resumeDeferred();
+
+  std::vector<std::thread> myWorkers;
+  std::deque<std::function<void()>> myQueue;
+  std::deque<DeferredLoad> myDeferred;
+  bool myStopping;
+  size_t myMaxInFlight;
+  size_t myInFlight;
+  mutable std::mutex myMutex;
+  std::condition_variable myWork;
+};
+
+// Load/save on IOPool::shared()
+AsyncLoad loadAsync(const std::string& filename, bool flip = false);
+AsyncSave saveAsync(const Image& image, const std::string& filename, bool flip = true);
+
+}  // namespace agl
+#endif  // AGL_ASYNC_IO_H_
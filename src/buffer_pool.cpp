@@ -0,0 +1,162 @@
+#include "buffer_pool.h"
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "parallel.h"
+
+namespace agl {
+
+static const size_t BUFFER_ALIGNMENT= 64;
+static const size_t SMALLEST_CLASS= 64;
+
+struct BufferPool::Shard {
+  std::mutex mutex;
+  std::map<size_t, std::vector<unsigned char*>> free; // by class size
+};
+
+// the shard index of this thread, handed out round robin on first use
+static int homeShard(int shards) {
+  static std::atomic<int> next(0);
+  static thread_local int index= next++;
+  return index % shards;
+}
+
+// The raw pointer from new[] is kept just before the aligned start
+static unsigned char* allocateAligned(size_t bytes) {
+  unsigned char* raw= new unsigned char[bytes + BUFFER_ALIGNMENT];
+  unsigned char* aligned= raw + BUFFER_ALIGNMENT - ((uintptr_t) raw & (BUFFER_ALIGNMENT - 1));
+  ((unsigned char**) aligned)[-1]= raw;
+  return aligned;
+}
+
+static void freeAligned(unsigned char* aligned) {
+  delete[] ((unsigned char**) aligned)[-1];
+}
+
+BufferPool::BufferPool(size_t retentionCap): myShardCount(threadCount()),
+  myShards(new Shard[threadCount()]), myCap(retentionCap), myRetainedBytes(0),
+  myRetainedBuffers(0), myHits(0), myMisses(0), myReturned(0), myDropped(0) {
+}
+
+BufferPool::~BufferPool() {
+  this->trim();
+}
+
+size_t BufferPool::classSize(size_t bytes) {
+  if (bytes <= SMALLEST_CLASS) return SMALLEST_CLASS;
+
+  // 2^e < bytes <= 2^(e + 1), split into four classes
+  int e= 0;
+  while (((size_t) 2 << e) < bytes) e++;
+  size_t step= (size_t) 1 << (e - 2);
+  return (bytes + step - 1) / step * step;
+}
+
+unsigned char* BufferPool::acquire(size_t bytes) {
+  if (bytes == 0) return nullptr;
+  size_t size= classSize(bytes);
+
+  if (this->myRetainedBytes.load(std::memory_order_relaxed) > 0) {
+    int home= homeShard(this->myShardCount);
+    for (int k= 0; k < this->myShardCount; k++) {
+      Shard& shard= this->myShards[(home + k) % this->myShardCount];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto found= shard.free.find(size);
+      if (found == shard.free.end() || found->second.empty()) continue;
+
+      unsigned char* buffer= found->second.back();
+      found->second.pop_back();
+      this->myRetainedBytes-= size;
+      this->myRetainedBuffers--;
+      this->myHits++;
+      return buffer;
+    }
+  }
+
+  this->myMisses++;
+  return allocateAligned(size);
+}
+
+void BufferPool::release(unsigned char* buffer, size_t bytes) {
+  if (buffer == nullptr) return;
+  size_t size= classSize(bytes);
+
+  // reserve room under the cap first so concurrent releases cannot
+  // overshoot it together
+  if (this->myRetainedBytes.fetch_add(size) + size > this->myCap.load()) {
+    this->myRetainedBytes-= size;
+    this->myDropped++;
+    freeAligned(buffer);
+    return;
+  }
+
+  Shard& shard= this->myShards[homeShard(this->myShardCount)];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  shard.free[size].push_back(buffer);
+  this->myRetainedBuffers++;
+  this->myReturned++;
+}
+
+void BufferPool::setRetentionCap(size_t bytes) {
+  this->myCap= bytes;
+  this->shrinkTo(bytes);
+}
+
+size_t BufferPool::retentionCap() const {
+  return this->myCap.load();
+}
+
+void BufferPool::trim() {
+  this->shrinkTo(0);
+}
+
+void BufferPool::shrinkTo(size_t bytes) {
+  for (int s= 0; s < this->myShardCount; s++) {
+    Shard& shard= this->myShards[s];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // largest classes first, they free the most for the least reuse lost
+    for (auto entry= shard.free.rbegin(); entry != shard.free.rend(); ++entry) {
+      std::vector<unsigned char*>& buffers= entry->second;
+      while (!buffers.empty() && this->myRetainedBytes.load() > bytes) {
+        freeAligned(buffers.back());
+        buffers.pop_back();
+        this->myRetainedBytes-= entry->first;
+        this->myRetainedBuffers--;
+      }
+    }
+  }
+}
+
+BufferPoolStats BufferPool::stats() const {
+  BufferPoolStats stats;
+  stats.hits= this->myHits.load();
+  stats.misses= this->myMisses.load();
+  stats.returned= this->myReturned.load();
+  stats.dropped= this->myDropped.load();
+  stats.retainedBytes= this->myRetainedBytes.load();
+  stats.retainedBuffers= this->myRetainedBuffers.load();
+  return stats;
+}
+
+void BufferPool::resetStats() {
+  this->myHits= 0;
+  this->myMisses= 0;
+  this->myReturned= 0;
+  this->myDropped= 0;
+}
+
+BufferPool& BufferPool::shared() {
+  static BufferPool* pool= []() {
+    size_t cap= (size_t) 256 << 20;
+    const char* env= std::getenv("PIXMAP_POOL_BYTES");
+    if (env != nullptr && *env != '\0') cap= std::strtoull(env, nullptr, 10);
+    return new BufferPool(cap);
+  }();
+
+  return *pool;
+}
+
+}  // namespace agl
@@ -0,0 +1,96 @@
+#ifndef AGL_BUFFER_POOL_H_
+#define AGL_BUFFER_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace agl {
+
+/**
+ * @brief Counters of a BufferPool since it was made (or last reset)
+ */
+struct BufferPoolStats {
+  size_t hits;          // acquires served from a retained buffer
+  size_t misses;        // acquires that had to allocate
+  size_t returned;      // releases kept for reuse
+  size_t dropped;       // releases freed because of the retention cap
+  size_t retainedBytes; // bytes currently held for reuse (not reset)
+  size_t retainedBuffers;
+};
+
+/**
+ * @brief Recycles large buffers by size class
+ *
+ * Freeing an image's pixels and allocating the next one of the same size
+ * otherwise goes back to the system (mmap/munmap for large blocks), which
+ * makes every page fault in again. Requests are rounded up to a size class
+ * (four per power of two, so at most 25% is wasted) and released buffers
+ * are kept per class, up to retentionCap() bytes in total; past that they
+ * are freed.
+ *
+ * Every thread has a home shard that it releases to and acquires from
+ * first, so threads rarely contend; an acquire that finds nothing there
+ * takes a buffer from another shard before allocating. Buffers are 64-byte
+ * aligned and may be released by a different thread than acquired them.
+ */
+class BufferPool {
+ public:
+  explicit BufferPool(size_t retentionCap);
+  ~BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  /**
+   * @brief Returns a buffer of at least bytes, contents undefined
+   *
+   * nullptr for 0 bytes. Give it back with release(buffer, bytes).
+   */
+  unsigned char* acquire(size_t bytes);
+
+  // bytes must be what the buffer was acquired with
+  void release(unsigned char* buffer, size_t bytes);
+
+  // Lowering the cap frees retained buffers until the pool is under it;
+  // 0 turns recycling off
+  void setRetentionCap(size_t bytes);
+  size_t retentionCap() const;
+
+  // Frees every retained buffer
+  void trim();
+
+  BufferPoolStats stats() const;
+  void resetStats();
+
+  // The size class bytes is rounded up to
+  static size_t classSize(size_t bytes);
+
+  /**
+   * @brief The pool Image allocates from
+   *
+   * Its cap is 256 MB unless the PIXMAP_POOL_BYTES environment variable
+   * gives another (PIXMAP_POOL_BYTES=0 disables it). It is never
+   * destroyed, so images with static storage can outlive main.
+   */
+  static BufferPool& shared();
+
+ private:
+  struct Shard;
+
+  // frees retained buffers until at most bytes are left
+  void shrinkTo(size_t bytes);
+
+  int myShardCount;
+  std::unique_ptr<Shard[]> myShards;
+  std::atomic<size_t> myCap;
+  std::atomic<size_t> myRetainedBytes;
+  std::atomic<size_t> myRetainedBuffers;
+  std::atomic<size_t> myHits;
+  std::atomic<size_t> myMisses;
+  std::atomic<size_t> myReturned;
+  std::atomic<size_t> myDropped;
+};
+
+}  // namespace agl
+#endif  // AGL_BUFFER_POOL_H_
@@ -0,0 +1,478 @@
+#include "color.h"
+#include "dispatch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace agl {
+
+// Pixels converted at a time when going between two non-RGB spaces
+static const int COLOR_CHUNK= 256;
+
+// Entries in the linear -> sRGB table of the 8-bit Lab path
+static const int LINEAR_STEPS= 1 << 14;
+
+// Steps of the interpolated Lab curve table over [0, 1] of the 8-bit path
+static const int LAB_STEPS= 1 << 12;
+
+static AGL_INLINE int clampByte(int value) {
+  return std::min(std::max(value, 0), 255);
+}
+
+// x / 255 rounded, for 0 <= x <= 255 * 255
+static AGL_INLINE int div255(int x) {
+  x+= 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+static inline float srgbToLinear(float v) {
+  return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+
+static inline float linearToSrgb(float v) {
+  v= std::min(std::max(v, 0.0f), 1.0f);
+  return v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+}
+
+// CIELab against the D65 white point
+static const float LAB_WHITE[3]= {0.95047f, 1.0f, 1.08883f};
+static const float LAB_EPSILON= 216.0f / 24389.0f;  // (6/29)^3
+static const float LAB_KAPPA= 24389.0f / 27.0f;     // (29/3)^3
+
+static inline float labF(float t) {
+  return t > LAB_EPSILON ? std::cbrt(t) : (LAB_KAPPA * t + 16.0f) / 116.0f;
+}
+
+// Lookup tables, built once on first use (thread-safe static init)
+struct ColorTables {
+  unsigned char toLinear[256];
+  unsigned char fromLinear[256];
+  float toLinearFloat[256];
+  unsigned char fromLinearFloat[LINEAR_STEPS + 1];
+  float labCurve[LAB_STEPS + 2];  // labF, one spare entry for interpolation
+
+  ColorTables() {
+    for (int i= 0; i < 256; i++) {
+      toLinearFloat[i]= srgbToLinear(i / 255.0f);
+      toLinear[i]= (unsigned char) std::lround(toLinearFloat[i] * 255.0f);
+      fromLinear[i]= (unsigned char) std::lround(linearToSrgb(i / 255.0f) * 255.0f);
+    }
+    for (int i= 0; i <= LINEAR_STEPS; i++) {
+      fromLinearFloat[i]= (unsigned char) std::lround(linearToSrgb((float) i / LINEAR_STEPS) * 255.0f);
+    }
+    for (int i= 0; i <= LAB_STEPS + 1; i++) {
+      labCurve[i]= labF((float) i / LAB_STEPS);
+    }
+  }
+};
+
+static const ColorTables& tables() {
+  static const ColorTables instance;
+  return instance;
+}
+
+// ---- 8-bit kernels ----
+
+// Pixels per block of the fixed-point kernels. Each block is split into
+// planar int arrays of a fixed size, which the compiler vectorizes even
+// at -O2 (the interleaved loops do not).
+static const int COLOR_BLOCK= 64;
+
+typedef void (*BlockKernel)(int* __restrict, int* __restrict, int* __restrict);
+
+template <BlockKernel kernel>
+static AGL_INLINE void convertBlock(const unsigned char* src, unsigned char* dst) {
+  int x[COLOR_BLOCK];
+  int y[COLOR_BLOCK];
+  int z[COLOR_BLOCK];
+  for (int i= 0; i < COLOR_BLOCK; i++) {
+    x[i]= src[3 * i];
+    y[i]= src[3 * i + 1];
+    z[i]= src[3 * i + 2];
+  }
+
+  kernel(x, y, z);
+
+  for (int i= 0; i < COLOR_BLOCK; i++) {
+    dst[3 * i]= (unsigned char) x[i];
+    dst[3 * i + 1]= (unsigned char) y[i];
+    dst[3 * i + 2]= (unsigned char) z[i];
+  }
+}
+
+// Runs kernel over whole blocks; the last partial block goes through a
+// padded copy. A block is read completely before it is written, so in
+// and out may be the same buffer.
+template <BlockKernel kernel>
+static AGL_INLINE void blockwise(const unsigned char* in, unsigned char* out, int count) {
+  int whole= count / COLOR_BLOCK * COLOR_BLOCK;
+  for (int start= 0; start < whole; start+= COLOR_BLOCK) {
+    convertBlock<kernel>(in + start * 3, out + start * 3);
+  }
+
+  if (whole < count) {
+    unsigned char staged[COLOR_BLOCK * 3]= {0};
+    std::memcpy(staged, in + whole * 3, (count - whole) * 3);
+    convertBlock<kernel>(staged, staged);
+    std::memcpy(out + whole * 3, staged, (count - whole) * 3);
+  }
+}
+
+// The hue and saturation divisions use float reciprocals so they
+// vectorize; every other step is integer
+static AGL_INLINE void rgbToHSVBlock(int* __restrict r, int* __restrict g, int* __restrict b) {
+  for (int i= 0; i < COLOR_BLOCK; i++) {
+    int v= std::max(r[i], std::max(g[i], b[i]));
+    int delta= v - std::min(r[i], std::min(g[i], b[i]));
+    int vr= v == r[i] ? -1 : 0;
+    int vg= v == g[i] ? -1 : 0;
+
+    // the sector offsets 0, 2 and 4 deltas pick which channel is largest
+    int h= (vr & (g[i] - b[i])) +
+           (~vr & ((vg & (b[i] - r[i] + 2 * delta)) + (~vg & (r[i] - g[i] + 4 * delta))));
+    // delta (and so h) is 0 when v is 0, so the max() only avoids 0 / 0
+    float hue= h * (256.0f / 6.0f) / std::max(delta, 1);
+    float saturation= delta * 255.0f / std::max(v, 1);
+
+    r[i]= (int) (hue + 256.5f) & 255;
+    g[i]= (int) (saturation + 0.5f);
+    b[i]= v;
+  }
+}
+
+static AGL_INLINE void hsvToRGBBlock(int* __restrict h, int* __restrict s, int* __restrict v) {
+  for (int i= 0; i < COLOR_BLOCK; i++) {
+    int h6= h[i] * 6;
+    int sector= h6 >> 8;
+    int f= h6 & 255;
+    int value= v[i];
+    int p= div255(value * (255 - s[i]));
+    int q= div255(value * (255 - div255(s[i] * f)));
+    int t= div255(value * (255 - div255(s[i] * (255 - f))));
+
+    // plain selects rather than a switch, so the loop stays branch-free
+    int r= p;
+    int g= p;
+    int b= p;
+    r= (sector == 1) ? q : r;
+    r= (sector == 4) ? t : r;
+    r= ((sector == 0) | (sector == 5)) ? value : r;
+    g= (sector == 0) ? t : g;
+    g= (sector == 3) ? q : g;
+    g= ((sector == 1) | (sector == 2)) ? value : g;
+    b= (sector == 2) ? t : b;
+    b= (sector == 5) ? q : b;
+    b= ((sector == 3) | (sector == 4)) ? value : b;
+    h[i]= r;
+    s[i]= g;
+    v[i]= b;
+  }
+}
+
+// JFIF coefficients in 16.16 fixed point
+static AGL_INLINE void rgbToYCbCrBlock(int* __restrict r, int* __restrict g, int* __restrict b) {
+  for (int i= 0; i < COLOR_BLOCK; i++) {
+    int y= (19595 * r[i] + 38470 * g[i] + 7471 * b[i] + 32768) >> 16;
+    int cb= (-11059 * r[i] - 21709 * g[i] + 32768 * b[i] + (128 << 16) + 32768) >> 16;
+    int cr= (32768 * r[i] - 27439 * g[i] - 5329 * b[i] + (128 << 16) + 32768) >> 16;
+    r[i]= y;
+    g[i]= clampByte(cb);
+    b[i]= clampByte(cr);
+  }
+}
+
+static AGL_INLINE void yCbCrToRGBBlock(int* __restrict y, int* __restrict cb, int* __restrict cr) {
+  for (int i= 0; i < COLOR_BLOCK; i++) {
+    int u= cb[i] - 128;
+    int w= cr[i] - 128;
+    int r= y[i] + ((91881 * w + 32768) >> 16);
+    int g= y[i] + ((-22554 * u - 46802 * w + 32768) >> 16);
+    int b= y[i] + ((116130 * u + 32768) >> 16);
+    y[i]= clampByte(r);
+    cb[i]= clampByte(g);
+    cr[i]= clampByte(b);
+  }
+}
+
+// One variant of each row conversion per instruction set (dispatch.h)
+static AGL_INLINE void rgbToHSVRow(const unsigned char* in, unsigned char* out, int count) {
+  blockwise<rgbToHSVBlock>(in, out, count);
+}
+
+static AGL_INLINE void hsvToRGBRow(const unsigned char* in, unsigned char* out, int count) {
+  blockwise<hsvToRGBBlock>(in, out, count);
+}
+
+static AGL_INLINE void rgbToYCbCrRow(const unsigned char* in, unsigned char* out, int count) {
+  blockwise<rgbToYCbCrBlock>(in, out, count);
+}
+
+static AGL_INLINE void yCbCrToRGBRow(const unsigned char* in, unsigned char* out, int count) {
+  blockwise<yCbCrToRGBBlock>(in, out, count);
+}
+
+AGL_VARIANTS(rgbToHSVRow, (const unsigned char* in, unsigned char* out, int count), (in, out, count))
+AGL_VARIANTS(hsvToRGBRow, (const unsigned char* in, unsigned char* out, int count), (in, out, count))
+AGL_VARIANTS(rgbToYCbCrRow, (const unsigned char* in, unsigned char* out, int count), (in, out, count))
+AGL_VARIANTS(yCbCrToRGBRow, (const unsigned char* in, unsigned char* out, int count), (in, out, count))
+
+static void lookup8(const unsigned char* table, const unsigned char* in,
+    unsigned char* out, int count) {
+  for (int i= 0; i < count * 3; i++) out[i]= table[in[i]];
+}
+
+// ---- float kernels ----
+
+static void rgbToHSVf(const float* in, float* out, int count) {
+  for (int i= 0; i < count * 3; i+= 3) {
+    float r= in[i];
+    float g= in[i + 1];
+    float b= in[i + 2];
+    float v= std::max(r, std::max(g, b));
+    float delta= v - std::min(r, std::min(g, b));
+    float h= 0.0f;
+    if (delta > 0.0f) {
+      if (v == r) h= (g - b) / delta;
+      else if (v == g) h= 2.0f + (b - r) / delta;
+      else h= 4.0f + (r - g) / delta;
+      h*= 60.0f;
+      if (h < 0.0f) h+= 360.0f;
+    }
+    out[i]= h;
+    out[i + 1]= v > 0.0f ? delta / v : 0.0f;
+    out[i + 2]= v;
+  }
+}
+
+static void hsvToRGBf(const float* in, float* out, int count) {
+  for (int i= 0; i < count * 3; i+= 3) {
+    float h= in[i] / 60.0f;
+    float s= in[i + 1];
+    float v= in[i + 2];
+    h-= 6.0f * std::floor(h / 6.0f);
+    int sector= std::min((int) h, 5);
+    float f= h - sector;
+    float p= v * (1.0f - s);
+    float q= v * (1.0f - s * f);
+    float t= v * (1.0f - s * (1.0f - f));
+
+    float r, g, b;
+    switch (sector) {
+      case 0: r= v; g= t; b= p; break;
+      case 1: r= q; g= v; b= p; break;
+      case 2: r= p; g= v; b= t; break;
+      case 3: r= p; g= q; b= v; break;
+      case 4: r= t; g= p; b= v; break;
+      default: r= v; g= p; b= q; break;
+    }
+    out[i]= r;
+    out[i + 1]= g;
+    out[i + 2]= b;
+  }
+}
+
+static void rgbToYCbCrf(const float* in, float* out, int count) {
+  for (int i= 0; i < count * 3; i+= 3) {
+    float r= in[i];
+    float g= in[i + 1];
+    float b= in[i + 2];
+    out[i]= 0.299f * r + 0.587f * g + 0.114f * b;
+    out[i + 1]= -0.168736f * r - 0.331264f * g + 0.5f * b;
+    out[i + 2]= 0.5f * r - 0.418688f * g - 0.081312f * b;
+  }
+}
+
+static void yCbCrToRGBf(const float* in, float* out, int count) {
+  for (int i= 0; i < count * 3; i+= 3) {
+    float y= in[i];
+    float cb= in[i + 1];
+    float cr= in[i + 2];
+    out[i]= y + 1.402f * cr;
+    out[i + 1]= y - 0.344136f * cb - 0.714136f * cr;
+    out[i + 2]= y + 1.772f * cb;
+  }
+}
+
+static void rgbToLinearf(const float* in, float* out, int count) {
+  for (int i= 0; i < count * 3; i++) out[i]= srgbToLinear(in[i]);
+}
+
+static void linearToRGBf(const float* in, float* out, int count) {
+  for (int i= 0; i < count * 3; i++) out[i]= linearToSrgb(in[i]);
+}
+
+
+static inline float labInverseF(float f) {
+  float cube= f * f * f;
+  return cube > LAB_EPSILON ? cube : (116.0f * f - 16.0f) / LAB_KAPPA;
+}
+
+// curve is labF, or a faster approximation of it
+template <typename Curve>
+static void linearToLab(const float* in, float* out, int count, Curve curve) {
+  for (int i= 0; i < count * 3; i+= 3) {
+    float r= in[i];
+    float g= in[i + 1];
+    float b= in[i + 2];
+    float fx= curve((0.4124564f * r + 0.3575761f * g + 0.1804375f * b) / LAB_WHITE[0]);
+    float fy= curve((0.2126729f * r + 0.7151522f * g + 0.0721750f * b) / LAB_WHITE[1]);
+    float fz= curve((0.0193339f * r + 0.1191920f * g + 0.9503041f * b) / LAB_WHITE[2]);
+    out[i]= 116.0f * fy - 16.0f;
+    out[i + 1]= 500.0f * (fx - fy);
+    out[i + 2]= 200.0f * (fy - fz);
+  }
+}
+
+static void labToLinear(const float* in, float* out, int count) {
+  for (int i= 0; i < count * 3; i+= 3) {
+    float fy= (in[i] + 16.0f) / 116.0f;
+    float x= LAB_WHITE[0] * labInverseF(fy + in[i + 1] / 500.0f);
+    float y= LAB_WHITE[1] * labInverseF(fy);
+    float z= LAB_WHITE[2] * labInverseF(fy - in[i + 2] / 200.0f);
+    out[i]= 3.2404542f * x - 1.5371385f * y - 0.4985314f * z;
+    out[i + 1]= -0.9692660f * x + 1.8760108f * y + 0.0415560f * z;
+    out[i + 2]= 0.0556434f * x - 0.2040259f * y + 1.0572252f * z;
+  }
+}
+
+static void rgbToLabf(const float* in, float* out, int count) {
+  rgbToLinearf(in, out, count);
+  linearToLab(out, out, count, labF);
+}
+
+static void labToRGBf(const float* in, float* out, int count) {
+  labToLinear(in, out, count);
+  linearToRGBf(out, out, count);
+}
+
+// 8-bit Lab through the float kernels, with tables for the sRGB curve and
+// the cube root. The 8-bit encoding is lossy for saturated colours near
+// the gamut edge (a round trip can move a channel by up to ~25); use the
+// float path when that matters
+static void rgbToLab8(const unsigned char* in, unsigned char* out, int count) {
+  const ColorTables& t= tables();
+  float lab[COLOR_CHUNK * 3];
+  for (int start= 0; start < count; start+= COLOR_CHUNK) {
+    int n= std::min(COLOR_CHUNK, count - start);
+    const unsigned char* src= in + start * 3;
+    for (int i= 0; i < n * 3; i++) lab[i]= t.toLinearFloat[src[i]];
+
+    // t stays within [0, 1] for 8-bit input (up to rounding)
+    linearToLab(lab, lab, n, [&t](float value) {
+      float position= std::min(std::max(value, 0.0f), 1.0f) * LAB_STEPS;
+      int index= (int) position;
+      float fraction= position - index;
+      return t.labCurve[index] + fraction * (t.labCurve[index + 1] - t.labCurve[index]);
+    });
+
+    unsigned char* dst= out + start * 3;
+    for (int i= 0; i < n * 3; i+= 3) {
+      dst[i]= (unsigned char) clampByte((int) std::lround(lab[i] * 2.55f));
+      dst[i + 1]= (unsigned char) clampByte((int) std::lround(lab[i + 1]) + 128);
+      dst[i + 2]= (unsigned char) clampByte((int) std::lround(lab[i + 2]) + 128);
+    }
+  }
+}
+
+static void labToRGB8(const unsigned char* in, unsigned char* out, int count) {
+  const ColorTables& t= tables();
+  float rgb[COLOR_CHUNK * 3];
+  for (int start= 0; start < count; start+= COLOR_CHUNK) {
+    int n= std::min(COLOR_CHUNK, count - start);
+    const unsigned char* src= in + start * 3;
+    for (int i= 0; i < n * 3; i+= 3) {
+      rgb[i]= src[i] / 2.55f;
+      rgb[i + 1]= src[i + 1] - 128.0f;
+      rgb[i + 2]= src[i + 2] - 128.0f;
+    }
+    labToLinear(rgb, rgb, n);
+
+    unsigned char* dst= out + start * 3;
+    for (int i= 0; i < n * 3; i++) {
+      float v= std::min(std::max(rgb[i], 0.0f), 1.0f);
+      dst[i]= t.fromLinearFloat[(int) (v * LINEAR_STEPS + 0.5f)];
+    }
+  }
+}
+
+// ---- dispatch ----
+
+static void fromRGB(ColorSpace to, const unsigned char* in, unsigned char* out, int count,
+    Isa isa) {
+  switch (to) {
+    case COLOR_HSV: rgbToHSVRowVariants[isa](in, out, count); break;
+    case COLOR_YCBCR: rgbToYCbCrRowVariants[isa](in, out, count); break;
+    case COLOR_LAB: rgbToLab8(in, out, count); break;
+    case COLOR_LINEAR: lookup8(tables().toLinear, in, out, count); break;
+    default: std::memmove(out, in, count * 3); break;
+  }
+}
+
+static void toRGB(ColorSpace from, const unsigned char* in, unsigned char* out, int count,
+    Isa isa) {
+  switch (from) {
+    case COLOR_HSV: hsvToRGBRowVariants[isa](in, out, count); break;
+    case COLOR_YCBCR: yCbCrToRGBRowVariants[isa](in, out, count); break;
+    case COLOR_LAB: labToRGB8(in, out, count); break;
+    case COLOR_LINEAR: lookup8(tables().fromLinear, in, out, count); break;
+    default: std::memmove(out, in, count * 3); break;
+  }
+}
+
+// the float kernels are not multi-versioned; isa keeps convert() generic
+static void fromRGB(ColorSpace to, const float* in, float* out, int count, Isa) {
+  switch (to) {
+    case COLOR_HSV: rgbToHSVf(in, out, count); break;
+    case COLOR_YCBCR: rgbToYCbCrf(in, out, count); break;
+    case COLOR_LAB: rgbToLabf(in, out, count); break;
+    case COLOR_LINEAR: rgbToLinearf(in, out, count); break;
+    default: std::memmove(out, in, count * 3 * sizeof(float)); break;
+  }
+}
+
+static void toRGB(ColorSpace from, const float* in, float* out, int count, Isa) {
+  switch (from) {
+    case COLOR_HSV: hsvToRGBf(in, out, count); break;
+    case COLOR_YCBCR: yCbCrToRGBf(in, out, count); break;
+    case COLOR_LAB: labToRGBf(in, out, count); break;
+    case COLOR_LINEAR: linearToRGBf(in, out, count); break;
+    default: std::memmove(out, in, count * 3 * sizeof(float)); break;
+  }
+}
+
+template <typename T>
+static void convert(ColorSpace from, ColorSpace to, const T* in, T* out, int count, Isa isa) {
+  if (from == to) {
+    if (in != out) std::memmove(out, in, count * 3 * sizeof(T));
+    return;
+  }
+  if (from == COLOR_RGB || to == COLOR_RGB) {
+    if (from == COLOR_RGB) fromRGB(to, in, out, count, isa);
+    else toRGB(from, in, out, count, isa);
+    return;
+  }
+
+  T rgb[COLOR_CHUNK * 3];
+  for (int start= 0; start < count; start+= COLOR_CHUNK) {
+    int n= std::min(COLOR_CHUNK, count - start);
+    toRGB(from, in + start * 3, rgb, n, isa);
+    fromRGB(to, rgb, out + start * 3, n, isa);
+  }
+}
+
+void convertColors(ColorSpace from, ColorSpace to, const unsigned char* in,
+    unsigned char* out, int count) {
+  convert(from, to, in, out, count, activeIsa());
+}
+
+void convertColors(ColorSpace from, ColorSpace to, const unsigned char* in,
+    unsigned char* out, int count, Isa isa) {
+  convert(from, to, in, out, count, isa);
+}
+
+void convertColors(ColorSpace from, ColorSpace to, const float* in,
+    float* out, int count) {
+  convert(from, to, in, out, count, ISA_SCALAR);
+}
+
+}  // namespace agl
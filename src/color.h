@@ -0,0 +1,53 @@
+#ifndef AGL_COLOR_H_
+#define AGL_COLOR_H_
+
+#include "dispatch.h"
+
+namespace agl {
+
+/**
+ * Colour spaces understood by convertColors. Pixels are always 3
+ * interleaved channels.
+ *
+ * 8-bit encodings (unsigned char):
+ *   COLOR_RGB     sRGB, 0..255
+ *   COLOR_HSV     hue 0..255 for the full circle, saturation and value 0..255
+ *   COLOR_YCBCR   JPEG (JFIF) full range: Y 0..255, Cb and Cr centred on 128
+ *   COLOR_LAB     CIELab D65: L * 255 / 100, a + 128, b + 128
+ *   COLOR_LINEAR  linear-light RGB, 0..255
+ *
+ * float encodings:
+ *   COLOR_RGB     sRGB, 0..1
+ *   COLOR_HSV     hue in degrees 0..360, saturation and value 0..1
+ *   COLOR_YCBCR   Y 0..1, Cb and Cr -0.5..0.5
+ *   COLOR_LAB     L 0..100, a and b roughly -128..127
+ *   COLOR_LINEAR  linear-light RGB, 0..1
+ */
+enum ColorSpace {COLOR_RGB, COLOR_HSV, COLOR_YCBCR, COLOR_LAB, COLOR_LINEAR};
+
+/**
+ * @brief Converts count 8-bit pixels between colour spaces
+ *
+ * RGB <-> HSV, YCbCr and linear use fixed-point integer kernels written
+ * without branches so that they vectorize; Lab goes through float. Other
+ * pairs go through RGB. in and out may be the same buffer. The HSV and
+ * YCbCr kernels are multi-versioned and run with activeIsa().
+ */
+void convertColors(ColorSpace from, ColorSpace to, const unsigned char* in,
+  unsigned char* out, int count);
+
+// As above, with the kernels compiled for a given instruction set
+void convertColors(ColorSpace from, ColorSpace to, const unsigned char* in,
+  unsigned char* out, int count, Isa isa);
+
+/**
+ * @brief Converts count float pixels between colour spaces
+ *
+ * Exact formulas, for when 8-bit rounding between steps is too lossy.
+ * in and out may be the same buffer.
+ */
+void convertColors(ColorSpace from, ColorSpace to, const float* in,
+  float* out, int count);
+
+}  // namespace agl
+#endif  // AGL_COLOR_H_
@@ -0,0 +1,120 @@
+#include "dispatch.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace agl {
+
+static const char* const ISA_NAMES[ISA_COUNT]= {"scalar", "sse4.1", "avx2", "avx512"};
+
+static std::atomic<long long> gMismatches(0);
+
+Isa detectedIsa() {
+  static const Isa detected= []() {
+#ifdef AGL_DISPATCH_X86
+    // also checks that the OS saves the wider registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return ISA_AVX512;
+    if (__builtin_cpu_supports("avx2")) return ISA_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return ISA_SSE41;
+#endif
+    return ISA_SCALAR;
+  }();
+
+  return detected;
+}
+
+// the requested ISA, or -1 until the environment has been read
+static std::atomic<int>& activeSetting() {
+  static std::atomic<int> setting(-1);
+  return setting;
+}
+
+static Isa isaFromEnvironment() {
+  Isa best= detectedIsa();
+  const char* env= std::getenv("PIXMAP_ISA");
+  if (env == nullptr || *env == '\0') return best;
+
+  for (int i= 0; i < ISA_COUNT; i++) {
+    if (std::strcmp(env, ISA_NAMES[i]) == 0) {
+      if (i > best) {
+        std::cerr << "PIXMAP_ISA=" << env << " is not supported here, using "
+          << ISA_NAMES[best] << std::endl;
+        return best;
+      }
+      return (Isa) i;
+    }
+  }
+  std::cerr << "Unknown PIXMAP_ISA=" << env << ", using " << ISA_NAMES[best] << std::endl;
+  return best;
+}
+
+Isa activeIsa() {
+  int isa= activeSetting().load(std::memory_order_relaxed);
+  if (isa < 0) {
+    static const Isa fromEnvironment= isaFromEnvironment();
+    int expected= -1;
+    activeSetting().compare_exchange_strong(expected, fromEnvironment);
+    isa= activeSetting().load(std::memory_order_relaxed);
+  }
+  return (Isa) isa;
+}
+
+void setActiveIsa(Isa isa) {
+  activeSetting().store(std::min(isa, detectedIsa()));
+}
+
+const char* isaName(Isa isa) {
+  return (isa >= 0 && isa < ISA_COUNT) ? ISA_NAMES[isa] : "unknown";
+}
+
+static std::atomic<bool>& verifySetting() {
+  static std::atomic<bool> setting(std::getenv("PIXMAP_VERIFY") != nullptr);
+  return setting;
+}
+
+bool verifyKernels() {
+  return verifySetting().load(std::memory_order_relaxed);
+}
+
+void setVerifyKernels(bool enabled) {
+  verifySetting().store(enabled);
+}
+
+bool checkAgainstScalar(const char* operation, Isa isa, const unsigned char* result,
+    const unsigned char* reference, size_t rowBytes, int rows, size_t stride) {
+  // only the first rowBytes of every row are compared, not the padding
+  size_t first= 0;
+  size_t differing= 0;
+  for (int r= 0; r < rows; r++) {
+    const unsigned char* a= result + r * stride;
+    const unsigned char* b= reference + r * stride;
+    if (std::memcmp(a, b, rowBytes) == 0) continue;
+
+    for (size_t i= 0; i < rowBytes; i++) {
+      if (a[i] != b[i]) {
+        if (differing == 0) first= r * rowBytes + i;
+        differing++;
+      }
+    }
+  }
+  if (differing == 0) return true;
+
+  size_t firstRow= first / rowBytes;
+  size_t firstCol= first % rowBytes;
+  std::cerr << "PIXMAP_VERIFY: " << operation << " with " << isaName(isa)
+    << " differs from scalar in " << differing << " of " << rowBytes * rows
+    << " bytes, first at byte " << first << " ("
+    << (int) result[firstRow * stride + firstCol] << " vs "
+    << (int) reference[firstRow * stride + firstCol] << ")" << std::endl;
+  gMismatches++;
+  return false;
+}
+
+long long verifyMismatches() {
+  return gMismatches.load();
+}
+
+}  // namespace agl
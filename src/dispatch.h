@@ -0,0 +1,123 @@
+#ifndef AGL_DISPATCH_H_
+#define AGL_DISPATCH_H_
+
+#include <cstddef>
+
+namespace agl {
+
+/**
+ * Instruction sets the multi-versioned kernels are compiled for. The
+ * binary is built for the baseline target only; the faster variants are
+ * compiled per function (AGL_TARGET) and picked at run time, so one build
+ * runs everywhere and still uses AVX2 or AVX-512 where they exist.
+ *
+ * ISA_SCALAR is the kernels compiled for the baseline target with
+ * vectorization off (AGL_SCALAR), one element at a time; it is the
+ * reference every other variant must match byte for byte.
+ */
+enum Isa {ISA_SCALAR, ISA_SSE41, ISA_AVX2, ISA_AVX512, ISA_COUNT};
+
+// Best instruction set this CPU and OS support (ISA_SCALAR off x86)
+Isa detectedIsa();
+
+/**
+ * @brief Instruction set the kernels use
+ *
+ * detectedIsa(), unless the PIXMAP_ISA environment variable asks for a
+ * lower one: scalar, sse4.1, avx2 or avx512. Asking for more than the CPU
+ * supports falls back to detectedIsa() with a warning.
+ */
+Isa activeIsa();
+
+// Overrides activeIsa() from now on (capped to detectedIsa())
+void setActiveIsa(Isa isa);
+
+// "scalar", "sse4.1", "avx2" or "avx512"
+const char* isaName(Isa isa);
+
+/**
+ * @brief Whether operations cross-check their kernels
+ *
+ * On when the PIXMAP_VERIFY environment variable is set. Operations with
+ * multi-versioned kernels then also run the ISA_SCALAR ones and report
+ * any output byte that differs (see checkAgainstScalar).
+ */
+bool verifyKernels();
+void setVerifyKernels(bool enabled);
+
+/**
+ * @brief Compares an operation's output with the scalar reference
+ *
+ * Both buffers hold rows of rowBytes bytes, stride bytes apart.
+ * @return true if all bytes match; otherwise prints the first mismatch
+ *   to stderr and counts it in verifyMismatches()
+ */
+bool checkAgainstScalar(const char* operation, Isa isa, const unsigned char* result,
+  const unsigned char* reference, size_t rowBytes, int rows, size_t stride);
+
+// Mismatching operations reported so far
+long long verifyMismatches();
+
+}  // namespace agl
+
+// AGL_TARGET("avx2") compiles one function for an instruction set; the
+// kernel bodies it calls must be AGL_INLINE so they are compiled into it.
+// The build needs -ffp-contract=off: AVX-512 brings fused multiply-add,
+// which rounds float kernels differently from the scalar variant.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define AGL_DISPATCH_X86 1
+#define AGL_TARGET(isa) __attribute__((target(isa)))
+#define AGL_INLINE inline __attribute__((always_inline))
+#else
+#define AGL_TARGET(isa)
+#define AGL_INLINE inline
+#endif
+
+// Compiles a function without auto-vectorization, so the ISA_SCALAR
+// reference really is scalar rather than the baseline build's SSE2 code.
+// clang has no per-function switch for it; there the reference is the
+// baseline build, vectorized or not.
+#if defined(__GNUC__) && !defined(__clang__)
+#define AGL_SCALAR __attribute__((optimize("no-tree-vectorize")))
+#else
+#define AGL_SCALAR
+#endif
+
+// clang's target attribute has no vector width option
+#ifdef __clang__
+#define AGL_AVX512 "avx512f,avx512bw"
+#else
+#define AGL_AVX512 "avx512f,avx512bw,prefer-vector-width=256"
+#endif
+
+// Placed before a loop whose iterations are independent although the
+// compiler cannot prove it (say, rows of one buffer that never overlap).
+// Inlining drops __restrict, and -O2 does not add runtime alias checks
+#if defined(__clang__)
+#define AGL_IVDEP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define AGL_IVDEP _Pragma("GCC ivdep")
+#else
+#define AGL_IVDEP
+#endif
+
+/**
+ * Defines name##Variants, a table indexed by Isa of void functions taking
+ * params, each compiled for its instruction set and forwarding args to
+ * the AGL_INLINE body `name`. The AVX-512 variant keeps to 256-bit
+ * vectors: the kernels reload what they just stored, which full-width
+ * registers made slower than AVX2 on the CPUs measured.
+ *
+ *   static AGL_INLINE void addRow(const float* a, float* b, int n) { ... }
+ *   AGL_VARIANTS(addRow, (const float* a, float* b, int n), (a, b, n))
+ *   addRowVariants[activeIsa()](a, b, n);
+ */
+#define AGL_VARIANTS(name, params, args) \
+  AGL_SCALAR static void name##Scalar params { name args; } \
+  AGL_TARGET("sse4.1") static void name##Sse41 params { name args; } \
+  AGL_TARGET("avx2") static void name##Avx2 params { name args; } \
+  AGL_TARGET(AGL_AVX512) static void name##Avx512 params { name args; } \
+  static void (* const name##Variants[agl::ISA_COUNT]) params= \
+    {name##Scalar, name##Sse41, name##Avx2, name##Avx512};
+
+#endif  // AGL_DISPATCH_H_
@@ -0,0 +1,122 @@
+#include "fft.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace agl {
+
+// std::complex multiplication handles inf/nan specially (and slowly); the
+// values here are always finite
+static inline Complex multiply(Complex a, Complex b) {
+  return Complex(a.real() * b.real() - a.imag() * b.imag(),
+                 a.real() * b.imag() + a.imag() * b.real());
+}
+
+static inline Complex twiddle(const std::vector<Complex>& twiddles, int k, bool inverse) {
+  return inverse ? std::conj(twiddles[k]) : twiddles[k];
+}
+
+int nextPowerOfTwo(int n) {
+  int p= 1;
+  while (p < n) p*= 2;
+  return p;
+}
+
+FFT::FFT(int size, Isa isa): mySize(size), myIsa(isa), myReversed(size), myTwiddles(size / 2) {
+  assert(size > 0 && (size & (size - 1)) == 0);
+
+  int bits= 0;
+  while ((1 << bits) < size) bits++;
+  for (int i= 0; i < size; i++) {
+    int r= 0;
+    for (int b= 0; b < bits; b++) {
+      if (i & (1 << b)) r|= 1 << (bits - 1 - b);
+    }
+    this->myReversed[i]= r;
+  }
+
+  // computed in double so large sizes do not accumulate error
+  const double pi= std::acos(-1.0);
+  for (int k= 0; k < size / 2; k++) {
+    double angle= -2.0 * pi * k / size;
+    this->myTwiddles[k]= Complex((float) std::cos(angle), (float) std::sin(angle));
+  }
+}
+
+void FFT::transform(Complex* data, bool inverse) const {
+  int n= this->mySize;
+  for (int i= 0; i < n; i++) {
+    int r= this->myReversed[i];
+    if (i < r) std::swap(data[i], data[r]);
+  }
+
+  for (int length= 2; length <= n; length*= 2) {
+    int half= length / 2;
+    int step= n / length;
+    for (int start= 0; start < n; start+= length) {
+      for (int k= 0; k < half; k++) {
+        Complex w= twiddle(this->myTwiddles, k * step, inverse);
+        Complex a= data[start + k];
+        Complex b= multiply(data[start + k + half], w);
+        data[start + k]= a + b;
+        data[start + k + half]= a - b;
+      }
+    }
+  }
+}
+
+// One butterfly applied to every column: a, b are rows of `count` values
+static AGL_INLINE void butterflyRows(float* __restrict a, float* __restrict b, int count,
+    float wr, float wi) {
+  for (int j= 0; j < 2 * count; j+= 2) {
+    float br= b[j] * wr - b[j + 1] * wi;
+    float bi= b[j] * wi + b[j + 1] * wr;
+    float ar= a[j];
+    float ai= a[j + 1];
+    a[j]= ar + br;
+    a[j + 1]= ai + bi;
+    b[j]= ar - br;
+    b[j + 1]= ai - bi;
+  }
+}
+
+// Every butterfly stage of transformColumns, after the bit reversal
+static AGL_INLINE void columnStages(float* values, int n, int count,
+    const Complex* twiddles, bool inverse) {
+  for (int length= 2; length <= n; length*= 2) {
+    int half= length / 2;
+    int step= n / length;
+    for (int start= 0; start < n; start+= length) {
+      for (int k= 0; k < half; k++) {
+        Complex w= inverse ? std::conj(twiddles[k * step]) : twiddles[k * step];
+        butterflyRows(values + (size_t) (start + k) * count * 2,
+                      values + (size_t) (start + k + half) * count * 2, count,
+                      w.real(), w.imag());
+      }
+    }
+  }
+}
+AGL_VARIANTS(columnStages, (float* values, int n, int count, const Complex* twiddles,
+  bool inverse), (values, n, count, twiddles, inverse))
+
+void FFT::transformColumns(Complex* data, int count, bool inverse) const {
+  int n= this->mySize;
+  for (int i= 0; i < n; i++) {
+    int r= this->myReversed[i];
+    if (i < r) std::swap_ranges(data + (size_t) i * count, data + (size_t) (i + 1) * count,
+                                data + (size_t) r * count);
+  }
+
+  columnStagesVariants[this->myIsa](reinterpret_cast<float*>(data), n, count,
+                                    this->myTwiddles.data(), inverse);
+}
+
+void FFT::transform2D(Complex* data, bool inverse) const {
+  int n= this->mySize;
+  for (int i= 0; i < n; i++) {
+    this->transform(data + (size_t) i * n, inverse);
+  }
+  this->transformColumns(data, n, inverse);
+}
+
+}  // namespace agl
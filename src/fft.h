@@ -0,0 +1,61 @@
+#ifndef AGL_FFT_H_
+#define AGL_FFT_H_
+
+#include <complex>
+#include <vector>
+#include "dispatch.h"
+
+namespace agl {
+
+typedef std::complex<float> Complex;
+
+/**
+ * @brief Radix-2 complex FFT of a fixed power-of-two size
+ *
+ * Twiddles and the bit-reversal permutation are computed once, so one
+ * FFT can be shared by any number of threads. The inverse transform is
+ * not normalized; callers divide by size() (per dimension) themselves.
+ * The column transforms are multi-versioned and run with the instruction
+ * set given at construction.
+ */
+class FFT {
+ public:
+  explicit FFT(int size, Isa isa = activeIsa());
+
+  int size() const { return mySize; }
+  Isa isa() const { return myIsa; }
+
+  /**
+   * @brief In-place transform of size() contiguous values
+   * @param inverse Use the +i exponent instead of -i
+   */
+  void transform(Complex* data, bool inverse) const;
+
+  /**
+   * @brief In-place transform of `count` sequences stored side by side
+   *
+   * Element k of sequence j is data[k * count + j], i.e. the columns of a
+   * size() x count row-major array. Every butterfly updates a whole row
+   * of values, so the inner loops run over contiguous memory.
+   */
+  void transformColumns(Complex* data, int count, bool inverse) const;
+
+  /**
+   * @brief In-place 2-D transform of a size() x size() row-major array
+   */
+  void transform2D(Complex* data, bool inverse) const;
+
+ private:
+  int mySize;
+  Isa myIsa;
+  std::vector<int> myReversed;
+  std::vector<Complex> myTwiddles;  // exp(-2 pi i k / size), k < size / 2
+};
+
+/**
+ * @brief Returns the smallest power of two >= n
+ */
+int nextPowerOfTwo(int n);
+
+}  // namespace agl
+#endif  // AGL_FFT_H_
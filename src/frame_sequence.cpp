@@ -0,0 +1,161 @@
+#include "frame_sequence.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "parallel.h"
+
+namespace agl {
+
+FrameSequence::FrameSequence(int width, int height, int window):
+  myWidth(width), myHeight(height), myWindow(window), myCount(0),
+  myNewest(window), myFrameCount(0) {
+  assert(width > 0 && height > 0);
+  assert(window >= 1 && window <= MAX_WINDOW);
+
+  this->myBuffers.reserve(window + 1);
+  for (int i= 0; i <= window; i++) this->myBuffers.emplace_back(width, height);
+  this->mySums.assign((size_t) width * height * 3, 0);
+}
+
+FrameSequence::~FrameSequence() {
+}
+
+int FrameSequence::width() const {
+  return this->myWidth;
+}
+
+int FrameSequence::height() const {
+  return this->myHeight;
+}
+
+int FrameSequence::window() const {
+  return this->myWindow;
+}
+
+int FrameSequence::size() const {
+  return this->myCount;
+}
+
+long long FrameSequence::frameCount() const {
+  return this->myFrameCount;
+}
+
+void FrameSequence::reset() {
+  this->myCount= 0;
+  this->myFrameCount= 0;
+  std::fill(this->mySums.begin(), this->mySums.end(), 0);
+}
+
+Image& FrameSequence::nextFrame() {
+  return this->myBuffers[(this->myNewest + 1) % this->myBuffers.size()];
+}
+
+void FrameSequence::commit() {
+  // the running sums gain the new frame and lose the one leaving the window
+  const Image* evicted= this->myCount == this->myWindow ? &this->frame(this->myWindow - 1) : nullptr;
+
+  parallelFor(this->myHeight, [this, evicted](int, int begin, int end) {
+    int rowBytes= this->myWidth * 3;
+    const Image& added= this->nextFrame();
+    for (int i= begin; i < end; i++) {
+      unsigned int* sums= this->mySums.data() + (size_t) i * rowBytes;
+      const unsigned char* in= added.rowData(i);
+      for (int j= 0; j < rowBytes; j++) sums[j]+= in[j];
+      if (evicted != nullptr) {
+        const unsigned char* old= evicted->rowData(i);
+        for (int j= 0; j < rowBytes; j++) sums[j]-= old[j];
+      }
+    }
+  });
+
+  this->myNewest= (this->myNewest + 1) % this->myBuffers.size();
+  this->myCount= std::min(this->myCount + 1, this->myWindow);
+  this->myFrameCount++;
+}
+
+void FrameSequence::push(const Image& frame) {
+  assert(frame.width() == this->myWidth && frame.height() == this->myHeight);
+  Image& next= this->nextFrame();
+  for (int i= 0; i < this->myHeight; i++) {
+    std::memcpy(next.rowData(i), frame.rowData(i), this->myWidth * 3);
+  }
+  this->commit();
+}
+
+const Image& FrameSequence::frame(int age) const {
+  assert(age >= 0 && age < this->myCount);
+  int buffers= (int) this->myBuffers.size();
+  return this->myBuffers[(this->myNewest - age + buffers) % buffers];
+}
+
+void FrameSequence::prepare(Image& out) const {
+  if (out.width() != this->myWidth || out.height() != this->myHeight) {
+    out= Image(this->myWidth, this->myHeight);
+  }
+}
+
+void FrameSequence::average(Image& out) const {
+  assert(this->myCount > 0);
+  this->prepare(out);
+
+  parallelFor(this->myHeight, [this, &out](int, int begin, int end) {
+    int rowBytes= this->myWidth * 3;
+    float inverse= 1.0f / this->myCount;
+    for (int i= begin; i < end; i++) {
+      const unsigned int* sums= this->mySums.data() + (size_t) i * rowBytes;
+      unsigned char* dst= out.rowData(i);
+      for (int j= 0; j < rowBytes; j++) {
+        dst[j]= (unsigned char) (sums[j] * inverse + 0.5f);
+      }
+    }
+  });
+}
+
+void FrameSequence::motionMask(Image& out, int threshold, int age) const {
+  assert(age >= 1 && age < this->myCount);
+  this->prepare(out);
+  const Image& current= this->frame(0);
+  const Image& previous= this->frame(age);
+
+  parallelFor(this->myHeight, [&current, &previous, &out, threshold](int, int begin, int end) {
+    int width= out.width();
+    for (int i= begin; i < end; i++) {
+      const unsigned char* a= current.rowData(i);
+      const unsigned char* b= previous.rowData(i);
+      unsigned char* dst= out.rowData(i);
+      for (int j= 0; j < width; j++) {
+        int red= std::abs(a[3 * j] - b[3 * j]);
+        int green= std::abs(a[3 * j + 1] - b[3 * j + 1]);
+        int blue= std::abs(a[3 * j + 2] - b[3 * j + 2]);
+        unsigned char value= std::max(red, std::max(green, blue)) > threshold ? 255 : 0;
+        dst[3 * j]= value;
+        dst[3 * j + 1]= value;
+        dst[3 * j + 2]= value;
+      }
+    }
+  });
+}
+
+void FrameSequence::median(Image& out) const {
+  assert(this->myCount > 0);
+  this->prepare(out);
+
+  parallelFor(this->myHeight, [this, &out](int, int begin, int end) {
+    int count= this->myCount;
+    int rowBytes= this->myWidth * 3;
+    const unsigned char* rows[MAX_WINDOW];
+    unsigned char values[MAX_WINDOW];
+
+    for (int i= begin; i < end; i++) {
+      for (int f= 0; f < count; f++) rows[f]= this->frame(f).rowData(i);
+      unsigned char* dst= out.rowData(i);
+      for (int j= 0; j < rowBytes; j++) {
+        for (int f= 0; f < count; f++) values[f]= rows[f][j];
+        std::nth_element(values, values + count / 2, values + count);
+        dst[j]= values[count / 2];
+      }
+    }
+  });
+}
+
+}  // namespace agl
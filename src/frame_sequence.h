@@ -0,0 +1,95 @@
+#ifndef AGL_FRAME_SEQUENCE_H_
+#define AGL_FRAME_SEQUENCE_H_
+
+#include <vector>
+#include "image.h"
+
+namespace agl {
+
+/**
+ * @brief Sliding window over a stream of same-sized frames, with temporal
+ * operations, that recycles a fixed pool of frame buffers
+ *
+ * The sequence owns window + 1 Images, allocated once: the last `window`
+ * frames plus the buffer the next frame is written into. Temporal results
+ * go into caller-owned Images that are only reallocated when their size
+ * is wrong, so a loop that reuses the same outputs allocates no pixel
+ * memory once it is running.
+ *
+ *   FrameSequence frames(width, height, 5);
+ *   Image mask, background;
+ *   while (decodeFrame(frames.nextFrame())) {
+ *     frames.commit();
+ *     frames.motionMask(mask, 30);
+ *     frames.median(background);
+ *   }
+ */
+class FrameSequence {
+ public:
+  // Largest window the temporal median supports
+  static const int MAX_WINDOW= 255;
+
+  FrameSequence(int width, int height, int window);
+  virtual ~FrameSequence();
+
+  FrameSequence(const FrameSequence&) = delete;
+  FrameSequence& operator=(const FrameSequence&) = delete;
+
+  int width() const;
+  int height() const;
+  int window() const;
+
+  // Frames currently held, up to window()
+  int size() const;
+
+  // Frames committed since construction or reset()
+  long long frameCount() const;
+
+  // Drops every frame (the buffers are kept)
+  void reset();
+
+  /**
+   * @brief Returns the buffer for the next frame, to be filled in place
+   *
+   * Its previous contents are stale. It is not part of the window (nor
+   * seen by the temporal operations) until commit().
+   */
+  Image& nextFrame();
+
+  // Adds the frame written into nextFrame(), evicting the oldest if full
+  void commit();
+
+  // Copies frame into nextFrame() and commits it
+  void push(const Image& frame);
+
+  // A frame in the window: 0 is the newest, size() - 1 the oldest
+  const Image& frame(int age) const;
+
+  // Per-channel mean of the frames in the window. Kept as running sums,
+  // so the cost does not depend on the window size
+  void average(Image& out) const;
+
+  // White where any channel of frame(0) differs from frame(age) by more
+  // than threshold, black elsewhere
+  void motionMask(Image& out, int threshold, int age = 1) const;
+
+  // Per-channel median of the frames in the window (the upper median for
+  // an even count); removes transient objects and noise
+  void median(Image& out) const;
+
+ private:
+  // Resizes out to the frame size if it is not already
+  void prepare(Image& out) const;
+
+  int myWidth;
+  int myHeight;
+  int myWindow;
+  int myCount;
+  int myNewest;  // buffer index of frame(0)
+  long long myFrameCount;
+  std::vector<Image> myBuffers;  // window + 1 frames used as a ring
+  std::vector<unsigned int> mySums;  // per-value sums over the window
+};
+
+}  // namespace agl
+#endif  // AGL_FRAME_SEQUENCE_H_
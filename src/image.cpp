@@ -1,784 +1,2133 @@
-// Copyright 2021, Aline Normoyle, alinen
-
-/**
- * This program defines the methods of the Image class
- * which allows for loading, saving images. It also
- * supports many image manipulation methods. This
- * program loads each image with three channels.
- * 
- * Current Supported Image Manipulation Methods:
- * - Flip Horizontal
- * - Replace
- * - SubImage
- * - Resize
- * - Greyscale
- * - Gamma Correction
- * - Alpha Blend
- * - Rotating 90 degrees
- * - Grid Copying
- * - Gaussian Blur
- * - Box Blur
- * - Unsharp Masking
- * - Sobel Operator
- * - Invert
- * - Bitmap
- * - Ridge Detection
- * - Color Swirl
- * - Color Extraction
- * - Addition
- * - Subtraction
- * - Multiply
- * - Difference 
- * - Lightest
- * - Darkest
- * - Sharpen
- * 
- * @author David Dinh
- * @version Feb 2, 2023
- * 
-*/
-
-#include "image.h"
-#include <cassert>
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb/stb_image_write.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb/stb_image.h"
-#include <algorithm>
-#include <cstring>
-#include <cmath>
-#include <stdlib.h>
-#include <time.h>
-
-#define NUM_CHANNELS 3 // assumes that there will only be three components in an image
-
-namespace agl {
-
-enum Color { RED = 0, GREEN, BLUE };
-
-// Function to clamp value
-int clamp(int value, int low, int hi) {
-  return std::min(std::max(value, low), hi);
-}
-
-Image::Image() {
-  this->myData= nullptr;
-}
-
-Image::Image(int width, int height): myWidth(width), myHeight(height) {
-  this->myData= new unsigned char[width * height * NUM_CHANNELS];
-  this->totalBytes= width * height * NUM_CHANNELS;
-  this->totalPixels= width * height;
-}
-
-
-Image::Image(const Image& orig) {
-  this->myData= nullptr;
-  this->set(orig.width(), orig.height(), orig.data());
-}
-
-Image& Image::operator=(const Image& orig) {
-  if (&orig == this) {
-    return *this;
-  }
-  this->set(orig.width(), orig.height(), orig.data());
-
-  return *this;
-}
-
-Image::~Image() {
-  if (this->myData != nullptr) delete[] this->myData;
-}
-
-int Image::width() const {
-  return this->myWidth;
-}
-
-int Image::height() const {
-  return this->myHeight;
-}
-
-unsigned char* Image::data() const {
-  return this->myData;
-}
-
-int Image::bytes() const {
-  return this->totalBytes;
-}
-
-int Image::pixelCount() const {
-  return this->totalPixels;
-}
-
-void Image::set(int width, int height, unsigned char* data) {
-  assert(sizeof(data) != width * height * NUM_CHANNELS);
-  this->myWidth= width;
-  this->myHeight= height;
-  this->totalBytes= this->myWidth * this->myHeight * NUM_CHANNELS;
-  this->totalPixels= this->myWidth * this->myHeight;
-
-  // Assures that we clean up the data we are replacing to avoid leaks
-  if (this->myData != nullptr) {
-    delete[] this->myData;
-    this->myData= nullptr;
-  }
-  this->myData= new unsigned char[this->totalBytes];
-  std::memcpy(this->myData, data, this->totalBytes);
-}
-
-// Assumes that flip is false for now
-bool Image::load(const std::string& filename, bool flip) {
-  const char* file= filename.c_str();
-  unsigned char* data= stbi_load(file, &this->myWidth, &myHeight, nullptr, 3); // force it to have 4 channels
-
-  bool success= data != nullptr;
-
-  // so we don't set if it fails
-  if (success) this->set(this->myWidth, this->myHeight, data);
-
-  stbi_image_free(data);
-
-  return success;
-}
-
-// Assumes that flip is false for now
-bool Image::save(const std::string& filename, bool flip) const {
-  const char* file= filename.c_str();
-  int success= stbi_write_png(file, this->myWidth, this->myHeight, NUM_CHANNELS, 
-    this->myData, this->myWidth * NUM_CHANNELS);
-
-  return success == 1;
-}
-
-Pixel Image::get(int row, int col) const {
-  this->inImageCheck(row, col);
-
-  int idx= (row * this->myWidth + col) * NUM_CHANNELS;
-  //                  red                 green                 blue
-  return Pixel{ this->myData[idx + RED], this->myData[idx + GREEN], this->myData[idx + BLUE] };
-}
-
-void Image::set(int row, int col, const Pixel& color) {
-  this->inImageCheck(row, col);
-
-  int idx= (row * this->myWidth + col) * NUM_CHANNELS;
-
-  this->myData[idx + RED]= color.r;
-  this->myData[idx + GREEN] = color.g;
-  this->myData[idx + BLUE] = color.b;
-}
-
-Pixel Image::get(int i) const
-{
-  assert(i >= 0 && i < this->totalPixels);
-  int idx= i * NUM_CHANNELS;
-
-  return Pixel{ this->myData[idx + RED], this->myData[idx + GREEN], this->myData[idx + BLUE] };
-}
-
-void Image::set(int i, const Pixel& c)
-{
-  assert(i >= 0 && i < this->totalPixels);
-  int idx= i * NUM_CHANNELS;
-  this->myData[idx + RED]= c.r;
-  this->myData[idx + GREEN]= c.g;
-  this->myData[idx + BLUE]= c.b;
-}
-
-Image Image::resize(int w, int h) const {
-  Image result(w, h);
-  int i_1;
-  int j_1;
-  for (int i_2= 0; i_2 < h; i_2++) {
-    for (int j_2= 0; j_2 < w; j_2++) {
-      float rowRatio_2= (float) i_2 / (float) (h-1);
-      float colRatio_2= (float) j_2 / (float) (w-1);
-
-      i_1= rowRatio_2 * (this->myHeight - 1);
-      j_1= colRatio_2 * (this->myWidth - 1);
-      
-      result.set(i_2, j_2, this->get(i_1, j_1));
-    }
-  }
-  return result;
-}
-
-Image Image::flipHorizontal() const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i_start= 0; i_start < this->myHeight; i_start++) {
-
-    // corresponding index of the pixel on the other side of the middle line
-    int i_end= this->myHeight - 1 - i_start;
-    for (int j= 0; j < this->myWidth; j++) {
-      
-      result.set(i_start, j, this->get(i_end, j));
-    }
-  }
-  return result;
-}
-
-Image Image::flipVertical() const {
-  Image result(0, 0);
-  return result;
-}
-
-Image Image::flipPositiveDiagonal() const {
-  // switch dimensions to actually flip them correctly by swapping i,j -> j,i
-  Image result(this->myHeight, this->myWidth);
-
-  // invariant is that we only traverse the bottom triangle
-  for (int i= 0; i < this->myHeight; i++) {
-    for (int j= 0; j < this->myWidth; j++) {
-      Pixel curPixel= this->get(i, j);
-      result.set(j, i, curPixel); // place the pixel in mirrored position
-    }
-  }
-
-  return result;
-}
-
-Image Image::rotate90() const {
-  Image flippedHorizontally= this->flipHorizontal();
-  Image result= flippedHorizontally.flipPositiveDiagonal();
-  
-  return result;
-}
-
-Image Image::subimage(int startx, int starty, int w, int h) const {
-  // assures that the sub image is actually a subimage
-  assert(startx + w < this->myWidth && starty + h < this->myHeight);
-  Image sub(w, h);
-
-  for (int i= 0; i < h; i++) {
-    for (int j= 0; j < w; j++) {
-      sub.set(i, j, this->get(starty + i, startx + j));
-    }
-  }
-
-  return sub;
-}
-
-void Image::replace(const Image& image, int startx, int starty) {
-  // loop condition protects against index out of bounds error
-  for (int i= 0; i < image.height() && starty + i < this->myHeight; i++) {
-    for (int j= 0; j < image.width() && startx + j < this->myWidth; j++) {
-
-      this->set(starty + i, startx + j, image.get(i, j));
-    }
-  }  
-}
-
-void Image::replaceAlpha(const Image& other, float alpha, int startx, int starty) {
-  for (int i= 0; i < other.height() && starty + i < this->myHeight; i++) {
-    for (int j= 0; j < other.width() && startx + j < this->myWidth; j++) {
-      Pixel blendedPixel {0, 0, 0};
-      Pixel pixel1= this->get(starty + i, startx + j);
-      Pixel pixel2= other.get(i, j);
-
-      blendedPixel.r= (float) pixel1.r * (1 - alpha) + (float) pixel2.r * alpha;
-      blendedPixel.g= (float) pixel1.g * (1 - alpha) + (float) pixel2.g * alpha;
-      blendedPixel.b= (float) pixel1.b * (1 - alpha) + (float) pixel2.b * alpha;
-      
-      this->set(starty + i, startx + j, blendedPixel);
-    }
-  }  
-}
-
-Image Image::swirl() const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->myHeight; i++) {
-    for (int j= 0; j < this->myWidth; j++) {
-      Pixel pixel= this->get(i, j);
-      unsigned char tempRed= pixel.r;
-      pixel.r= pixel.g;
-      pixel.g= pixel.b;
-      pixel.b= tempRed;
-
-      result.set(i, j, pixel);
-    }
-  }
-  return result;
-}
-
-Image Image::add(const Image& other) const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel1= this->get(i);
-    Pixel pixel2= other.get(i);
-    Pixel resultPixel;
-    resultPixel.r= std::min(pixel1.r + pixel2.r, 255);
-    resultPixel.g= std::min(pixel1.g + pixel2.g, 255);
-    resultPixel.b= std::min(pixel1.b + pixel2.b, 255);
-    result.set(i, resultPixel);
-  }
-  
-  return result;
-}
-
-Image Image::subtract(const Image& other) const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel1= this->get(i);
-    Pixel pixel2= other.get(i);
-    Pixel resultPixel;
-    resultPixel.r= std::max(pixel1.r - pixel2.r, 0);
-    resultPixel.g= std::max(pixel1.g - pixel2.g, 0);
-    resultPixel.b= std::max(pixel1.b - pixel2.b, 0);
-    result.set(i, resultPixel);
-  }
-   
-  return result;
-}
-
-Image Image::multiply(const Image& other) const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel1= this->get(i);
-    Pixel pixel2= other.get(i);
-    Pixel resultPixel;
-    resultPixel.r= std::min(pixel1.r * pixel2.r, 255);
-    resultPixel.g= std::min(pixel1.g * pixel2.g, 255);
-    resultPixel.b= std::min(pixel1.b * pixel2.b, 255);
-    result.set(i, resultPixel);
-  }
-   
-  return result;
-}
-
-Image Image::difference(const Image& other) const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel1= this->get(i);
-    Pixel pixel2= other.get(i);
-    Pixel resultPixel;
-    resultPixel.r= std::abs(pixel1.r - pixel2.r);
-    resultPixel.g= std::abs(pixel1.g - pixel2.g);
-    resultPixel.b= std::abs(pixel1.b - pixel2.b);
-    result.set(i, resultPixel);
-  }
-  
-  return result;
-}
-
-Image Image::lightest(const Image& other) const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel1= this->get(i);
-    Pixel pixel2= other.get(i);
-    Pixel resultPixel;
-    resultPixel.r= std::max(pixel1.r, pixel2.r);
-    resultPixel.g= std::max(pixel1.g, pixel2.g);
-    resultPixel.b= std::max(pixel1.b, pixel2.b);
-    result.set(i, resultPixel);
-  }
-  
-  return result;
-}
-
-Image Image::darkest(const Image& other) const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel1= this->get(i);
-    Pixel pixel2= other.get(i);
-    Pixel resultPixel;
-    resultPixel.r= std::min(pixel1.r, pixel2.r);
-    resultPixel.g= std::min(pixel1.g, pixel2.g);
-    resultPixel.b= std::min(pixel1.b, pixel2.b);
-    result.set(i, resultPixel);
-  }
-  
-  return result;
-}
-
-Image Image::gammaCorrect(float gamma) const {
-  Image result(this->myWidth, this->myHeight);
-   
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel= this->get(i);
-
-    pixel.r= std::pow(pixel.r/255.0f, 1.0f/gamma) * 255;
-    pixel.g= std::pow(pixel.g/255.0f, 1.0f/gamma) * 255;
-    pixel.b= std::pow(pixel.b/255.0f, 1.0f/gamma) * 255;
-
-    result.set(i, pixel);
-  }
-  
-  return result;
-}
-
-Image Image::alphaBlend(const Image& other, float alpha) const {
-  // assumes that images have the same dimensions
-  assert(this->myWidth == other.width() && this->myHeight == other.height());
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->myHeight; i++) {
-    for (int j= 0; j < this->myWidth; j++) {
-      Pixel blendedPixel= Pixel { 0, 0, 0 };
-      Pixel pixel1= this->get(i, j);
-      Pixel pixel2= other.get(i, j);
-
-      blendedPixel.r= (float) pixel1.r * (1 - alpha) + (float) pixel2.r * alpha;
-      blendedPixel.g= (float) pixel1.g * (1 - alpha) + (float) pixel2.g * alpha;
-      blendedPixel.b= (float) pixel1.b * (1 - alpha) + (float) pixel2.b * alpha;
-
-      result.set(i, j, blendedPixel);
-    } 
-  }
-
-  return result;
-}
-
-Image Image::invert() const {
-  Image image(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel= this->get(i);
-
-    pixel.r= 255 - pixel.r;
-    pixel.g= 255 - pixel.g;
-    pixel.b= 255 - pixel.b;    
-
-    image.set(i, pixel);
-
-  }
-  return image;
-}
-
-Image Image::grayscale() const {
-  Image result(this->myWidth, this->myHeight);
-  Pixel pixel;
-  unsigned char intensity;
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    pixel= this->get(i);
-
-    // Hardcoded values to make the greyscale intensity to look pleasing to human eye
-    intensity= (float) pixel.r * 0.3f + (float) pixel.g * 0.59f + (float) pixel.b * 0.11f;
-    
-    pixel.r= intensity;
-    pixel.g= intensity;
-    pixel.b= intensity;
-
-    result.set(i, pixel);
-  }
-
-  return result;
-}
-
-Image Image::colorJitter(int size) const {
-  Image image(this->myWidth, this->myHeight);
-
-  srand(time(NULL));
-
-  int numCols= this->myWidth  / size + ((this->myWidth  % size != 0) ? 1 : 0);
-  int numRows= this->myHeight / size + ((this->myHeight % size != 0) ? 1 : 0);
-
-  for (int i= 0; i < numRows; i++) {
-    for (int j= 0; j < numCols; j++) {
-      int i_start= i * size;
-      int j_start= j * size;
-      int i_end= std::min(this->myHeight, (i+1) * size);
-      int j_end= std::min(this->myWidth,  (j+1) * size);
-
-      int redJitter= std::rand() % 80 - 40;
-      int greenJitter= std::rand() % 80 - 40;
-      int blueJitter= std::rand() % 80 - 40;
-      for (int row= i_start; row < i_end; row++) {
-        for (int col= j_start; col < j_end; col++) {
-          Pixel pixel= this->get(row, col);
-          pixel.r= clamp(pixel.r + redJitter, 0, 255);
-          pixel.g= clamp(pixel.g + greenJitter, 0, 255);
-          pixel.b= clamp(pixel.b + blueJitter, 0, 255);
-
-          image.set(row, col, pixel);
-        }
-      }
-    }
-  }
-
- 
-  return image;
-}
-
-Image Image::bitmap(int size) const {
-  Image image(this->myWidth, this->myHeight);
-
-  // if it is not easily divisible by size, we need to iterate once more
-  // to get the corners
-  int numCols= this->myWidth  / size + ((this->myWidth  % size != 0) ? 1 : 0);
-  int numRows= this->myHeight / size + ((this->myHeight % size != 0) ? 1 : 0);
-
-  for (int i= 0; i < numRows; i++) {
-    for (int j= 0; j < numCols; j++) {
-      int i_start= i * size;
-      int j_start= j * size;
-      int i_end= std::min(this->myHeight, (i+1) * size);
-      int j_end= std::min(this->myWidth,  (j+1) * size);
-      int accumulatedRed= 0;
-      int accumulatedGreen= 0;
-      int accumulatedBlue= 0;
-      int count= 0; // although size could be size * size, edge cases
-      for (int row= i_start; row < i_end; row++) {
-        for (int col= j_start; col < j_end; col++) {
-          Pixel pixel= this->get(row, col);
-          accumulatedRed+= pixel.r;
-          accumulatedGreen+= pixel.g;
-          accumulatedBlue+= pixel.b;
-          count++;
-        }
-      }
-
-      // this will be assigned to each pixel in the size by size pixels
-      unsigned char red= accumulatedRed/count;
-      unsigned char green= accumulatedGreen/count;
-      unsigned char blue= accumulatedBlue/count;
-
-
-      Pixel avgPixel {red, green, blue};
-
-      for (int row= i_start; row < i_end; row++) {
-        for (int col= j_start; col < j_end; col++) {
-          image.set(row, col, avgPixel);
-        }
-      }
-
-    }
-  }
-
-
-  return image;
-}
-
-Image Image::sharpen() const {
-  int kernel[] {0, -1, 0,
-               -1, 5, -1,
-                0, -1, 0};
-  
-  Image result= this->convolute(kernel, 1, 3);
-
-  return result;
-
-}
-
-Image Image::identity() const {
-  int kernel[] {0, 0, 0,
-                0, 1, 0,
-                0, 0, 0};
-
-  Image result= this->convolute(kernel, 1, 3);
-  return result;
-}
-
-Image Image::gaussianBlur() const {
-  int kernel[] {1, 2, 1,
-                2, 4, 2,
-                1, 2, 1};
-  float scale= 1.0f/16.0f;
-
-  Image result= this->convolute(kernel, scale, 3);
-
-  return result;
-}
-
-Image Image::boxBlur() const {
-  int kernel[] {1, 1, 1,
-                1, 1, 1,
-                1, 1, 1};
-  float scale= 1.0f/9.0f;
-
-  Image result= this->convolute(kernel, scale, 3);
-
-  return result;
-}
-
-Image Image::ridgeDetection() const {
-  int kernel[] {-1, -1, -1, -1, 8, -1, -1, -1, -1};
-
-  Image result= this->convolute(kernel, 1, 3);
-
-  return result;
-}
-
-Image Image::unsharpMasking() const {
-  int kernel[] {1, 4, 6, 4, 1,
-                4, 16, 24, 16, 4,
-                6, 24, -476, 24, 6,
-                4, 16, 24, 16, 4,
-                1, 4, 6, 4, 1};
-  float scale= -1/256.0f;
-
-  Image result= this->convolute(kernel, scale, 5);
-  return result;
-}
-
-Image Image::sobel() const {
-  int kernel1[] {-1, 0, 1,
-                  -2, 0, 2,
-                  -1, 0, 1};
-  int kernel2[] {1, 2, 1,
-                 0, 0, 0,
-                 -1, -2, -1};
-      
-  Image G1= this->convolute(kernel1, 1, 3);
-  Image G2= this->convolute(kernel2, 1, 3);
-
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel1= G1.get(i);
-    Pixel pixel2= G2.get(i);
-
-    unsigned char r= clamp(std::sqrt((float) pixel1.r * (float) pixel1.r + (float) pixel2.r * (float) pixel2.r), 0, 255);
-    unsigned char g= clamp(std::sqrt((float) pixel1.g * (float) pixel1.g + (float) pixel2.g * (float) pixel2.g), 0, 255);
-    unsigned char b= clamp(std::sqrt((float) pixel1.b * (float) pixel1.b + (float) pixel2.b * (float) pixel2.b), 0, 255);
-
-    result.set(i, Pixel{r, g, b});
-  }
-  
-  return result;
-}
-
-Image Image::extract(const Pixel& low, const Pixel& high) const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel= this->get(i);
-    if (pixel.r < low.r || pixel.g < low.g || pixel.b < low.b ||
-        pixel.r > high.r || pixel.g > high.g || pixel.b > high.b) {
-      pixel.r= 0;
-      pixel.g= 0;
-      pixel.b= 0;
-    }
-    result.set(i, pixel);
-  }
-
-  return result;
-}
-
-Image Image::extractRed() const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel= this->get(i);
-    pixel.g= 0;
-    pixel.b= 0;
-    
-    result.set(i, pixel);
-  }
-
-  return result;
-}
-
-Image Image::extractGreen() const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel= this->get(i);
-    pixel.r= 0;
-    pixel.b= 0;
-    
-    result.set(i, pixel);
-  }
-
-  return result;
-}
-
-Image Image::extractBlue() const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->totalPixels; i++) {
-    Pixel pixel= this->get(i);
-    pixel.r= 0;
-    pixel.g= 0;
-    
-    result.set(i, pixel);
-  }
-
-  return result;
-}
-
-Image Image::gridCopy(int m, int n) const {
-  Image result(this->myWidth * n, this->myHeight * m);
-  unsigned char* data= result.data();
-
-  int widthBytes= this->myWidth * 3;
-
-  // this iterates row-by-row of our current image
-  // and copies the bytes directly over to each grid cell
-  // in result
-  for (int i= 0; i < m * this->myHeight; i++) {
-    for (int j= 0; j < n; j++) {
-      memcpy(data + (i * n * widthBytes + j * widthBytes), this->myData + 
-        (i % this->myHeight * widthBytes), widthBytes);
-    }
-  }
-
-  return result;
-}
-
-void Image::inImageCheck(int row, int col) const {
-  assert(row >= 0 && row < this->myHeight);
-  assert(col >= 0 && col < this->myWidth);
-  assert(this->myData != nullptr);
-}
-
-
-Image Image::convolute(int kernel[], float kernelScale, int sideLength) const {
-  Image result(this->myWidth, this->myHeight);
-
-  for (int i= 0; i < this->myHeight; i++) {
-    for (int j= 0; j < this->myWidth; j++) {
-      Pixel accumulator= {0, 0, 0};
-      float accumulatorRed= 0;
-      float accumulatorGreen= 0;
-      float accumulatorBlue= 0;
-
-      // convolute operator
-      for (int k_i= 0; k_i < sideLength; k_i++) {
-        for (int k_j= 0; k_j < sideLength; k_j++) {
-          int i_offset= k_i - 1; // so we get -1, 0, or 1
-          int j_offset= k_j - 1;
-
-          int pixel_i= clamp(i + i_offset, 0, this->myHeight - 1);
-          int pixel_j= clamp(j + j_offset, 0, this->myWidth - 1);
-
-
-          Pixel pixel= this->get(pixel_i, pixel_j);
-
-          // convolution operator requires us to multiply the index
-          // mirrored to the pixel aka (m-i-1, n-j-1)
-          int kernel_idx= (sideLength - 1 - k_i) * sideLength + (sideLength - 1 - k_j);
-          accumulatorRed += kernelScale * kernel[kernel_idx] * pixel.r;
-          accumulatorGreen += kernelScale * kernel[kernel_idx] * pixel.g;
-          accumulatorBlue += kernelScale * kernel[kernel_idx] * pixel.b;
-        }
-      }
-
-      accumulator.r= clamp(accumulatorRed, 0, 255);
-      accumulator.g= clamp(accumulatorGreen, 0, 255);
-      accumulator.b= clamp(accumulatorBlue, 0, 255);
-      
-      result.set(i, j, accumulator);
-
-    }
-  }
-
-  return result;
-}
-
-Image Image::glow(const Pixel& low, const Pixel& high) const {
-  return this->add(this->extract(low, high).boxBlur());
-}
-
-
-}  // namespace agl
-
+// Copyright 2021, Aline Normoyle, alinen
+
+/**
+ * This program defines the methods of the Image class
+ * which allows for loading, saving images. It also
+ * supports many image manipulation methods. This
+ * program loads each image with three channels.
+ * 
+ * Current Supported Image Manipulation Methods:
+ * - Flip Horizontal
+ * - Replace
+ * - SubImage
+ * - Resize
+ * - Greyscale
+ * - Gamma Correction
+ * - Alpha Blend
+ * - Rotating 90 degrees
+ * - Grid Copying
+ * - Gaussian Blur
+ * - Box Blur
+ * - Unsharp Masking
+ * - Sobel Operator (magnitude, orientation, raw gradients)
+ * - Invert
+ * - Bitmap
+ * - Ridge Detection
+ * - Color Swirl
+ * - Color Extraction
+ * - Addition
+ * - Subtraction
+ * - Multiply
+ * - Difference 
+ * - Lightest
+ * - Darkest
+ * - Sharpen
+ * - Statistics (histograms, min/max, mean, variance, percentiles)
+ * - Histogram Equalization
+ * - Auto Levels
+ * - Gaussian Noise, Salt and Pepper, Film Grain
+ * - Median, Min, Max and Rank Filters
+ * - Erode, Dilate, Opening, Closing, Top Hat, Black Hat
+ * - Gaussian Blur of any sigma (recursive)
+ * - FFT Convolution for large kernels
+ * - Colour Space Conversion (HSV, YCbCr, Lab, linear), Hue/Saturation
+ * 
+ * @author David Dinh
+ * @version Feb 2, 2023
+ * 
+*/
+
+#include "image.h"
+#include "buffer_pool.h"
+#include "dispatch.h"
+#include "fft.h"
+#include "parallel.h"
+#include "quantize.h"
+#include "random.h"
+#include "row_kernels.h"
+#include <cassert>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb/stb_image_write.h"
+#define STB_IMAGE_IMPLEMENTATION
+// stb keeps its failure string in an unsynchronized global, which the
+// async loaders would race on; nothing here reads it
+#define STBI_NO_FAILURE_STRINGS
+#include "stb/stb_image.h"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <stdlib.h>
+
+#define NUM_CHANNELS 3 // assumes that there will only be three components in an image
+
+// Bounds checks on pixel access; define AGL_UNCHECKED to compile them
+// out even in debug builds
+#ifdef AGL_UNCHECKED
+#define AGL_CHECK(condition) ((void) 0)
+#else
+#define AGL_CHECK(condition) assert(condition)
+#endif
+
+namespace agl {
+
+enum Color { RED = 0, GREEN, BLUE };
+
+// Function to clamp value
+int clamp(int value, int low, int hi) {
+  return std::min(std::max(value, low), hi);
+}
+
+// Runs op(isa) with activeIsa(); under PIXMAP_VERIFY runs it again with
+// ISA_SCALAR and reports any output byte that differs
+template <typename Operation>
+static Image dispatched(const char* name, Operation op) {
+  Isa isa= activeIsa();
+  Image result= op(isa);
+  if (verifyKernels() && isa != ISA_SCALAR) {
+    Image reference= op(ISA_SCALAR);
+    assert(reference.stride() == result.stride());
+    checkAgainstScalar(name, isa, result.data(), reference.data(),
+      (size_t) result.width() * NUM_CHANNELS, result.height(), result.stride());
+  }
+  return result;
+}
+
+// Rows start on this boundary (one cache line, one zmm register); the
+// buffers from BufferPool are aligned to it too
+static const int ROW_ALIGNMENT= 64;
+
+// addresses a multiple of this many bytes apart share L1 and L2 cache sets
+static const int CACHE_SET_SPAN= 2048;
+
+int Image::defaultStride(int width) {
+  int stride= (width * NUM_CHANNELS + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+  if (stride > 0 && stride % CACHE_SET_SPAN == 0) stride+= ROW_ALIGNMENT;
+  return stride;
+}
+
+Image::Image(): myWidth(0), myHeight(0), myStride(0), totalBytes(0), totalPixels(0) {
+  this->myData= nullptr;
+}
+
+Image::Image(int width, int height): Image(width, height, defaultStride(width)) {
+}
+
+Image::Image(int width, int height, int stride): Image() {
+  this->allocate(width, height, stride);
+}
+
+Image::Image(const Image& orig): Image() {
+  this->allocate(orig.myWidth, orig.myHeight, orig.myStride);
+  if (this->totalBytes > 0) std::memcpy(this->myData, orig.myData, this->totalBytes);
+  this->myDirty= orig.myDirty;
+}
+
+Image& Image::operator=(const Image& orig) {
+  if (&orig == this) {
+    return *this;
+  }
+  // keeps our buffer when it already has the right size
+  this->allocate(orig.myWidth, orig.myHeight, orig.myStride);
+  if (this->totalBytes > 0) std::memcpy(this->myData, orig.myData, this->totalBytes);
+  this->myDirty= orig.myDirty;
+
+  return *this;
+}
+
+Image::Image(Image&& orig) noexcept: myWidth(orig.myWidth), myHeight(orig.myHeight),
+  myStride(orig.myStride), myData(orig.myData), totalBytes(orig.totalBytes),
+  totalPixels(orig.totalPixels), myDirty(std::move(orig.myDirty)) {
+  orig.myData= nullptr;
+  orig.myWidth= 0;
+  orig.myHeight= 0;
+  orig.myStride= 0;
+  orig.totalBytes= 0;
+  orig.totalPixels= 0;
+}
+
+Image& Image::operator=(Image&& orig) noexcept {
+  if (&orig == this) {
+    return *this;
+  }
+  BufferPool::shared().release(this->myData, this->totalBytes);
+
+  this->myWidth= orig.myWidth;
+  this->myHeight= orig.myHeight;
+  this->myStride= orig.myStride;
+  this->myData= orig.myData;
+  this->totalBytes= orig.totalBytes;
+  this->totalPixels= orig.totalPixels;
+  this->myDirty= std::move(orig.myDirty);
+  orig.myData= nullptr;
+  orig.myWidth= 0;
+  orig.myHeight= 0;
+  orig.myStride= 0;
+  orig.totalBytes= 0;
+  orig.totalPixels= 0;
+
+  return *this;
+}
+
+Image::~Image() {
+  BufferPool::shared().release(this->myData, this->totalBytes);
+}
+
+void Image::allocate(int width, int height, int stride) {
+  assert(width >= 0 && height >= 0 && stride >= width * NUM_CHANNELS);
+  size_t bytes= (size_t) stride * height;
+  if (bytes != this->totalBytes) {
+    BufferPool& pool= BufferPool::shared();
+    pool.release(this->myData, this->totalBytes);
+    this->myData= pool.acquire(bytes);
+  }
+  this->myWidth= width;
+  this->myHeight= height;
+  this->myStride= stride;
+  this->totalBytes= bytes;
+  this->totalPixels= width * height;
+
+  // kernels only write the pixels, so padding would otherwise stay undefined
+  size_t rowBytes= (size_t) width * NUM_CHANNELS;
+  if (rowBytes < (size_t) stride) {
+    for (int i= 0; i < height; i++) {
+      std::memset(this->myData + (size_t) i * stride + rowBytes, 0, stride - rowBytes);
+    }
+  }
+}
+
+int Image::width() const {
+  return this->myWidth;
+}
+
+int Image::height() const {
+  return this->myHeight;
+}
+
+unsigned char* Image::data() const {
+  return this->myData;
+}
+
+size_t Image::bytes() const {
+  return this->totalBytes;
+}
+
+int Image::stride() const {
+  return this->myStride;
+}
+
+int Image::pixelCount() const {
+  return this->totalPixels;
+}
+
+bool Image::operator==(const Image& other) const {
+  if (this->myWidth != other.myWidth || this->myHeight != other.myHeight) return false;
+
+  size_t rowBytes= (size_t) this->myWidth * NUM_CHANNELS;
+  for (int i= 0; i < this->myHeight; i++) {
+    if (std::memcmp(this->rowData(i), other.rowData(i), rowBytes) != 0) return false;
+  }
+  return true;
+}
+
+bool Image::operator!=(const Image& other) const {
+  return !(*this == other);
+}
+
+void Image::set(int width, int height, unsigned char* data) {
+  this->allocate(width, height, defaultStride(width));
+
+  size_t rowBytes= (size_t) width * NUM_CHANNELS;
+  for (int i= 0; i < height; i++) {
+    std::memcpy(this->myData + (size_t) i * this->myStride, data + i * rowBytes, rowBytes);
+  }
+  this->myDirty.assign(1, Region{0, 0, width, height});
+}
+
+// Assumes that flip is false for now
+bool Image::load(const std::string& filename, bool flip) {
+  const char* file= filename.c_str();
+  int width= 0;
+  int height= 0;
+  unsigned char* data= stbi_load(file, &width, &height, nullptr, 3); // force it to have 3 channels
+
+  bool success= data != nullptr;
+
+  // so we don't set if it fails
+  if (success) this->set(width, height, data);
+
+  stbi_image_free(data);
+
+  return success;
+}
+
+// Assumes that flip is false for now
+bool Image::save(const std::string& filename, bool flip) const {
+  const char* file= filename.c_str();
+  int success= stbi_write_png(file, this->myWidth, this->myHeight, NUM_CHANNELS, 
+    this->myData, this->myStride);
+
+  return success == 1;
+}
+
+bool Image::saveIndexed(const std::string& filename, int colors) const {
+  if (this->myData == nullptr) return false;
+  return quantize(*this, colors).save(filename);
+}
+
+Pixel Image::get(int row, int col) const {
+  this->inImageCheck(row, col);
+
+  size_t idx= (size_t) row * this->myStride + col * NUM_CHANNELS;
+  //                  red                 green                 blue
+  return Pixel{ this->myData[idx + RED], this->myData[idx + GREEN], this->myData[idx + BLUE] };
+}
+
+void Image::set(int row, int col, const Pixel& color) {
+  this->inImageCheck(row, col);
+
+  size_t idx= (size_t) row * this->myStride + col * NUM_CHANNELS;
+
+  this->myData[idx + RED]= color.r;
+  this->myData[idx + GREEN] = color.g;
+  this->myData[idx + BLUE] = color.b;
+}
+
+Pixel Image::get(int i) const
+{
+  AGL_CHECK(i >= 0 && i < this->totalPixels);
+  return this->get(i / this->myWidth, i % this->myWidth);
+}
+
+void Image::set(int i, const Pixel& c)
+{
+  AGL_CHECK(i >= 0 && i < this->totalPixels);
+  this->set(i / this->myWidth, i % this->myWidth, c);
+}
+
+Pixel* Image::row(int row) {
+  return (Pixel*) this->rowData(row);
+}
+
+const Pixel* Image::row(int row) const {
+  return (const Pixel*) this->rowData(row);
+}
+
+unsigned char* Image::rowData(int row) {
+  AGL_CHECK(row >= 0 && row < this->myHeight && this->myData != nullptr);
+  return this->myData + (size_t) row * this->myStride;
+}
+
+const unsigned char* Image::rowData(int row) const {
+  AGL_CHECK(row >= 0 && row < this->myHeight && this->myData != nullptr);
+  return this->myData + (size_t) row * this->myStride;
+}
+
+PixelIterator Image::begin() {
+  return PixelIterator((Pixel*) this->myData, 0, this->myWidth, this->myStride);
+}
+
+PixelIterator Image::end() {
+  // one past the last row, at column 0
+  return PixelIterator((Pixel*) (this->myData + this->totalBytes), 0, this->myWidth,
+    this->myStride);
+}
+
+ConstPixelIterator Image::begin() const {
+  return ConstPixelIterator((const Pixel*) this->myData, 0, this->myWidth, this->myStride);
+}
+
+ConstPixelIterator Image::end() const {
+  return ConstPixelIterator((const Pixel*) (this->myData + this->totalBytes), 0, this->myWidth,
+    this->myStride);
+}
+
+Image Image::resize(int w, int h) const {
+  Image result(w, h);
+
+  // source column for every destination column, computed once
+  std::vector<int> cols(w);
+  for (int j_2= 0; j_2 < w; j_2++) {
+    float colRatio_2= (float) j_2 / (float) (w-1);
+    cols[j_2]= colRatio_2 * (this->myWidth - 1);
+  }
+
+  for (int i_2= 0; i_2 < h; i_2++) {
+    float rowRatio_2= (float) i_2 / (float) (h-1);
+    int i_1= rowRatio_2 * (this->myHeight - 1);
+
+    const Pixel* src= this->row(i_1);
+    Pixel* dst= result.row(i_2);
+    for (int j_2= 0; j_2 < w; j_2++) {
+      dst[j_2]= src[cols[j_2]];
+    }
+  }
+  return result;
+}
+
+Image Image::flipHorizontal() const {
+  Image result(this->myWidth, this->myHeight);
+  size_t rowBytes= (size_t) this->myWidth * NUM_CHANNELS;
+
+  for (int i_start= 0; i_start < this->myHeight; i_start++) {
+
+    // corresponding index of the pixel on the other side of the middle line
+    int i_end= this->myHeight - 1 - i_start;
+    std::memcpy(result.rowData(i_start), this->rowData(i_end), rowBytes);
+  }
+  return result;
+}
+
+// warp output is produced in square tiles of this many pixels
+static const int WARP_TILE= 64;
+
+Image Image::warp(const Transform& transform, int width, int height,
+  Interpolation interpolation, const Pixel& background) const {
+  assert(width >= 0 && height >= 0);
+  Image result(width, height);
+  Transform toSource;
+  bool visible= transform.inverse(toSource) && this->totalPixels > 0;
+  WarpSource source= {this->myData, this->myWidth, this->myHeight, (size_t) this->myStride};
+  const unsigned char fill[3]= {background.r, background.g, background.b};
+
+  // a band is one row of tiles, done tile by tile
+  int bands= (height + WARP_TILE - 1) / WARP_TILE;
+  parallelFor(bands, [&](int, int begin, int end) {
+    for (int band= begin; band < end; band++) {
+      int top= band * WARP_TILE;
+      int bottom= std::min(top + WARP_TILE, height);
+      for (int left= 0; left < width; left+= WARP_TILE) {
+        int count= std::min(WARP_TILE, width - left);
+        for (int i= top; i < bottom; i++) {
+          Pixel* dst= result.row(i) + left;
+          if (visible) {
+            warpSpan(source, toSource, left, i, count, interpolation, fill, (unsigned char*) dst);
+          } else {
+            std::fill(dst, dst + count, background);
+          }
+        }
+      }
+    }
+  }, 1);
+
+  return result;
+}
+
+Image Image::rotate(float degrees, Interpolation interpolation, const Pixel& background) const {
+  Transform turn= Transform::rotation(degrees, (this->myWidth - 1) / 2.0, (this->myHeight - 1) / 2.0);
+  return this->warp(turn, this->myWidth, this->myHeight, interpolation, background);
+}
+
+Image Image::flipVertical() const {
+  Image result(0, 0);
+  return result;
+}
+
+Image Image::flipPositiveDiagonal() const {
+  // switch dimensions to actually flip them correctly by swapping i,j -> j,i
+  Image result(this->myHeight, this->myWidth);
+
+  // transpose in blocks so both images are walked cache-friendly
+  const int block= 32;
+  for (int i_block= 0; i_block < this->myHeight; i_block+= block) {
+    for (int j_block= 0; j_block < this->myWidth; j_block+= block) {
+      int i_end= std::min(this->myHeight, i_block + block);
+      int j_end= std::min(this->myWidth, j_block + block);
+      for (int i= i_block; i < i_end; i++) {
+        const Pixel* src= this->row(i);
+        for (int j= j_block; j < j_end; j++) {
+          result.row(j)[i]= src[j]; // place the pixel in mirrored position
+        }
+      }
+    }
+  }
+
+  return result;
+}
+
+Image Image::rotate90() const {
+  Image flippedHorizontally= this->flipHorizontal();
+  Image result= flippedHorizontally.flipPositiveDiagonal();
+  
+  return result;
+}
+
+Image Image::subimage(int startx, int starty, int w, int h) const {
+  // assures that the sub image is actually a subimage; it may reach the
+  // right and bottom edges
+  assert(startx >= 0 && starty >= 0 && startx + w <= this->myWidth && starty + h <= this->myHeight);
+  Image sub(w, h);
+
+  for (int i= 0; i < h; i++) {
+    std::memcpy(sub.rowData(i), this->row(starty + i) + startx, (size_t) w * NUM_CHANNELS);
+  }
+
+  return sub;
+}
+
+void Image::replace(const Image& image, int startx, int starty) {
+  // clamping the copied span protects against index out of bounds error
+  int cols= std::min(image.width(), this->myWidth - startx);
+  if (cols <= 0) return;
+
+  for (int i= 0; i < image.height() && starty + i < this->myHeight; i++) {
+    std::memcpy(this->row(starty + i) + startx, image.rowData(i), (size_t) cols * NUM_CHANNELS);
+  }
+  this->markDirty(startx, starty, cols, image.height());
+}
+
+void Image::replaceAlpha(const Image& other, float alpha, int startx, int starty) {
+  int cols= std::min(other.width(), this->myWidth - startx);
+
+  for (int i= 0; i < other.height() && starty + i < this->myHeight; i++) {
+    Pixel* dst= this->row(starty + i) + startx;
+    const Pixel* src= other.row(i);
+    for (int j= 0; j < cols; j++) {
+      Pixel pixel1= dst[j];
+      Pixel pixel2= src[j];
+
+      dst[j].r= (float) pixel1.r * (1 - alpha) + (float) pixel2.r * alpha;
+      dst[j].g= (float) pixel1.g * (1 - alpha) + (float) pixel2.g * alpha;
+      dst[j].b= (float) pixel1.b * (1 - alpha) + (float) pixel2.b * alpha;
+    }
+  }  
+  this->markDirty(startx, starty, cols, other.height());
+}
+
+// Adds region to a list of rectangles that do not overlap, merging it
+// with any it overlaps; a list longer than the limit becomes one box
+static void addRegion(std::vector<Region>& regions, Region region, size_t limit) {
+  if (region.width <= 0 || region.height <= 0) return;
+
+  for (size_t k= 0; k < regions.size(); ) {
+    const Region& other= regions[k];
+    bool overlaps= region.x < other.x + other.width && other.x < region.x + region.width &&
+      region.y < other.y + other.height && other.y < region.y + region.height;
+    if (!overlaps) {
+      k++;
+      continue;
+    }
+
+    // the union may overlap regions already passed, so look again
+    int right= std::max(region.x + region.width, other.x + other.width);
+    int bottom= std::max(region.y + region.height, other.y + other.height);
+    region.x= std::min(region.x, other.x);
+    region.y= std::min(region.y, other.y);
+    region.width= right - region.x;
+    region.height= bottom - region.y;
+    regions.erase(regions.begin() + k);
+    k= 0;
+  }
+  regions.push_back(region);
+
+  if (regions.size() > limit) {
+    Region box= regions[0];
+    for (const Region& other : regions) {
+      int right= std::max(box.x + box.width, other.x + other.width);
+      int bottom= std::max(box.y + box.height, other.y + other.height);
+      box.x= std::min(box.x, other.x);
+      box.y= std::min(box.y, other.y);
+      box.width= right - box.x;
+      box.height= bottom - box.y;
+    }
+    regions.assign(1, box);
+  }
+}
+
+// The part of (x, y, width, height) inside a width by height image
+static Region clipRegion(int x, int y, int width, int height, int imageWidth, int imageHeight) {
+  int left= std::max(x, 0);
+  int top= std::max(y, 0);
+  int right= std::min(x + width, imageWidth);
+  int bottom= std::min(y + height, imageHeight);
+  return Region{left, top, right - left, bottom - top};
+}
+
+const std::vector<Region>& Image::dirtyRegions() const {
+  return this->myDirty;
+}
+
+void Image::markDirty(int x, int y, int width, int height) {
+  Region region= clipRegion(x, y, width, height, this->myWidth, this->myHeight);
+  addRegion(this->myDirty, region, MAX_DIRTY_REGIONS);
+}
+
+void Image::clearDirty() {
+  this->myDirty.clear();
+}
+
+bool Image::refresh(const std::function<Image(const Image&)>& op, int halo, Image& output) const {
+  assert(&output != this && halo >= 0);
+  if (output.myWidth != this->myWidth || output.myHeight != this->myHeight) return false;
+
+  // the output pixels a change can reach, merged so that no two overlap
+  // and the regions can be written in parallel
+  std::vector<Region> targets;
+  for (const Region& dirty : this->myDirty) {
+    Region grown= clipRegion(dirty.x - halo, dirty.y - halo, dirty.width + 2 * halo,
+      dirty.height + 2 * halo, this->myWidth, this->myHeight);
+    addRegion(targets, grown, MAX_DIRTY_REGIONS);
+  }
+
+  parallelFor((int) targets.size(), [&](int, int begin, int end) {
+    for (int t= begin; t < end; t++) {
+      // the halo is only added inside the image, so op sees the real
+      // image borders where the region touches them
+      const Region& target= targets[t];
+      Region around= clipRegion(target.x - halo, target.y - halo, target.width + 2 * halo,
+        target.height + 2 * halo, this->myWidth, this->myHeight);
+      Image processed= op(this->subimage(around.x, around.y, around.width, around.height));
+      assert(processed.width() == around.width && processed.height() == around.height);
+
+      // crop the halo off again
+      int left= target.x - around.x;
+      int top= target.y - around.y;
+      for (int i= 0; i < target.height; i++) {
+        std::memcpy(output.row(target.y + i) + target.x, processed.row(top + i) + left,
+          (size_t) target.width * NUM_CHANNELS);
+      }
+    }
+  }, 1);
+
+  return true;
+}
+
+Image Image::swirl() const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const Pixel* src= this->row(i);
+    Pixel* dst= result.row(i);
+    for (int j= 0; j < this->myWidth; j++) {
+      dst[j].r= src[j].g;
+      dst[j].g= src[j].b;
+      dst[j].b= src[j].r;
+    }
+  }
+  return result;
+}
+
+Image Image::add(const Image& other) const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const unsigned char* a= this->rowData(i);
+    const unsigned char* b= other.rowData(i);
+    unsigned char* out= result.rowData(i);
+    for (int j= 0; j < this->myWidth * NUM_CHANNELS; j++) {
+      out[j]= std::min(a[j] + b[j], 255);
+    }
+  }
+  
+  return result;
+}
+
+Image Image::subtract(const Image& other) const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const unsigned char* a= this->rowData(i);
+    const unsigned char* b= other.rowData(i);
+    unsigned char* out= result.rowData(i);
+    for (int j= 0; j < this->myWidth * NUM_CHANNELS; j++) {
+      out[j]= std::max(a[j] - b[j], 0);
+    }
+  }
+  
+  return result;
+}
+
+Image Image::multiply(const Image& other) const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const unsigned char* a= this->rowData(i);
+    const unsigned char* b= other.rowData(i);
+    unsigned char* out= result.rowData(i);
+    for (int j= 0; j < this->myWidth * NUM_CHANNELS; j++) {
+      out[j]= std::min(a[j] * b[j], 255);
+    }
+  }
+  
+  return result;
+}
+
+Image Image::difference(const Image& other) const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const unsigned char* a= this->rowData(i);
+    const unsigned char* b= other.rowData(i);
+    unsigned char* out= result.rowData(i);
+    for (int j= 0; j < this->myWidth * NUM_CHANNELS; j++) {
+      out[j]= std::abs(a[j] - b[j]);
+    }
+  }
+  
+  return result;
+}
+
+Image Image::lightest(const Image& other) const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const unsigned char* a= this->rowData(i);
+    const unsigned char* b= other.rowData(i);
+    unsigned char* out= result.rowData(i);
+    for (int j= 0; j < this->myWidth * NUM_CHANNELS; j++) {
+      out[j]= std::max(a[j], b[j]);
+    }
+  }
+  
+  return result;
+}
+
+Image Image::darkest(const Image& other) const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const unsigned char* a= this->rowData(i);
+    const unsigned char* b= other.rowData(i);
+    unsigned char* out= result.rowData(i);
+    for (int j= 0; j < this->myWidth * NUM_CHANNELS; j++) {
+      out[j]= std::min(a[j], b[j]);
+    }
+  }
+  
+  return result;
+}
+
+Image Image::gammaCorrect(float gamma) const {
+  // one pow per possible value instead of three per pixel
+  unsigned char lut[3][256];
+  for (int v= 0; v < 256; v++) {
+    unsigned char corrected= std::pow(v/255.0f, 1.0f/gamma) * 255;
+    lut[RED][v]= corrected;
+    lut[GREEN][v]= corrected;
+    lut[BLUE][v]= corrected;
+  }
+
+  return this->applyLUT(lut);
+}
+
+Image Image::alphaBlend(const Image& other, float alpha) const {
+  // assumes that images have the same dimensions
+  assert(this->myWidth == other.width() && this->myHeight == other.height());
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const unsigned char* a= this->rowData(i);
+    const unsigned char* b= other.rowData(i);
+    unsigned char* out= result.rowData(i);
+    for (int j= 0; j < this->myWidth * NUM_CHANNELS; j++) {
+      out[j]= (float) a[j] * (1 - alpha) + (float) b[j] * alpha;
+    }
+  }
+
+  return result;
+}
+
+Image Image::invert() const {
+  Image image(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const unsigned char* src= this->rowData(i);
+    unsigned char* dst= image.rowData(i);
+    for (int j= 0; j < this->myWidth * NUM_CHANNELS; j++) {
+      dst[j]= 255 - src[j];
+    }
+  }
+  return image;
+}
+
+Image Image::grayscale() const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const Pixel* src= this->row(i);
+    Pixel* dst= result.row(i);
+    for (int j= 0; j < this->myWidth; j++) {
+      // Hardcoded values to make the greyscale intensity to look pleasing to human eye
+      unsigned char intensity= (float) src[j].r * 0.3f + (float) src[j].g * 0.59f + (float) src[j].b * 0.11f;
+      dst[j]= Pixel{intensity, intensity, intensity};
+    }
+  }
+
+  return result;
+}
+
+Image Image::convertColor(ColorSpace from, ColorSpace to) const {
+  return dispatched("convertColor", [&](Isa isa) {
+    Image result(this->myWidth, this->myHeight);
+
+    parallelFor(this->myHeight, [&](int, int begin, int end) {
+      for (int i= begin; i < end; i++) {
+        convertColors(from, to, this->rowData(i), result.rowData(i), this->myWidth, isa);
+      }
+    });
+
+    return result;
+  });
+}
+
+std::vector<float> Image::toFloat(ColorSpace space) const {
+  size_t rowValues= (size_t) this->myWidth * NUM_CHANNELS;
+  std::vector<float> values(rowValues * this->myHeight);
+
+  parallelFor(this->myHeight, [&](int, int begin, int end) {
+    for (int i= begin; i < end; i++) {
+      const unsigned char* src= this->rowData(i);
+      float* dst= values.data() + i * rowValues;
+      for (size_t j= 0; j < rowValues; j++) dst[j]= src[j] / 255.0f;
+      convertColors(COLOR_RGB, space, dst, dst, this->myWidth);
+    }
+  });
+
+  return values;
+}
+
+void Image::fromFloat(const float* values, ColorSpace space) {
+  size_t rowValues= (size_t) this->myWidth * NUM_CHANNELS;
+
+  parallelFor(this->myHeight, [&](int, int begin, int end) {
+    std::vector<float> rgb(rowValues);
+    for (int i= begin; i < end; i++) {
+      convertColors(space, COLOR_RGB, values + i * rowValues, rgb.data(), this->myWidth);
+      unsigned char* dst= this->rowData(i);
+      for (size_t j= 0; j < rowValues; j++) {
+        dst[j]= clamp((int) (rgb[j] * 255.0f + 0.5f), 0, 255);
+      }
+    }
+  });
+}
+
+Image Image::adjustHueSaturation(float hueDegrees, float saturationScale) const {
+  Image result(this->myWidth, this->myHeight);
+  size_t rowValues= (size_t) this->myWidth * NUM_CHANNELS;
+
+  parallelFor(this->myHeight, [&](int, int begin, int end) {
+    std::vector<float> hsv(rowValues);
+    for (int i= begin; i < end; i++) {
+      const unsigned char* src= this->rowData(i);
+      for (size_t j= 0; j < rowValues; j++) hsv[j]= src[j] / 255.0f;
+      convertColors(COLOR_RGB, COLOR_HSV, hsv.data(), hsv.data(), this->myWidth);
+
+      for (size_t j= 0; j < rowValues; j+= NUM_CHANNELS) {
+        hsv[j]+= hueDegrees;
+        hsv[j + 1]= std::min(hsv[j + 1] * saturationScale, 1.0f);
+      }
+
+      convertColors(COLOR_HSV, COLOR_RGB, hsv.data(), hsv.data(), this->myWidth);
+      unsigned char* dst= result.rowData(i);
+      for (size_t j= 0; j < rowValues; j++) {
+        dst[j]= clamp((int) (hsv[j] * 255.0f + 0.5f), 0, 255);
+      }
+    }
+  });
+
+  return result;
+}
+
+Image Image::colorJitter(int size, unsigned int seed) const {
+  Image image(this->myWidth, this->myHeight);
+
+  int numCols= this->myWidth  / size + ((this->myWidth  % size != 0) ? 1 : 0);
+  int numRows= this->myHeight / size + ((this->myHeight % size != 0) ? 1 : 0);
+
+  // each cell's jitter only depends on (seed, cell row, cell col), so
+  // rows of cells can be processed in any order on any thread
+  parallelFor(numRows, [&](int, int rowBegin, int rowEnd) {
+    for (int i= rowBegin; i < rowEnd; i++) {
+      for (int j= 0; j < numCols; j++) {
+        int i_start= i * size;
+        int j_start= j * size;
+        int i_end= std::min(this->myHeight, (i+1) * size);
+        int j_end= std::min(this->myWidth,  (j+1) * size);
+
+        int redJitter= (int) (counterRandom(seed, i, j, RED) % 80) - 40;
+        int greenJitter= (int) (counterRandom(seed, i, j, GREEN) % 80) - 40;
+        int blueJitter= (int) (counterRandom(seed, i, j, BLUE) % 80) - 40;
+        for (int row= i_start; row < i_end; row++) {
+          const Pixel* src= this->row(row);
+          Pixel* dst= image.row(row);
+          for (int col= j_start; col < j_end; col++) {
+            dst[col].r= clamp(src[col].r + redJitter, 0, 255);
+            dst[col].g= clamp(src[col].g + greenJitter, 0, 255);
+            dst[col].b= clamp(src[col].b + blueJitter, 0, 255);
+          }
+        }
+      }
+    }
+  }, 1);
+
+  return image;
+}
+
+Image Image::gaussianNoise(float sigma, unsigned int seed) const {
+  Image result(this->myWidth, this->myHeight);
+
+  parallelFor(this->myHeight, [&](int, int begin, int end) {
+    for (int row= begin; row < end; row++) {
+      const Pixel* src= this->row(row);
+      Pixel* dst= result.row(row);
+      for (int col= 0; col < this->myWidth; col++) {
+        Pixel pixel= src[col];
+        pixel.r= clamp(std::lround(pixel.r + sigma * counterNormal(seed, row, col, RED)), 0, 255);
+        pixel.g= clamp(std::lround(pixel.g + sigma * counterNormal(seed, row, col, GREEN)), 0, 255);
+        pixel.b= clamp(std::lround(pixel.b + sigma * counterNormal(seed, row, col, BLUE)), 0, 255);
+
+        dst[col]= pixel;
+      }
+    }
+  });
+
+  return result;
+}
+
+Image Image::saltAndPepper(float density, unsigned int seed) const {
+  Image result(this->myWidth, this->myHeight);
+
+  parallelFor(this->myHeight, [&](int, int begin, int end) {
+    for (int row= begin; row < end; row++) {
+      const Pixel* src= this->row(row);
+      Pixel* dst= result.row(row);
+      for (int col= 0; col < this->myWidth; col++) {
+        Pixel pixel= src[col];
+        float u= counterUniform(seed, row, col);
+
+        // the lower half of the hit range is pepper, the upper half salt
+        if (u < density) {
+          unsigned char value= (u < density * 0.5f) ? 0 : 255;
+          pixel= Pixel{value, value, value};
+        }
+        dst[col]= pixel;
+      }
+    }
+  });
+
+  return result;
+}
+
+Image Image::filmGrain(float strength, unsigned int seed) const {
+  Image result(this->myWidth, this->myHeight);
+
+  parallelFor(this->myHeight, [&](int, int begin, int end) {
+    for (int row= begin; row < end; row++) {
+      const Pixel* src= this->row(row);
+      Pixel* dst= result.row(row);
+      for (int col= 0; col < this->myWidth; col++) {
+        Pixel pixel= src[col];
+
+        // grain is the same on every channel and fades out towards
+        // black and white, like silver grain on film
+        float luminance= (pixel.r * 0.3f + pixel.g * 0.59f + pixel.b * 0.11f) / 255.0f;
+        float weight= 4.0f * luminance * (1.0f - luminance);
+        int grain= std::lround(strength * weight * counterNormal(seed, row, col));
+
+        pixel.r= clamp(pixel.r + grain, 0, 255);
+        pixel.g= clamp(pixel.g + grain, 0, 255);
+        pixel.b= clamp(pixel.b + grain, 0, 255);
+        dst[col]= pixel;
+      }
+    }
+  });
+
+  return result;
+}
+
+Image Image::bitmap(int size) const {
+  Image image(this->myWidth, this->myHeight);
+
+  // if it is not easily divisible by size, we need to iterate once more
+  // to get the corners
+  int numCols= this->myWidth  / size + ((this->myWidth  % size != 0) ? 1 : 0);
+  int numRows= this->myHeight / size + ((this->myHeight % size != 0) ? 1 : 0);
+
+  for (int i= 0; i < numRows; i++) {
+    for (int j= 0; j < numCols; j++) {
+      int i_start= i * size;
+      int j_start= j * size;
+      int i_end= std::min(this->myHeight, (i+1) * size);
+      int j_end= std::min(this->myWidth,  (j+1) * size);
+      int accumulatedRed= 0;
+      int accumulatedGreen= 0;
+      int accumulatedBlue= 0;
+      int count= 0; // although size could be size * size, edge cases
+      for (int row= i_start; row < i_end; row++) {
+        const Pixel* src= this->row(row);
+        for (int col= j_start; col < j_end; col++) {
+          accumulatedRed+= src[col].r;
+          accumulatedGreen+= src[col].g;
+          accumulatedBlue+= src[col].b;
+          count++;
+        }
+      }
+
+      // this will be assigned to each pixel in the size by size pixels
+      unsigned char red= accumulatedRed/count;
+      unsigned char green= accumulatedGreen/count;
+      unsigned char blue= accumulatedBlue/count;
+
+
+      Pixel avgPixel {red, green, blue};
+
+      for (int row= i_start; row < i_end; row++) {
+        Pixel* dst= image.row(row);
+        for (int col= j_start; col < j_end; col++) {
+          dst[col]= avgPixel;
+        }
+      }
+
+    }
+  }
+
+
+  return image;
+}
+
+Image Image::sharpen() const {
+  int kernel[] {0, -1, 0,
+               -1, 5, -1,
+                0, -1, 0};
+  
+  Image result= this->convolute(kernel, 1, 3);
+
+  return result;
+
+}
+
+Image Image::identity() const {
+  int kernel[] {0, 0, 0,
+                0, 1, 0,
+                0, 0, 0};
+
+  Image result= this->convolute(kernel, 1, 3);
+  return result;
+}
+
+Image Image::gaussianBlur() const {
+  int kernel[] {1, 2, 1,
+                2, 4, 2,
+                1, 2, 1};
+  float scale= 1.0f/16.0f;
+
+  Image result= this->convolute(kernel, scale, 3);
+
+  return result;
+}
+
+// Young-van Vliet recursive Gaussian: a third order causal pass followed
+// by the same filter run backwards. Each step is
+//   w[n] = B * x[n] + a1 * w[n-1] + a2 * w[n-2] + a3 * w[n-3]
+// The left edge starts from the steady state of the first sample repeated;
+// the right edge uses Triggs-Sdika: M maps the last three causal outputs
+// (relative to the last sample) to the anti-causal values past the end, as
+// if the last sample were repeated forever.
+struct RecursiveGaussian {
+  float B, a1, a2, a3;
+  float M[3][3];
+
+  explicit RecursiveGaussian(float sigma) {
+    double q= sigma >= 2.5f ? 0.98711 * sigma - 0.96330
+                            : 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * sigma);
+    double q2= q * q;
+    double q3= q2 * q;
+    double b0= 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    double b1= 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+    double b2= -(1.4281 * q2 + 1.26661 * q3);
+    double b3= 0.422205 * q3;
+    double a[3]= {b1 / b0, b2 / b0, b3 / b0};
+    a1= (float) a[0];
+    a2= (float) a[1];
+    a3= (float) a[2];
+    B= (float) (1.0 - (a[0] + a[1] + a[2]));
+
+    // M is linear, so run each unit deviation out past the end until it
+    // has decayed, then back; the tail shrinks by about e every sigma
+    int tail= (int) (20 * sigma) + 64;
+    std::vector<double> w(tail + 3);
+    std::vector<double> y(tail + 3);
+    for (int j= 0; j < 3; j++) {
+      std::fill(w.begin(), w.end(), 0.0);
+      std::fill(y.begin(), y.end(), 0.0);
+      w[2 - j]= 1.0;  // w[0..2] are w[N-3..N-1]
+      for (int n= 3; n < tail + 3; n++) {
+        w[n]= a[0] * w[n - 1] + a[1] * w[n - 2] + a[2] * w[n - 3];
+      }
+      for (int n= tail - 1; n >= 3; n--) {
+        y[n]= (1.0 - a[0] - a[1] - a[2]) * w[n] + a[0] * y[n + 1] + a[1] * y[n + 2] + a[2] * y[n + 3];
+      }
+      for (int k= 0; k < 3; k++) M[k][j]= (float) y[3 + k];
+    }
+  }
+};
+
+// One recursion step over `lanes` independent signals; the lanes are
+// contiguous so the loop vectorizes
+static AGL_INLINE void recursiveStep(float* __restrict value, const float* __restrict p1,
+    const float* __restrict p2, const float* __restrict p3, int lanes,
+    const RecursiveGaussian& g) {
+  for (int l= 0; l < lanes; l++) {
+    value[l]= g.B * value[l] + g.a1 * p1[l] + g.a2 * p2[l] + g.a3 * p3[l];
+  }
+}
+
+// Filters `length` samples of `lanes` interleaved signals in place,
+// data[n * lanes + l]; edge is scratch space of 4 * lanes floats
+static AGL_INLINE void recursiveGaussian(float* data, int length, int lanes,
+    const RecursiveGaussian& g, float* edge) {
+  float* last= edge + 3 * lanes;
+  std::memcpy(edge, data, lanes * sizeof(float));
+  std::memcpy(last, data + (size_t) (length - 1) * lanes, lanes * sizeof(float));
+  for (int n= 0; n < length; n++) {
+    float* p[3];
+    for (int k= 1; k <= 3; k++) p[k - 1]= n - k >= 0 ? data + (size_t) (n - k) * lanes : edge;
+    recursiveStep(data + (size_t) n * lanes, p[0], p[1], p[2], lanes, g);
+  }
+
+  // edge row k becomes the anti-causal value k + 1 samples past the end
+  for (int k= 0; k < 3; k++) {
+    for (int l= 0; l < lanes; l++) {
+      float value= last[l];
+      for (int j= 0; j < 3; j++) {
+        int n= std::max(length - 1 - j, 0);
+        value+= g.M[k][j] * (data[(size_t) n * lanes + l] - last[l]);
+      }
+      edge[k * lanes + l]= value;
+    }
+  }
+  for (int n= length - 1; n >= 0; n--) {
+    float* p[3];
+    for (int k= 1; k <= 3; k++) {
+      p[k - 1]= n + k < length ? data + (size_t) (n + k) * lanes : edge + (n + k - length) * lanes;
+    }
+    recursiveStep(data + (size_t) n * lanes, p[0], p[1], p[2], lanes, g);
+  }
+}
+
+// Rows filtered together by the horizontal pass, and floats per strip of
+// the vertical pass
+static const int GAUSSIAN_ROWS= 8;
+static const int GAUSSIAN_STRIP= 64;
+
+// The two passes' recursions, with their lane counts fixed at compile time
+static AGL_INLINE void recursiveRows(float* data, int length, const RecursiveGaussian& g, float* edge) {
+  recursiveGaussian(data, length, GAUSSIAN_ROWS * NUM_CHANNELS, g, edge);
+}
+AGL_VARIANTS(recursiveRows, (float* data, int length, const RecursiveGaussian& g, float* edge),
+  (data, length, g, edge))
+
+static AGL_INLINE void recursiveColumns(float* data, int length, const RecursiveGaussian& g, float* edge) {
+  recursiveGaussian(data, length, GAUSSIAN_STRIP, g, edge);
+}
+AGL_VARIANTS(recursiveColumns, (float* data, int length, const RecursiveGaussian& g, float* edge),
+  (data, length, g, edge))
+
+// Gaussian blur of sigma >= 0.5 with the recursions compiled for isa
+static Image recursiveGaussianBlur(const Image& source, float sigma, Isa isa) {
+  int width= source.width();
+  int height= source.height();
+  int rowBytes= width * NUM_CHANNELS;
+  RecursiveGaussian g(sigma);
+  std::vector<float> horizontal((size_t) height * rowBytes);
+  Image result(width, height);
+
+  // rows: GAUSSIAN_ROWS rows are transposed so that each step of the
+  // recursion handles all of their channels at once
+  int blocks= (height + GAUSSIAN_ROWS - 1) / GAUSSIAN_ROWS;
+  parallelFor(blocks, [&](int, int begin, int end) {
+    int lanes= GAUSSIAN_ROWS * NUM_CHANNELS;
+    std::vector<float> buffer((size_t) width * lanes);
+    std::vector<float> edge(4 * lanes);
+
+    for (int block= begin; block < end; block++) {
+      int first= block * GAUSSIAN_ROWS;
+      int rows= std::min(GAUSSIAN_ROWS, height - first);
+      std::fill(buffer.begin(), buffer.end(), 0.0f);
+      for (int r= 0; r < rows; r++) {
+        const unsigned char* src= source.rowData(first + r);
+        for (int x= 0; x < width; x++) {
+          for (int c= 0; c < NUM_CHANNELS; c++) {
+            buffer[(size_t) x * lanes + r * NUM_CHANNELS + c]= src[x * NUM_CHANNELS + c];
+          }
+        }
+      }
+
+      recursiveRowsVariants[isa](buffer.data(), width, g, edge.data());
+
+      for (int r= 0; r < rows; r++) {
+        float* out= horizontal.data() + (size_t) (first + r) * rowBytes;
+        for (int x= 0; x < width; x++) {
+          for (int c= 0; c < NUM_CHANNELS; c++) {
+            out[x * NUM_CHANNELS + c]= buffer[(size_t) x * lanes + r * NUM_CHANNELS + c];
+          }
+        }
+      }
+    }
+  });
+
+  // columns: a strip of GAUSSIAN_STRIP values of every row at a time
+  int strips= (rowBytes + GAUSSIAN_STRIP - 1) / GAUSSIAN_STRIP;
+  parallelFor(strips, [&](int, int begin, int end) {
+    std::vector<float> buffer((size_t) height * GAUSSIAN_STRIP);
+    std::vector<float> edge(4 * GAUSSIAN_STRIP);
+
+    for (int strip= begin; strip < end; strip++) {
+      int start= strip * GAUSSIAN_STRIP;
+      int count= std::min(GAUSSIAN_STRIP, rowBytes - start);
+      for (int y= 0; y < height; y++) {
+        std::memcpy(buffer.data() + (size_t) y * GAUSSIAN_STRIP,
+            horizontal.data() + (size_t) y * rowBytes + start, count * sizeof(float));
+      }
+
+      recursiveColumnsVariants[isa](buffer.data(), height, g, edge.data());
+
+      for (int y= 0; y < height; y++) {
+        const float* in= buffer.data() + (size_t) y * GAUSSIAN_STRIP;
+        unsigned char* out= result.rowData(y) + start;
+        for (int b= 0; b < count; b++) {
+          out[b]= (unsigned char) clamp((int) (in[b] + 0.5f), 0, 255);
+        }
+      }
+    }
+  }, 1);
+
+  return result;
+}
+
+Image Image::gaussianBlur(float sigma) const {
+  assert(sigma >= 0.0f);
+  if (sigma < 0.5f) return *this;
+  return dispatched("gaussianBlur", [&](Isa isa) {
+    return recursiveGaussianBlur(*this, sigma, isa);
+  });
+}
+
+Image Image::boxBlur() const {
+  int kernel[] {1, 1, 1,
+                1, 1, 1,
+                1, 1, 1};
+  float scale= 1.0f/9.0f;
+
+  Image result= this->convolute(kernel, scale, 3);
+
+  return result;
+}
+
+Image Image::ridgeDetection() const {
+  int kernel[] {-1, -1, -1, -1, 8, -1, -1, -1, -1};
+
+  Image result= this->convolute(kernel, 1, 3);
+
+  return result;
+}
+
+Image Image::unsharpMasking() const {
+  int kernel[] {1, 4, 6, 4, 1,
+                4, 16, 24, 16, 4,
+                6, 24, -476, 24, 6,
+                4, 16, 24, 16, 4,
+                1, 4, 6, 4, 1};
+  float scale= -1/256.0f;
+
+  Image result= this->convolute(kernel, scale, 5);
+  return result;
+}
+
+Image Image::sobel() const {
+  Image result(this->myWidth, this->myHeight);
+  this->sobelPass(&result, nullptr, nullptr, nullptr);
+
+  return result;
+}
+
+Image Image::sobelOrientation() const {
+  Image result(this->myWidth, this->myHeight);
+  this->sobelPass(nullptr, &result, nullptr, nullptr);
+
+  return result;
+}
+
+Gradient Image::gradient() const {
+  Gradient result;
+  result.width= this->myWidth;
+  result.height= this->myHeight;
+  result.gx.resize((size_t) this->totalPixels * NUM_CHANNELS);
+  result.gy.resize((size_t) this->totalPixels * NUM_CHANNELS);
+  this->sobelPass(nullptr, nullptr, result.gx.data(), result.gy.data());
+
+  return result;
+}
+
+void Image::sobelPass(Image* magnitude, Image* orientation,
+  short* gx, short* gy) const {
+  int rowBytes= this->myWidth * NUM_CHANNELS;
+
+  parallelFor(this->myHeight, [&](int, int begin, int end) {
+    for (int i= begin; i < end; i++) {
+      // rows above and below are clamped at the borders
+      const unsigned char* up= this->rowData(clamp(i - 1, 0, this->myHeight - 1));
+      const unsigned char* mid= this->rowData(i);
+      const unsigned char* down= this->rowData(clamp(i + 1, 0, this->myHeight - 1));
+      size_t offset= (size_t) i * rowBytes;
+
+      sobelRow(up, mid, down, this->myWidth,
+        magnitude != nullptr ? magnitude->rowData(i) : nullptr,
+        orientation != nullptr ? orientation->rowData(i) : nullptr,
+        gx != nullptr ? gx + offset : nullptr,
+        gy != nullptr ? gy + offset : nullptr);
+    }
+  });
+}
+
+void sobelRow(const unsigned char* up, const unsigned char* mid,
+  const unsigned char* down, int width, unsigned char* magnitude,
+  unsigned char* orientation, short* gx, short* gy) {
+  const float pi= 3.14159265f;
+
+  for (int j= 0; j < width; j++) {
+    int left= clamp(j - 1, 0, width - 1) * NUM_CHANNELS;
+    int right= clamp(j + 1, 0, width - 1) * NUM_CHANNELS;
+    int center= j * NUM_CHANNELS;
+
+    for (int c= 0; c < NUM_CHANNELS; c++) {
+      // |gx|, |gy| <= 4 * 255 so both fit in 16 bits
+      short x= (up[right + c] + 2 * mid[right + c] + down[right + c]) -
+               (up[left + c] + 2 * mid[left + c] + down[left + c]);
+      short y= (down[left + c] + 2 * down[center + c] + down[right + c]) -
+               (up[left + c] + 2 * up[center + c] + up[right + c]);
+      int idx= center + c;
+
+      if (gx != nullptr) gx[idx]= x;
+      if (gy != nullptr) gy[idx]= y;
+      if (magnitude != nullptr) {
+        magnitude[idx]= clamp(std::sqrt((float) (x * x + y * y)), 0, 255);
+      }
+      if (orientation != nullptr) {
+        float angle= std::atan2((float) y, (float) x); // -pi to pi
+        orientation[idx]= clamp((angle + pi) * (255.0f / (2 * pi)) + 0.5f, 0, 255);
+      }
+    }
+  }
+}
+
+Image Image::extract(const Pixel& low, const Pixel& high) const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const Pixel* src= this->row(i);
+    Pixel* dst= result.row(i);
+    for (int j= 0; j < this->myWidth; j++) {
+      Pixel pixel= src[j];
+      if (pixel.r < low.r || pixel.g < low.g || pixel.b < low.b ||
+          pixel.r > high.r || pixel.g > high.g || pixel.b > high.b) {
+        pixel= Pixel{0, 0, 0};
+      }
+      dst[j]= pixel;
+    }
+  }
+
+  return result;
+}
+
+Image Image::extractRed() const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const unsigned char* src= this->rowData(i);
+    unsigned char* dst= result.rowData(i);
+    std::memset(dst, 0, (size_t) this->myWidth * NUM_CHANNELS);
+    for (int j= RED; j < this->myWidth * NUM_CHANNELS; j+= NUM_CHANNELS) {
+      dst[j]= src[j];
+    }
+  }
+
+  return result;
+}
+
+Image Image::extractGreen() const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const unsigned char* src= this->rowData(i);
+    unsigned char* dst= result.rowData(i);
+    std::memset(dst, 0, (size_t) this->myWidth * NUM_CHANNELS);
+    for (int j= GREEN; j < this->myWidth * NUM_CHANNELS; j+= NUM_CHANNELS) {
+      dst[j]= src[j];
+    }
+  }
+
+  return result;
+}
+
+Image Image::extractBlue() const {
+  Image result(this->myWidth, this->myHeight);
+
+  for (int i= 0; i < this->myHeight; i++) {
+    const unsigned char* src= this->rowData(i);
+    unsigned char* dst= result.rowData(i);
+    std::memset(dst, 0, (size_t) this->myWidth * NUM_CHANNELS);
+    for (int j= BLUE; j < this->myWidth * NUM_CHANNELS; j+= NUM_CHANNELS) {
+      dst[j]= src[j];
+    }
+  }
+
+  return result;
+}
+
+Image Image::gridCopy(int m, int n) const {
+  Image result(this->myWidth * n, this->myHeight * m);
+
+  size_t widthBytes= (size_t) this->myWidth * NUM_CHANNELS;
+
+  // this iterates row-by-row of our current image
+  // and copies the bytes directly over to each grid cell
+  // in result
+  for (int i= 0; i < m * this->myHeight; i++) {
+    const unsigned char* src= this->rowData(i % this->myHeight);
+    unsigned char* dst= result.rowData(i);
+    for (int j= 0; j < n; j++) {
+      std::memcpy(dst + j * widthBytes, src, widthBytes);
+    }
+  }
+
+  return result;
+}
+
+void Image::inImageCheck(int row, int col) const {
+  AGL_CHECK(row >= 0 && row < this->myHeight);
+  AGL_CHECK(col >= 0 && col < this->myWidth);
+  AGL_CHECK(this->myData != nullptr);
+}
+
+
+// Rough cost per output pixel of the direct and FFT convolutions, in
+// multiply-adds. The FFT runs 3 channels as 1.5 complex signals, forward
+// and inverse over an N x N tile that yields (N - side + 1)^2 pixels.
+// FFT_WEIGHT folds in its heavier butterflies and memory traffic.
+static const double FFT_WEIGHT= 2.0;
+
+static double directCost(int sideLength) {
+  return 3.0 * sideLength * sideLength;
+}
+
+static double fftCost(int tile, int sideLength) {
+  double valid= tile - sideLength + 1;
+  double perTile= 1.5 * (2.0 * 2.0 * tile * tile * std::log2((double) tile) + tile * tile);
+  return FFT_WEIGHT * perTile / (valid * valid);
+}
+
+// Cheapest power-of-two FFT tile for this kernel and image, or 0 if the
+// direct convolution is cheaper
+static int fftTileSize(int sideLength, int width, int height) {
+  int largest= nextPowerOfTwo(std::max(width, height) + sideLength - 1);
+  int best= 0;
+  double bestCost= directCost(sideLength);
+  for (int tile= nextPowerOfTwo(2 * sideLength); tile <= std::min(largest, 1024); tile*= 2) {
+    double cost= fftCost(tile, sideLength);
+    if (cost < bestCost) {
+      best= tile;
+      bestCost= cost;
+    }
+  }
+  return best;
+}
+
+Image Image::convolute(int kernel[], float kernelScale, int sideLength) const {
+  if (fftTileSize(sideLength, this->myWidth, this->myHeight) > 0) {
+    return this->convoluteFFT(kernel, kernelScale, sideLength);
+  }
+  return this->convoluteDirect(kernel, kernelScale, sideLength);
+}
+
+// Overlap-save FFT convolution with the column transforms compiled for isa
+static Image fftConvolution(const Image& source, int kernel[], float kernelScale,
+    int sideLength, Isa isa) {
+  int width= source.width();
+  int height= source.height();
+  int half= sideLength / 2;
+  int n= fftTileSize(sideLength, width, height);
+  if (n == 0) n= nextPowerOfTwo(2 * sideLength);
+  Image result(width, height);
+  FFT fft(n, isa);
+
+  // Overlap-save: each tile reads an n x n block starting half a kernel
+  // above and left of its output (clamped to the image), and the circular
+  // convolution is exact for the last n - sideLength + 1 rows and columns
+  int valid= n - sideLength + 1;
+  int across= (width + valid - 1) / valid;
+  int down= (height + valid - 1) / valid;
+  int tiles= across * down;
+  size_t area= (size_t) n * n;
+
+  // kernel spectrum, with the scale and the inverse's 1 / n^2 folded in
+  std::vector<Complex> spectrum(area);
+  float weight= kernelScale / ((float) n * n);
+  for (int k_i= 0; k_i < sideLength; k_i++) {
+    for (int k_j= 0; k_j < sideLength; k_j++) {
+      spectrum[(size_t) k_i * n + k_j]= Complex(weight * kernel[k_i * sideLength + k_j], 0.0f);
+    }
+  }
+  fft.transform2D(spectrum.data(), false);
+
+  // tiles go in pairs: R + iG of each tile, and B of the first + i B of
+  // the second, so 6 real channels take 3 complex transforms
+  int pairs= (tiles + 1) / 2;
+  parallelFor(pairs, [&](int, int begin, int end) {
+    std::vector<Complex> buffers[3];
+    for (int b= 0; b < 3; b++) buffers[b].resize(area);
+
+    for (int pair= begin; pair < end; pair++) {
+      int count= std::min(2, tiles - 2 * pair);
+      for (int b= 0; b < 3; b++) std::fill(buffers[b].begin(), buffers[b].end(), Complex());
+
+      for (int t= 0; t < count; t++) {
+        int tile= 2 * pair + t;
+        int x0= (tile % across) * valid - half;
+        int y0= (tile / across) * valid - half;
+        for (int p= 0; p < n; p++) {
+          const unsigned char* src= source.rowData(clamp(y0 + p, 0, height - 1));
+          Complex* rg= buffers[t].data() + (size_t) p * n;
+          Complex* blue= buffers[2].data() + (size_t) p * n;
+          for (int q= 0; q < n; q++) {
+            const unsigned char* pixel= src + clamp(x0 + q, 0, width - 1) * NUM_CHANNELS;
+            rg[q]= Complex(pixel[RED], pixel[GREEN]);
+            if (t == 0) blue[q].real(pixel[BLUE]);
+            else blue[q].imag(pixel[BLUE]);
+          }
+        }
+      }
+
+      for (int b= 0; b < 3; b++) {
+        if (b == 1 && count == 1) continue;
+        Complex* values= buffers[b].data();
+        fft.transform2D(values, false);
+        for (size_t i= 0; i < area; i++) {
+          Complex v= values[i];
+          Complex k= spectrum[i];
+          values[i]= Complex(v.real() * k.real() - v.imag() * k.imag(),
+                             v.real() * k.imag() + v.imag() * k.real());
+        }
+        fft.transform2D(values, true);
+      }
+
+      for (int t= 0; t < count; t++) {
+        int tile= 2 * pair + t;
+        int x0= (tile % across) * valid;
+        int y0= (tile / across) * valid;
+        int columns= std::min(valid, width - x0);
+        int rows= std::min(valid, height - y0);
+        for (int p= 0; p < rows; p++) {
+          const Complex* rg= buffers[t].data() + (size_t) (p + sideLength - 1) * n + sideLength - 1;
+          const Complex* blue= buffers[2].data() + (size_t) (p + sideLength - 1) * n + sideLength - 1;
+          unsigned char* out= result.rowData(y0 + p) + x0 * NUM_CHANNELS;
+          for (int q= 0; q < columns; q++) {
+            // truncate like the direct path, but values a rounding error
+            // below an integer count as that integer
+            float b= t == 0 ? blue[q].real() : blue[q].imag();
+            out[q * NUM_CHANNELS + RED]= clamp((int) (rg[q].real() + 1e-3f), 0, 255);
+            out[q * NUM_CHANNELS + GREEN]= clamp((int) (rg[q].imag() + 1e-3f), 0, 255);
+            out[q * NUM_CHANNELS + BLUE]= clamp((int) (b + 1e-3f), 0, 255);
+          }
+        }
+      }
+    }
+  }, 1);
+
+  return result;
+}
+
+Image Image::convoluteFFT(int kernel[], float kernelScale, int sideLength) const {
+  return dispatched("convoluteFFT", [&](Isa isa) {
+    return fftConvolution(*this, kernel, kernelScale, sideLength, isa);
+  });
+}
+
+Image Image::convoluteDirect(int kernel[], float kernelScale, int sideLength) const {
+  Image result(this->myWidth, this->myHeight);
+  int half= sideLength / 2;
+
+  parallelFor(this->myHeight, [&](int, int begin, int end) {
+    std::vector<const unsigned char*> rows(sideLength);
+    for (int i= begin; i < end; i++) {
+      // kernel rows are centered on i and clamped to the image
+      for (int k_i= 0; k_i < sideLength; k_i++) {
+        rows[k_i]= this->rowData(clamp(i + k_i - half, 0, this->myHeight - 1));
+      }
+      convolveRow(rows.data(), this->myWidth, kernel, kernelScale, sideLength,
+        result.rowData(i));
+    }
+  });
+
+  return result;
+}
+
+void convolveRow(const unsigned char* const* rows, int width, const int* kernel,
+  float kernelScale, int sideLength, unsigned char* out) {
+  int half= sideLength / 2;
+
+  for (int j= 0; j < width; j++) {
+    float accumulatorRed= 0;
+    float accumulatorGreen= 0;
+    float accumulatorBlue= 0;
+
+    // convolute operator
+    for (int k_i= 0; k_i < sideLength; k_i++) {
+      for (int k_j= 0; k_j < sideLength; k_j++) {
+        int pixel_j= clamp(j + k_j - half, 0, width - 1);
+        const unsigned char* pixel= rows[k_i] + pixel_j * NUM_CHANNELS;
+
+        // convolution operator requires us to multiply the index
+        // mirrored to the pixel aka (m-i-1, n-j-1)
+        int kernel_idx= (sideLength - 1 - k_i) * sideLength + (sideLength - 1 - k_j);
+        accumulatorRed += kernelScale * kernel[kernel_idx] * pixel[RED];
+        accumulatorGreen += kernelScale * kernel[kernel_idx] * pixel[GREEN];
+        accumulatorBlue += kernelScale * kernel[kernel_idx] * pixel[BLUE];
+      }
+    }
+
+    out[j * NUM_CHANNELS + RED]= clamp(accumulatorRed, 0, 255);
+    out[j * NUM_CHANNELS + GREEN]= clamp(accumulatorGreen, 0, 255);
+    out[j * NUM_CHANNELS + BLUE]= clamp(accumulatorBlue, 0, 255);
+  }
+}
+
+unsigned char ImageStats::percentile(int channel, float p) const {
+  // rank of the pixel we are looking for, at least the first one
+  double target= std::max(1.0, std::ceil(p / 100.0 * this->count));
+  double cumulative= 0;
+
+  for (int v= 0; v < 256; v++) {
+    cumulative+= this->histogram[channel][v];
+    if (cumulative >= target) return v;
+  }
+  return this->max[channel];
+}
+
+ImageStats Image::statistics() const {
+  ImageStats stats;
+  std::memset(&stats, 0, sizeof(stats));
+  stats.count= this->totalPixels;
+
+  // each thread fills its own private histograms, merged afterwards
+  int chunks= parallelChunks(this->myHeight);
+  std::vector<unsigned int> partial(chunks * NUM_CHANNELS * 256, 0);
+  int rowBytes= this->myWidth * NUM_CHANNELS;
+
+  parallelFor(this->myHeight, [&](int chunk, int begin, int end) {
+    unsigned int* hist= partial.data() + chunk * NUM_CHANNELS * 256;
+    unsigned int* red= hist;
+    unsigned int* green= hist + 256;
+    unsigned int* blue= hist + 512;
+
+    for (int i= begin; i < end; i++) {
+      const unsigned char* p= this->rowData(i);
+      const unsigned char* last= p + rowBytes;
+      for (; p < last; p+= NUM_CHANNELS) {
+        red[p[RED]]++;
+        green[p[GREEN]]++;
+        blue[p[BLUE]]++;
+      }
+    }
+  });
+
+  for (int chunk= 0; chunk < chunks; chunk++) {
+    const unsigned int* hist= partial.data() + chunk * NUM_CHANNELS * 256;
+    for (int c= 0; c < NUM_CHANNELS; c++) {
+      for (int v= 0; v < 256; v++) stats.histogram[c][v]+= hist[c * 256 + v];
+    }
+  }
+
+  // everything else follows from the histograms
+  if (stats.count == 0) return stats;
+  for (int c= 0; c < NUM_CHANNELS; c++) {
+    const unsigned int* hist= stats.histogram[c];
+    double sum= 0;
+    double sumSquares= 0;
+    int lo= 255;
+    int hi= 0;
+    for (int v= 0; v < 256; v++) {
+      if (hist[v] == 0) continue;
+      lo= std::min(lo, v);
+      hi= std::max(hi, v);
+      sum+= (double) v * hist[v];
+      sumSquares+= (double) v * v * hist[v];
+    }
+    double mean= sum / stats.count;
+    stats.min[c]= lo;
+    stats.max[c]= hi;
+    stats.mean[c]= mean;
+    stats.variance[c]= std::max(0.0, sumSquares / stats.count - mean * mean);
+  }
+
+  return stats;
+}
+
+Image Image::applyLUT(const unsigned char lut[3][256]) const {
+  Image result(this->myWidth, this->myHeight);
+  int rowBytes= this->myWidth * NUM_CHANNELS;
+
+  parallelFor(this->myHeight, [&](int, int begin, int end) {
+    for (int i= begin; i < end; i++) {
+      const unsigned char* src= this->rowData(i);
+      unsigned char* dst= result.rowData(i);
+      for (int j= 0; j < rowBytes; j+= NUM_CHANNELS) {
+        dst[j + RED]= lut[RED][src[j + RED]];
+        dst[j + GREEN]= lut[GREEN][src[j + GREEN]];
+        dst[j + BLUE]= lut[BLUE][src[j + BLUE]];
+      }
+    }
+  });
+
+  return result;
+}
+
+Image Image::equalize() const {
+  ImageStats stats= this->statistics();
+  unsigned char lut[3][256];
+
+  for (int c= 0; c < NUM_CHANNELS; c++) {
+    // maps the cumulative distribution onto 0..255, starting from
+    // the first value that actually occurs
+    unsigned int cdfMin= stats.histogram[c][stats.min[c]];
+    double range= std::max(1.0, (double) stats.count - cdfMin);
+    double cumulative= 0;
+    for (int v= 0; v < 256; v++) {
+      cumulative+= stats.histogram[c][v];
+      lut[c][v]= clamp(std::lround((cumulative - cdfMin) / range * 255), 0, 255);
+    }
+  }
+
+  return this->applyLUT(lut);
+}
+
+Image Image::autoLevels(float clipPercent) const {
+  ImageStats stats= this->statistics();
+  unsigned char lut[3][256];
+
+  for (int c= 0; c < NUM_CHANNELS; c++) {
+    int lo= stats.percentile(c, clipPercent);
+    int hi= stats.percentile(c, 100 - clipPercent);
+    float scale= (hi > lo) ? 255.0f / (hi - lo) : 1.0f;
+    for (int v= 0; v < 256; v++) {
+      lut[c][v]= clamp(std::lround((v - lo) * scale), 0, 255);
+    }
+  }
+
+  return this->applyLUT(lut);
+}
+
+Image Image::glow(const Pixel& low, const Pixel& high) const {
+  return this->add(this->extract(low, high).boxBlur());
+}
+
+
+// Comparators of Batcher's odd-even merge sort on n (a power of two)
+// inputs, keeping only the ones that can change output index target
+static std::vector<std::pair<int, int>> selectionNetwork(int n, int target) {
+  std::vector<std::pair<int, int>> network;
+  for (int p= 1; p < n; p <<= 1) {
+    for (int k= p; k >= 1; k >>= 1) {
+      for (int j= k % p; j + k < n; j+= 2 * k) {
+        for (int i= 0; i < k && i + j + k < n; i++) {
+          if ((i + j) / (2 * p) == (i + j + k) / (2 * p)) {
+            network.push_back(std::make_pair(i + j, i + j + k));
+          }
+        }
+      }
+    }
+  }
+
+  // walk backwards from the output, a comparator matters if it
+  // writes a position that matters
+  std::vector<bool> needed(n, false);
+  needed[target]= true;
+  std::vector<std::pair<int, int>> pruned;
+  for (int c= (int) network.size() - 1; c >= 0; c--) {
+    int a= network[c].first;
+    int b= network[c].second;
+    if (needed[a] || needed[b]) {
+      needed[a]= true;
+      needed[b]= true;
+      pruned.push_back(network[c]);
+    }
+  }
+  std::reverse(pruned.begin(), pruned.end());
+
+  return pruned;
+}
+
+// Output bytes a sorting network works on at once
+static const int NETWORK_LANES= 64;
+
+// Runs a whole network over rows of NETWORK_LANES values. Each comparator
+// is a min/max over two rows that never overlap, which lets it vectorize
+static AGL_INLINE void applyNetwork(unsigned char* values,
+    const std::pair<int, int>* network, int comparators) {
+  for (int c= 0; c < comparators; c++) {
+    unsigned char* a= values + network[c].first * NETWORK_LANES;
+    unsigned char* b= values + network[c].second * NETWORK_LANES;
+    AGL_IVDEP
+    for (int l= 0; l < NETWORK_LANES; l++) {
+      // written as selects; std::min/std::max here become compare-and-blend
+      unsigned char x= a[l];
+      unsigned char y= b[l];
+      a[l]= x < y ? x : y;
+      b[l]= x < y ? y : x;
+    }
+  }
+}
+AGL_VARIANTS(applyNetwork, (unsigned char* values, const std::pair<int, int>* network,
+  int comparators), (values, network, comparators))
+
+// Median for radius 1 (3x3) or 2 (5x5) with a sorting network that runs
+// on NETWORK_LANES output bytes at a time, so every compare-exchange is
+// a vectorizable min/max over arrays
+static void medianNetworkFilter(const Image& source, Image& result, int radius, Isa isa) {
+  const int lanes= NETWORK_LANES;
+  int side= 2 * radius + 1;
+  int count= side * side;
+  int size= 1;
+  while (size < count) size<<= 1;
+
+  // pad to a power of two with equally many zeros below and 255s above
+  // the real values, which shifts the median by the number of zeros
+  int zeros= (size - count) / 2;
+  int target= count / 2 + zeros;
+  static const std::vector<std::pair<int, int>> network3= selectionNetwork(16, 9 / 2 + (16 - 9) / 2);
+  static const std::vector<std::pair<int, int>> network5= selectionNetwork(32, 25 / 2 + (32 - 25) / 2);
+  const std::vector<std::pair<int, int>>& network= (radius == 1) ? network3 : network5;
+
+  int width= source.width();
+  int height= source.height();
+  int rowBytes= width * NUM_CHANNELS;
+  int paddedBytes= (width + 2 * radius) * NUM_CHANNELS;
+  auto run= applyNetworkVariants[isa];
+
+  parallelFor(height, [&](int, int begin, int end) {
+    // rows of the window with radius border pixels replicated on each side
+    std::vector<unsigned char> padded(side * paddedBytes);
+    std::vector<unsigned char> values(size * lanes);
+
+    for (int i= begin; i < end; i++) {
+      for (int k= 0; k < side; k++) {
+        const unsigned char* src= source.rowData(clamp(i + k - radius, 0, height - 1));
+        unsigned char* dst= padded.data() + k * paddedBytes;
+        for (int b= 0; b < radius; b++) {
+          std::memcpy(dst + b * NUM_CHANNELS, src, NUM_CHANNELS);
+          std::memcpy(dst + (radius + width + b) * NUM_CHANNELS, src + rowBytes - NUM_CHANNELS, NUM_CHANNELS);
+        }
+        std::memcpy(dst + radius * NUM_CHANNELS, src, rowBytes);
+      }
+
+      unsigned char* out= result.rowData(i);
+      for (int start= 0; start < rowBytes; start+= lanes) {
+        int used= std::min(lanes, rowBytes - start);
+
+        // the network shuffles the padding too, so it is reset every time
+        for (int v= count; v < size; v++) {
+          std::memset(values.data() + v * lanes, (v - count < zeros) ? 0 : 255, lanes);
+        }
+
+        // neighbour (dy, dx) of output byte b is padded row dy at b + dx * 3
+        for (int dy= 0; dy < side; dy++) {
+          for (int dx= 0; dx < side; dx++) {
+            std::memcpy(values.data() + (dy * side + dx) * lanes,
+              padded.data() + dy * paddedBytes + dx * NUM_CHANNELS + start, used);
+          }
+        }
+
+        run(values.data(), network.data(), (int) network.size());
+        std::memcpy(out + start, values.data() + target * lanes, used);
+      }
+    }
+  });
+}
+
+Image Image::medianFilter(int radius) const {
+  if (radius == 1 || radius == 2) {
+    return dispatched("medianFilter", [&](Isa isa) {
+      Image result(this->myWidth, this->myHeight);
+      medianNetworkFilter(*this, result, radius, isa);
+      return result;
+    });
+  }
+  return this->rankFilter(radius, 0.5f);
+}
+
+Image Image::minFilter(int radius) const {
+  return this->erode(radius);
+}
+
+Image Image::maxFilter(int radius) const {
+  return this->dilate(radius);
+}
+
+struct MinOp {
+  AGL_INLINE unsigned char operator()(unsigned char a, unsigned char b) const { return a < b ? a : b; }
+};
+
+struct MaxOp {
+  AGL_INLINE unsigned char operator()(unsigned char a, unsigned char b) const { return a < b ? b : a; }
+};
+
+// Byte columns the vertical pass handles at once
+static const int MORPHOLOGY_STRIP= 64;
+
+// Input of the vertical van Herk pass: the row pass output, height rows
+// of stride bytes. The stride is a whole number of strips, so every strip
+// is MORPHOLOGY_STRIP bytes wide and its loops have a fixed trip count
+struct VanHerkColumns {
+  const unsigned char* horizontal;
+  size_t stride;
+  int height;
+  int radius;
+  int columnLength;
+  Image* result;
+};
+
+// Vertical pass over the strip at byte start, of which count bytes are in
+// the image; g and h hold columnLength rows of MORPHOLOGY_STRIP bytes, and
+// overlap neither each other nor the images
+template <typename Select>
+static AGL_INLINE void vanHerkStrip(const VanHerkColumns& job, int start, int count,
+    unsigned char* g, unsigned char* h, Select select) {
+  int side= 2 * job.radius + 1;
+
+  for (int p= 0; p < job.columnLength; p++) {
+    const unsigned char* f= job.horizontal +
+      clamp(p - job.radius, 0, job.height - 1) * job.stride + start;
+    unsigned char* gp= g + (size_t) p * MORPHOLOGY_STRIP;
+    if (p % side == 0) {
+      std::memcpy(gp, f, MORPHOLOGY_STRIP);
+    } else {
+      const unsigned char* previous= gp - MORPHOLOGY_STRIP;
+      AGL_IVDEP
+      for (int b= 0; b < MORPHOLOGY_STRIP; b++) gp[b]= select(previous[b], f[b]);
+    }
+  }
+  for (int p= job.columnLength - 1; p >= 0; p--) {
+    const unsigned char* f= job.horizontal +
+      clamp(p - job.radius, 0, job.height - 1) * job.stride + start;
+    unsigned char* hp= h + (size_t) p * MORPHOLOGY_STRIP;
+    if (p % side == side - 1) {
+      std::memcpy(hp, f, MORPHOLOGY_STRIP);
+    } else {
+      const unsigned char* next= hp + MORPHOLOGY_STRIP;
+      AGL_IVDEP
+      for (int b= 0; b < MORPHOLOGY_STRIP; b++) hp[b]= select(next[b], f[b]);
+    }
+  }
+  for (int y= 0; y < job.height; y++) {
+    const unsigned char* hp= h + (size_t) y * MORPHOLOGY_STRIP;
+    const unsigned char* gp= g + (size_t) (y + 2 * job.radius) * MORPHOLOGY_STRIP;
+    unsigned char row[MORPHOLOGY_STRIP];
+    for (int b= 0; b < MORPHOLOGY_STRIP; b++) row[b]= select(hp[b], gp[b]);
+    std::memcpy(job.result->rowData(y) + start, row, count);
+  }
+}
+
+static AGL_INLINE void erodeStrip(const VanHerkColumns& job, int start, int count,
+    unsigned char* g, unsigned char* h) {
+  vanHerkStrip(job, start, count, g, h, MinOp());
+}
+AGL_VARIANTS(erodeStrip, (const VanHerkColumns& job, int start, int count,
+  unsigned char* g, unsigned char* h), (job, start, count, g, h))
+
+static AGL_INLINE void dilateStrip(const VanHerkColumns& job, int start, int count,
+    unsigned char* g, unsigned char* h) {
+  vanHerkStrip(job, start, count, g, h, MaxOp());
+}
+AGL_VARIANTS(dilateStrip, (const VanHerkColumns& job, int start, int count,
+  unsigned char* g, unsigned char* h), (job, start, count, g, h))
+
+typedef void (*StripKernel)(const VanHerkColumns&, int, int, unsigned char*, unsigned char*);
+
+// Running min/max over a (2 * radius + 1) window with van Herk / Gil-Werman:
+// the padded line is cut into segments of the window size, g holds the
+// running result from each segment's start and h from each segment's end,
+// so every window is select(h[x], g[x + 2 * radius]) -- three comparisons
+// per value whatever the radius. Runs along rows, then along columns where
+// each step works on a whole strip of bytes at once (stripPass, which must
+// use the same select).
+template <typename Select>
+static Image vanHerkFilter(const Image& source, int radius, Select select, StripKernel stripPass) {
+  int width= source.width();
+  int height= source.height();
+  int side= 2 * radius + 1;
+  int rowBytes= width * NUM_CHANNELS;
+  int strips= (rowBytes + MORPHOLOGY_STRIP - 1) / MORPHOLOGY_STRIP;
+
+  // the default stride is a multiple of MORPHOLOGY_STRIP, so whole strips
+  // can be read from every row; the padding they cover is zero
+  Image horizontal(width, height);
+  assert(horizontal.stride() >= strips * MORPHOLOGY_STRIP);
+  Image result(width, height);
+
+  // rows: values are pixels, with the 3 channels handled side by side
+  int rowLength= (width + 2 * radius + side - 1) / side * side;
+  parallelFor(height, [&](int, int begin, int end) {
+    std::vector<unsigned char> g(rowLength * NUM_CHANNELS);
+    std::vector<unsigned char> h(rowLength * NUM_CHANNELS);
+
+    for (int i= begin; i < end; i++) {
+      const unsigned char* src= source.rowData(i);
+      unsigned char* out= horizontal.rowData(i);
+
+      for (int p= 0; p < rowLength; p++) {
+        const unsigned char* f= src + clamp(p - radius, 0, width - 1) * NUM_CHANNELS;
+        for (int c= 0; c < NUM_CHANNELS; c++) {
+          int idx= p * NUM_CHANNELS + c;
+          g[idx]= (p % side == 0) ? f[c] : select(g[idx - NUM_CHANNELS], f[c]);
+        }
+      }
+      for (int p= rowLength - 1; p >= 0; p--) {
+        const unsigned char* f= src + clamp(p - radius, 0, width - 1) * NUM_CHANNELS;
+        for (int c= 0; c < NUM_CHANNELS; c++) {
+          int idx= p * NUM_CHANNELS + c;
+          h[idx]= (p % side == side - 1) ? f[c] : select(h[idx + NUM_CHANNELS], f[c]);
+        }
+      }
+      for (int b= 0; b < width * NUM_CHANNELS; b++) {
+        out[b]= select(h[b], g[b + 2 * radius * NUM_CHANNELS]);
+      }
+    }
+  });
+
+  // columns: one step handles a strip of MORPHOLOGY_STRIP bytes of a row
+  int columnLength= (height + 2 * radius + side - 1) / side * side;
+  VanHerkColumns job= {horizontal.data(), (size_t) horizontal.stride(), height, radius,
+    columnLength, &result};
+  parallelFor(strips, [&](int, int begin, int end) {
+    std::vector<unsigned char> g((size_t) columnLength * MORPHOLOGY_STRIP);
+    std::vector<unsigned char> h((size_t) columnLength * MORPHOLOGY_STRIP);
+
+    for (int strip= begin; strip < end; strip++) {
+      int start= strip * MORPHOLOGY_STRIP;
+      int count= std::min(MORPHOLOGY_STRIP, rowBytes - start);
+      stripPass(job, start, count, g.data(), h.data());
+    }
+  }, 1);
+
+  return result;
+}
+
+Image Image::erode(int radius) const {
+  assert(radius >= 0);
+  return dispatched("erode", [&](Isa isa) {
+    return vanHerkFilter(*this, radius, MinOp(), erodeStripVariants[isa]);
+  });
+}
+
+Image Image::dilate(int radius) const {
+  assert(radius >= 0);
+  return dispatched("dilate", [&](Isa isa) {
+    return vanHerkFilter(*this, radius, MaxOp(), dilateStripVariants[isa]);
+  });
+}
+
+Image Image::opening(int radius) const {
+  return this->erode(radius).dilate(radius);
+}
+
+Image Image::closing(int radius) const {
+  return this->dilate(radius).erode(radius);
+}
+
+Image Image::topHat(int radius) const {
+  return this->subtract(this->opening(radius));
+}
+
+Image Image::blackHat(int radius) const {
+  return this->closing(radius).subtract(*this);
+}
+
+Image Image::rankFilter(int radius, float rank) const {
+  assert(radius >= 0 && radius < 32767);
+  Image result(this->myWidth, this->myHeight);
+  int side= 2 * radius + 1;
+  int rowBytes= this->myWidth * NUM_CHANNELS;
+
+  // the window holds side * side values, we want the one at position k
+  unsigned int k= std::lround(std::min(std::max(rank, 0.0f), 1.0f) * (side * side - 1));
+
+  // Sliding histograms (Perreault and Hebert, "Median Filtering in
+  // Constant Time"): every byte column keeps a histogram of the side rows
+  // around the current row, and the window histogram is updated by adding
+  // the column entering on the right and removing the one leaving on the
+  // left. Both updates are 256 adds whatever the radius.
+  parallelFor(this->myHeight, [&](int, int begin, int end) {
+    std::vector<unsigned short> columns((size_t) rowBytes * 256, 0);
+    unsigned int window[NUM_CHANNELS][256];
+
+    for (int dy= -radius; dy <= radius; dy++) {
+      const unsigned char* src= this->rowData(clamp(begin + dy, 0, this->myHeight - 1));
+      for (int b= 0; b < rowBytes; b++) columns[(size_t) b * 256 + src[b]]++;
+    }
+
+    for (int i= begin; i < end; i++) {
+      if (i > begin) {
+        // slide every column histogram down one row
+        const unsigned char* leaving= this->rowData(clamp(i - radius - 1, 0, this->myHeight - 1));
+        const unsigned char* entering= this->rowData(clamp(i + radius, 0, this->myHeight - 1));
+        for (int b= 0; b < rowBytes; b++) {
+          columns[(size_t) b * 256 + leaving[b]]--;
+          columns[(size_t) b * 256 + entering[b]]++;
+        }
+      }
+
+      std::memset(window, 0, sizeof(window));
+      for (int dx= -radius; dx <= radius; dx++) {
+        int col= clamp(dx, 0, this->myWidth - 1);
+        for (int c= 0; c < NUM_CHANNELS; c++) {
+          const unsigned short* column= columns.data() + (size_t) (col * NUM_CHANNELS + c) * 256;
+          for (int v= 0; v < 256; v++) window[c][v]+= column[v];
+        }
+      }
+
+      unsigned char* out= result.rowData(i);
+      for (int j= 0; j < this->myWidth; j++) {
+        if (j > 0) {
+          int entering= clamp(j + radius, 0, this->myWidth - 1);
+          int leaving= clamp(j - radius - 1, 0, this->myWidth - 1);
+          for (int c= 0; c < NUM_CHANNELS; c++) {
+            const unsigned short* add= columns.data() + (size_t) (entering * NUM_CHANNELS + c) * 256;
+            const unsigned short* remove= columns.data() + (size_t) (leaving * NUM_CHANNELS + c) * 256;
+            for (int v= 0; v < 256; v++) window[c][v]+= add[v] - remove[v];
+          }
+        }
+
+        for (int c= 0; c < NUM_CHANNELS; c++) {
+          // skip 8 bins at a time while the whole group stays <= k, so the
+          // data-dependent loop below runs at most 8 times
+          unsigned int cumulative= 0;
+          int v= 0;
+          while (v < 248) {
+            const unsigned int* bins= window[c] + v;
+            unsigned int group= bins[0] + bins[1] + bins[2] + bins[3] +
+                                bins[4] + bins[5] + bins[6] + bins[7];
+            if (cumulative + group > k) break;
+            cumulative+= group;
+            v+= 8;
+          }
+          while (v < 255 && (cumulative+= window[c][v]) <= k) v++;
+          out[j * NUM_CHANNELS + c]= v;
+        }
+      }
+    }
+  }, std::max(8, side));
+
+  return result;
+}
+
+}  // namespace agl
+
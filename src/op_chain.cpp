@@ -0,0 +1,362 @@
+#include "op_chain.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace agl {
+
+namespace {
+
+// What an operation gets: its numbers and the images its $k arguments name
+struct OpArgs {
+  const double* numbers;
+  const Image* const* images;
+};
+
+typedef bool (*OpRun)(const Image& image, const OpArgs& args, Image& result, std::string& error);
+
+struct OpSpec {
+  const char* name;
+  const char* help;   // the arguments, as shown by operationHelp()
+  int images;         // leading $k arguments
+  int required;       // numbers after them
+  int optional;       // trailing numbers that may be left out
+  double defaults[2]; // values of the optional numbers when left out
+  OpRun run;
+};
+
+bool inRange(double value, double low, double high, const char* what, std::string& error) {
+  if (value >= low && value <= high) return true;
+  char message[128];
+  std::snprintf(message, sizeof(message), "%s %g is outside %g..%g", what, value, low, high);
+  error= message;
+  return false;
+}
+
+bool sameSize(const Image& a, const Image& b, std::string& error) {
+  if (a.width() == b.width() && a.height() == b.height()) return true;
+  error= "images differ in size";
+  return false;
+}
+
+// Largest side a resize or grid copy may produce
+const double MAX_SIDE= 32768;
+
+// Largest filter radius accepted
+const double MAX_RADIUS= 1000;
+
+const double MAX_SEED= 4294967295.0;
+
+#define AGL_UNARY(method) \
+  [](const Image& image, const OpArgs&, Image& result, std::string&) { \
+    result= image.method(); \
+    return true; \
+  }
+
+#define AGL_BINARY(method) \
+  [](const Image& image, const OpArgs& a, Image& result, std::string& error) { \
+    if (!sameSize(image, *a.images[0], error)) return false; \
+    result= image.method(*a.images[0]); \
+    return true; \
+  }
+
+#define AGL_RADIUS(method) \
+  [](const Image& image, const OpArgs& a, Image& result, std::string& error) { \
+    if (!inRange(a.numbers[0], 0, MAX_RADIUS, "radius", error)) return false; \
+    result= image.method((int) a.numbers[0]); \
+    return true; \
+  }
+
+// (amount, seed) operations; amount must lie in [0, high]
+#define AGL_SEEDED(method, high) \
+  [](const Image& image, const OpArgs& a, Image& result, std::string& error) { \
+    if (!inRange(a.numbers[0], 0, high, #method " amount", error) || \
+        !inRange(a.numbers[1], 0, MAX_SEED, "seed", error)) return false; \
+    result= image.method((float) a.numbers[0], (unsigned int) a.numbers[1]); \
+    return true; \
+  }
+
+bool pixelRange(const OpArgs& a, Pixel& low, Pixel& high, std::string& error) {
+  for (int k= 0; k < 6; k++) {
+    if (!inRange(a.numbers[k], 0, 255, "channel value", error)) return false;
+  }
+  low= Pixel{(unsigned char) a.numbers[0], (unsigned char) a.numbers[1], (unsigned char) a.numbers[2]};
+  high= Pixel{(unsigned char) a.numbers[3], (unsigned char) a.numbers[4], (unsigned char) a.numbers[5]};
+  return true;
+}
+
+const OpSpec OPERATIONS[]= {
+  {"resize", "(width,height)", 0, 2, 0, {}, [](const Image& image, const OpArgs& a, Image& result,
+      std::string& error) {
+    if (!inRange(a.numbers[0], 2, MAX_SIDE, "width", error) ||
+        !inRange(a.numbers[1], 2, MAX_SIDE, "height", error)) return false;
+    result= image.resize((int) a.numbers[0], (int) a.numbers[1]);
+    return true;
+  }},
+  {"subimage", "(x,y,width,height)", 0, 4, 0, {}, [](const Image& image, const OpArgs& a,
+      Image& result, std::string& error) {
+    if (!inRange(a.numbers[0], 0, image.width() - 1, "x", error) ||
+        !inRange(a.numbers[1], 0, image.height() - 1, "y", error) ||
+        !inRange(a.numbers[2], 1, image.width() - (int) a.numbers[0], "width", error) ||
+        !inRange(a.numbers[3], 1, image.height() - (int) a.numbers[1], "height", error)) {
+      return false;
+    }
+    result= image.subimage((int) a.numbers[0], (int) a.numbers[1], (int) a.numbers[2],
+      (int) a.numbers[3]);
+    return true;
+  }},
+  {"flipHorizontal", "", 0, 0, 0, {}, AGL_UNARY(flipHorizontal)},
+  {"flipPositiveDiagonal", "", 0, 0, 0, {}, AGL_UNARY(flipPositiveDiagonal)},
+  {"rotate90", "", 0, 0, 0, {}, AGL_UNARY(rotate90)},
+  {"swirl", "", 0, 0, 0, {}, AGL_UNARY(swirl)},
+  {"add", "($k)", 1, 0, 0, {}, AGL_BINARY(add)},
+  {"subtract", "($k)", 1, 0, 0, {}, AGL_BINARY(subtract)},
+  {"multiply", "($k)", 1, 0, 0, {}, AGL_BINARY(multiply)},
+  {"difference", "($k)", 1, 0, 0, {}, AGL_BINARY(difference)},
+  {"lightest", "($k)", 1, 0, 0, {}, AGL_BINARY(lightest)},
+  {"darkest", "($k)", 1, 0, 0, {}, AGL_BINARY(darkest)},
+  {"alphaBlend", "($k,amount)", 1, 1, 0, {}, [](const Image& image, const OpArgs& a,
+      Image& result, std::string& error) {
+    if (!sameSize(image, *a.images[0], error) ||
+        !inRange(a.numbers[0], 0, 1, "amount", error)) return false;
+    result= image.alphaBlend(*a.images[0], (float) a.numbers[0]);
+    return true;
+  }},
+  {"replace", "($k,x,y)", 1, 2, 0, {}, [](const Image& image, const OpArgs& a, Image& result,
+      std::string& error) {
+    if (!inRange(a.numbers[0], 0, image.width() - 1, "x", error) ||
+        !inRange(a.numbers[1], 0, image.height() - 1, "y", error)) return false;
+    result= image;
+    result.replace(*a.images[0], (int) a.numbers[0], (int) a.numbers[1]);
+    return true;
+  }},
+  {"replaceAlpha", "($k,alpha,x,y)", 1, 3, 0, {}, [](const Image& image, const OpArgs& a,
+      Image& result, std::string& error) {
+    if (!inRange(a.numbers[0], 0, 1, "alpha", error) ||
+        !inRange(a.numbers[1], 0, image.width() - 1, "x", error) ||
+        !inRange(a.numbers[2], 0, image.height() - 1, "y", error)) return false;
+    result= image;
+    result.replaceAlpha(*a.images[0], (float) a.numbers[0], (int) a.numbers[1], (int) a.numbers[2]);
+    return true;
+  }},
+  {"gammaCorrect", "(gamma)", 0, 1, 0, {}, [](const Image& image, const OpArgs& a, Image& result,
+      std::string& error) {
+    if (!inRange(a.numbers[0], 0.01, 100, "gamma", error)) return false;
+    result= image.gammaCorrect((float) a.numbers[0]);
+    return true;
+  }},
+  {"invert", "", 0, 0, 0, {}, AGL_UNARY(invert)},
+  {"grayscale", "", 0, 0, 0, {}, AGL_UNARY(grayscale)},
+  {"adjustHueSaturation", "(hueDegrees,saturationScale)", 0, 2, 0, {}, [](const Image& image,
+      const OpArgs& a, Image& result, std::string& error) {
+    if (!inRange(a.numbers[0], -360, 360, "hue", error) ||
+        !inRange(a.numbers[1], 0, 100, "saturation scale", error)) return false;
+    result= image.adjustHueSaturation((float) a.numbers[0], (float) a.numbers[1]);
+    return true;
+  }},
+  {"colorJitter", "(size[,seed])", 0, 1, 1, {0}, [](const Image& image, const OpArgs& a,
+      Image& result, std::string& error) {
+    if (!inRange(a.numbers[0], 1, MAX_SIDE, "size", error) ||
+        !inRange(a.numbers[1], 0, MAX_SEED, "seed", error)) return false;
+    result= image.colorJitter((int) a.numbers[0], (unsigned int) a.numbers[1]);
+    return true;
+  }},
+  {"gaussianNoise", "(sigma[,seed])", 0, 1, 1, {0}, AGL_SEEDED(gaussianNoise, 255)},
+  {"saltAndPepper", "(density[,seed])", 0, 1, 1, {0}, AGL_SEEDED(saltAndPepper, 1)},
+  {"filmGrain", "(strength[,seed])", 0, 1, 1, {0}, AGL_SEEDED(filmGrain, 255)},
+  {"bitmap", "(size)", 0, 1, 0, {}, [](const Image& image, const OpArgs& a, Image& result,
+      std::string& error) {
+    if (!inRange(a.numbers[0], 1, MAX_SIDE, "size", error)) return false;
+    result= image.bitmap((int) a.numbers[0]);
+    return true;
+  }},
+  {"sharpen", "", 0, 0, 0, {}, AGL_UNARY(sharpen)},
+  {"gaussianBlur", "", 0, 0, 0, {}, AGL_UNARY(gaussianBlur)},
+  {"gaussianBlur", "(sigma)", 0, 1, 0, {}, [](const Image& image, const OpArgs& a, Image& result,
+      std::string& error) {
+    if (!inRange(a.numbers[0], 0, MAX_RADIUS, "sigma", error)) return false;
+    result= image.gaussianBlur((float) a.numbers[0]);
+    return true;
+  }},
+  {"boxBlur", "", 0, 0, 0, {}, AGL_UNARY(boxBlur)},
+  {"ridgeDetection", "", 0, 0, 0, {}, AGL_UNARY(ridgeDetection)},
+  {"unsharpMasking", "", 0, 0, 0, {}, AGL_UNARY(unsharpMasking)},
+  {"sobel", "", 0, 0, 0, {}, AGL_UNARY(sobel)},
+  {"sobelOrientation", "", 0, 0, 0, {}, AGL_UNARY(sobelOrientation)},
+  {"extract", "(lowR,lowG,lowB,highR,highG,highB)", 0, 6, 0, {}, [](const Image& image,
+      const OpArgs& a, Image& result, std::string& error) {
+    Pixel low, high;
+    if (!pixelRange(a, low, high, error)) return false;
+    result= image.extract(low, high);
+    return true;
+  }},
+  {"extractRed", "", 0, 0, 0, {}, AGL_UNARY(extractRed)},
+  {"extractGreen", "", 0, 0, 0, {}, AGL_UNARY(extractGreen)},
+  {"extractBlue", "", 0, 0, 0, {}, AGL_UNARY(extractBlue)},
+  {"gridCopy", "(rows,columns)", 0, 2, 0, {}, [](const Image& image, const OpArgs& a,
+      Image& result, std::string& error) {
+    if (!inRange(a.numbers[0], 1, MAX_SIDE / std::max(1, image.height()), "rows", error) ||
+        !inRange(a.numbers[1], 1, MAX_SIDE / std::max(1, image.width()), "columns", error)) {
+      return false;
+    }
+    result= image.gridCopy((int) a.numbers[0], (int) a.numbers[1]);
+    return true;
+  }},
+  {"glow", "(lowR,lowG,lowB,highR,highG,highB)", 0, 6, 0, {}, [](const Image& image,
+      const OpArgs& a, Image& result, std::string& error) {
+    Pixel low, high;
+    if (!pixelRange(a, low, high, error)) return false;
+    result= image.glow(low, high);
+    return true;
+  }},
+  {"equalize", "", 0, 0, 0, {}, AGL_UNARY(equalize)},
+  {"autoLevels", "([clipPercent])", 0, 0, 1, {0.5}, [](const Image& image, const OpArgs& a,
+      Image& result, std::string& error) {
+    if (!inRange(a.numbers[0], 0, 50, "clip percent", error)) return false;
+    result= image.autoLevels((float) a.numbers[0]);
+    return true;
+  }},
+  {"medianFilter", "(radius)", 0, 1, 0, {}, AGL_RADIUS(medianFilter)},
+  {"minFilter", "(radius)", 0, 1, 0, {}, AGL_RADIUS(minFilter)},
+  {"maxFilter", "(radius)", 0, 1, 0, {}, AGL_RADIUS(maxFilter)},
+  {"erode", "(radius)", 0, 1, 0, {}, AGL_RADIUS(erode)},
+  {"dilate", "(radius)", 0, 1, 0, {}, AGL_RADIUS(dilate)},
+  {"opening", "(radius)", 0, 1, 0, {}, AGL_RADIUS(opening)},
+  {"closing", "(radius)", 0, 1, 0, {}, AGL_RADIUS(closing)},
+  {"topHat", "(radius)", 0, 1, 0, {}, AGL_RADIUS(topHat)},
+  {"blackHat", "(radius)", 0, 1, 0, {}, AGL_RADIUS(blackHat)},
+  {"rankFilter", "(radius,rank)", 0, 2, 0, {}, [](const Image& image, const OpArgs& a,
+      Image& result, std::string& error) {
+    if (!inRange(a.numbers[0], 0, MAX_RADIUS, "radius", error) ||
+        !inRange(a.numbers[1], 0, 1, "rank", error)) return false;
+    result= image.rankFilter((int) a.numbers[0], (float) a.numbers[1]);
+    return true;
+  }},
+};
+
+#undef AGL_UNARY
+#undef AGL_BINARY
+#undef AGL_RADIUS
+#undef AGL_SEEDED
+
+const int OPERATION_COUNT= sizeof(OPERATIONS) / sizeof(OPERATIONS[0]);
+
+// The entry for name taking `images` images and `numbers` numbers
+const OpSpec* findOperation(const std::string& name, int images, int numbers) {
+  for (const OpSpec& spec : OPERATIONS) {
+    if (name == spec.name && images == spec.images && numbers >= spec.required &&
+        numbers <= spec.required + spec.optional) {
+      return &spec;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+std::string OpStep::text() const {
+  std::string text= this->name;
+  if (this->inputs.empty() && this->numbers.empty()) return text;
+
+  // 9 significant digits are enough for any float argument
+  text+= "(";
+  char buffer[32];
+  for (size_t k= 0; k < this->inputs.size() + this->numbers.size(); k++) {
+    if (k > 0) text+= ",";
+    if (k < this->inputs.size()) {
+      std::snprintf(buffer, sizeof(buffer), "$%d", this->inputs[k]);
+    } else {
+      std::snprintf(buffer, sizeof(buffer), "%.9g", this->numbers[k - this->inputs.size()]);
+    }
+    text+= buffer;
+  }
+  return text + ")";
+}
+
+bool parseStep(const std::string& token, int inputCount, OpStep& step, std::string& error) {
+  step= OpStep();
+  size_t open= token.find('(');
+  step.name= token.substr(0, open);
+
+  if (open != std::string::npos) {
+    if (token.back() != ')') {
+      error= "missing ) in " + token;
+      return false;
+    }
+    std::string list= token.substr(open + 1, token.size() - open - 2);
+    size_t start= 0;
+    while (!list.empty() && start <= list.size()) {
+      size_t comma= list.find(',', start);
+      if (comma == std::string::npos) comma= list.size();
+      std::string arg= list.substr(start, comma - start);
+      start= comma + 1;
+
+      if (!arg.empty() && arg[0] == '$') {
+        char* end= nullptr;
+        long index= std::strtol(arg.c_str() + 1, &end, 10);
+        if (arg.size() == 1 || *end != '\0' || index < 0 || index >= inputCount) {
+          error= "no input " + arg + " in " + token;
+          return false;
+        }
+        if (!step.numbers.empty()) {
+          error= "image arguments come first in " + token;
+          return false;
+        }
+        step.inputs.push_back((int) index);
+      } else {
+        char* end= nullptr;
+        double value= std::strtod(arg.c_str(), &end);
+        if (arg.empty() || *end != '\0') {
+          error= "bad argument '" + arg + "' in " + token;
+          return false;
+        }
+        step.numbers.push_back(value);
+      }
+    }
+  }
+
+  const OpSpec* spec= findOperation(step.name, (int) step.inputs.size(), (int) step.numbers.size());
+  if (spec == nullptr) {
+    error= "unknown operation or wrong arguments: " + token;
+    return false;
+  }
+  for (int k= (int) step.numbers.size() - spec->required; k < spec->optional; k++) {
+    step.numbers.push_back(spec->defaults[k]);
+  }
+  return true;
+}
+
+bool applyStep(const Image& image, const OpStep& step, const std::vector<const Image*>& inputs,
+    Image& result, std::string& error) {
+  const OpSpec* spec= findOperation(step.name, (int) step.inputs.size(), (int) step.numbers.size());
+  if (spec == nullptr) {
+    error= "unknown operation or wrong arguments: " + step.text();
+    return false;
+  }
+
+  std::vector<const Image*> images;
+  for (int index : step.inputs) {
+    if (index < 0 || index >= (int) inputs.size()) {
+      error= "no input $" + std::to_string(index);
+      return false;
+    }
+    images.push_back(inputs[index]);
+  }
+  if (image.width() == 0 || image.height() == 0) {
+    error= "empty image";
+    return false;
+  }
+
+  OpArgs args= {step.numbers.data(), images.data()};
+  return spec->run(image, args, result, error);
+}
+
+std::string operationHelp() {
+  std::string help;
+  for (const OpSpec& spec : OPERATIONS) {
+    help+= std::string(spec.name) + spec.help + "\n";
+  }
+  return help;
+}
+
+}  // namespace agl
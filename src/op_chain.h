@@ -0,0 +1,48 @@
+#ifndef AGL_OP_CHAIN_H_
+#define AGL_OP_CHAIN_H_
+
+#include <string>
+#include <vector>
+#include "image.h"
+
+namespace agl {
+
+/**
+ * @brief One operation of a chain, e.g. gaussianBlur(4) or alphaBlend($1,0.5)
+ *
+ * numbers holds the numeric arguments in order; an argument written $k
+ * refers to the k-th input image of the request instead and is kept in
+ * inputs. Missing optional arguments (seeds, ...) are filled in by
+ * parseStep, so equal steps always have equal text().
+ */
+struct OpStep {
+  std::string name;
+  std::vector<double> numbers;
+  std::vector<int> inputs;
+
+  // Canonical form, e.g. "alphaBlend($1,0.5)"
+  std::string text() const;
+};
+
+/**
+ * @brief Parses one step written name or name(arg,arg,...) without spaces
+ * @param inputCount How many images $k may refer to
+ * @return false with a message in error if the name is unknown, the
+ *   arguments do not fit it or a $k is out of range
+ */
+bool parseStep(const std::string& token, int inputCount, OpStep& step, std::string& error);
+
+/**
+ * @brief Applies one step to image
+ * @param inputs The images $k refers to
+ * @return false with a message in error if the arguments are out of range
+ *   for this image (e.g. a subimage outside it, a blend of different sizes)
+ */
+bool applyStep(const Image& image, const OpStep& step, const std::vector<const Image*>& inputs,
+  Image& result, std::string& error);
+
+// The names parseStep accepts, with their arguments, one per line
+std::string operationHelp();
+
+}  // namespace agl
+#endif  // AGL_OP_CHAIN_H_
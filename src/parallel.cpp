@@ -0,0 +1,148 @@
+#include "parallel.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace agl {
+
+// true while the current thread is inside a SerialRegion
+static thread_local bool tSerial= false;
+
+SerialRegion::SerialRegion(): myPrevious(tSerial) {
+  tSerial= true;
+}
+
+SerialRegion::~SerialRegion() {
+  tSerial= this->myPrevious;
+}
+
+int threadCount() {
+  static const int count= []() {
+    const char* env= std::getenv("PIXMAP_THREADS");
+    if (env != nullptr && std::atoi(env) > 0) return std::atoi(env);
+
+    // hardware_concurrency may report 0 when it cannot tell
+    return std::max(1, (int) std::thread::hardware_concurrency());
+  }();
+
+  return count;
+}
+
+int parallelChunks(int count, int grain) {
+  if (count <= 0) return 0;
+  if (tSerial) return 1;
+  grain= std::max(1, grain);
+  int chunks= (count + grain - 1) / grain;
+
+  return std::min(chunks, threadCount());
+}
+
+// Workers started on the first parallel loop and kept for the life of the
+// process, so a loop costs a wakeup instead of thread creation (and no
+// heap allocation). One loop runs on the pool at a time; a loop started
+// from another thread while it is busy runs serially on that thread.
+// Chunks are claimed under the mutex; there are at most threadCount().
+class WorkerPool {
+ public:
+  explicit WorkerPool(int workers): myStop(false), myFn(nullptr),
+    myCount(0), myChunks(0), myNext(0), myRemaining(0) {
+    for (int i= 0; i < workers; i++) {
+      this->myThreads.emplace_back([this]() { this->work(); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(this->myMutex);
+      this->myStop= true;
+    }
+    this->myWake.notify_all();
+    for (std::thread& thread : this->myThreads) thread.join();
+  }
+
+  // Runs fn over chunks of [0, count); false if the pool is busy
+  bool run(int count, int chunks, const ChunkFunction& fn) {
+    std::unique_lock<std::mutex> busy(this->myBusy, std::try_to_lock);
+    if (!busy.owns_lock()) return false;
+
+    std::unique_lock<std::mutex> lock(this->myMutex);
+    this->myFn= &fn;
+    this->myCount= count;
+    this->myChunks= chunks;
+    this->myNext= 1;  // chunk 0 always runs on the caller
+    this->myRemaining= chunks;
+    this->myWake.notify_all();
+
+    int chunk= 0;
+    do {
+      lock.unlock();
+      this->runChunk(fn, count, chunks, chunk);
+      lock.lock();
+      this->myRemaining--;
+    } while ((chunk= this->claim()) >= 0);
+
+    this->myDone.wait(lock, [this]() { return this->myRemaining == 0; });
+    return true;
+  }
+
+ private:
+  // Next unclaimed chunk of the loop in flight, or -1; needs myMutex
+  int claim() {
+    return this->myNext < this->myChunks ? this->myNext++ : -1;
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lock(this->myMutex);
+    for (;;) {
+      this->myWake.wait(lock, [this]() { return this->myStop || this->myNext < this->myChunks; });
+      if (this->myStop) return;
+
+      int chunk= this->claim();
+      const ChunkFunction& fn= *this->myFn;
+      int count= this->myCount;
+      int chunks= this->myChunks;
+      lock.unlock();
+      this->runChunk(fn, count, chunks, chunk);
+      lock.lock();
+      if (--this->myRemaining == 0) this->myDone.notify_all();
+    }
+  }
+
+  static void runChunk(const ChunkFunction& fn, int count,
+      int chunks, int chunk) {
+    SerialRegion serial;
+    fn(chunk, (int) ((long long) count * chunk / chunks),
+       (int) ((long long) count * (chunk + 1) / chunks));
+  }
+
+  std::vector<std::thread> myThreads;
+  std::mutex myBusy;  // held by the thread whose loop is running
+  std::mutex myMutex;  // guards everything below
+  std::condition_variable myWake;
+  std::condition_variable myDone;
+  bool myStop;
+  const ChunkFunction* myFn;
+  int myCount;
+  int myChunks;
+  int myNext;
+  int myRemaining;
+};
+
+void parallelFor(int count, ChunkFunction fn, int grain) {
+  int chunks= parallelChunks(count, grain);
+  if (chunks == 0) return;
+  if (chunks > 1) {
+    static WorkerPool pool(threadCount() - 1);
+    if (pool.run(count, chunks, fn)) return;
+  }
+
+  // one chunk, or the pool is busy with another thread's loop
+  for (int c= 0; c < chunks; c++) {
+    fn(c, (int) ((long long) count * c / chunks), (int) ((long long) count * (c + 1) / chunks));
+  }
+}
+
+}  // namespace agl
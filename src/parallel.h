@@ -0,0 +1,82 @@
+#ifndef AGL_PARALLEL_H_
+#define AGL_PARALLEL_H_
+
+#include <functional>
+
+namespace agl {
+
+/**
+ * @brief Returns the number of threads the parallel kernels may use
+ *
+ * Defaults to the hardware concurrency; the PIXMAP_THREADS environment
+ * variable overrides it (PIXMAP_THREADS=1 makes everything serial)
+ */
+int threadCount();
+
+/**
+ * @brief Returns how many chunks parallelFor splits count items into
+ * @param count The number of items (e.g. rows)
+ * @param grain The fewest items worth giving to one thread
+ *
+ * Callers that keep per-thread state (e.g. private histograms) size it
+ * with this and index it with the chunk passed to their function
+ */
+int parallelChunks(int count, int grain = 8);
+
+/**
+ * @brief Non-owning reference to a callable fn(chunk, begin, end)
+ *
+ * Unlike std::function it never copies the callable, so a lambda's
+ * captures cost no heap allocation however many there are. It refers to
+ * the callable passed in, which must outlive it; as a parallelFor
+ * argument the lambda lives until the loop returns.
+ */
+class ChunkFunction {
+ public:
+  template <class Function>
+  ChunkFunction(const Function& fn): myCallable(&fn), myCall(&call<Function>) {}
+
+  void operator()(int chunk, int begin, int end) const {
+    this->myCall(this->myCallable, chunk, begin, end);
+  }
+
+ private:
+  template <class Function>
+  static void call(const void* callable, int chunk, int begin, int end) {
+    (*static_cast<const Function*>(callable))(chunk, begin, end);
+  }
+
+  const void* myCallable;
+  void (*myCall)(const void*, int, int, int);
+};
+
+/**
+ * @brief Splits [0, count) into contiguous chunks and runs them concurrently
+ * @param count The number of items (e.g. rows)
+ * @param fn Called once per chunk as fn(chunk, begin, end)
+ * @param grain The fewest items worth giving to one thread
+ *
+ * Chunk 0 runs on the calling thread, the others on a pool of
+ * threadCount() - 1 workers kept alive between calls; the call returns
+ * once every chunk has finished. Chunk boundaries only depend on count,
+ * grain and threadCount(), never on timing. Nothing is allocated per call.
+ */
+void parallelFor(int count, ChunkFunction fn, int grain = 8);
+
+/**
+ * @brief While alive, parallelFor calls made on this thread run serially
+ *
+ * Used by outer schedulers (and parallelFor's own workers) so nested
+ * parallel loops do not oversubscribe the cores
+ */
+class SerialRegion {
+ public:
+  SerialRegion();
+  ~SerialRegion();
+
+ private:
+  bool myPrevious;
+};
+
+}  // namespace agl
+#endif  // AGL_PARALLEL_H_
@@ -1,5 +1,7 @@
 #include <iostream>
 #include "image.h"
+#include "task_graph.h"
+#include "virtual_image.h"
 #include <vector>
 #include <string>
 using namespace std;
@@ -11,7 +13,7 @@ using namespace agl;
  * the same image but manipulated using the methods
  * implemented in image.cpp. It showcases a plethora
  * of methods: 
- * - GridCopy
+ * - Virtual mosaic streamed to PNG
  * - Gaussian Blur
  * - Box Blur
  * - Unsharp Masking
@@ -90,97 +92,71 @@ int main(int argc, char** argv)
   images.push_back(jinx);
   names.push_back("jinx");
 
+  // Every effect only depends on the source image, so they are all
+  // nodes of one task graph that runs them concurrently across images.
+  // Only the grid cells are kept; the grid itself is never built, its
+  // rows are put together as the PNG encoder asks for them.
+  TaskGraph graph;
+  vector<vector<int>> grids;
+
   for (int i= 0; i < images.size(); i++) {
-    Image cur_image= images[i];
-    string cur_name= names[i];
-
-    // dimensions for each of the subsequent images
-    int width= cur_image.width();
-    int height= cur_image.height();
-
-    
-    cout << "5x4 grid copy " << cur_name << endl;
-    Image grid_image= cur_image.gridCopy(5, 4);
-
-    cout << "gaussian blur " << cur_name << endl;
-    Image gaussBlur= cur_image.gaussianBlur();
-    grid_image.replace(gaussBlur, width, 0);
-
-    cout << "box blur " << cur_name << endl;
-    Image boxBlur= cur_image.boxBlur();
-    grid_image.replace(boxBlur, 2*width, 0);
-
-    cout << "unsharp mask " << cur_name << endl;
-    Image unsharpMask= cur_image.unsharpMasking();
-    grid_image.replace(unsharpMask, 3*width, 0);
-
-    cout << "sobel " << cur_name << endl;
-    Image sobel= cur_image.sobel();
-    grid_image.replace(sobel, 0, height);
-
-    cout << "greyscale " << cur_name << endl;
-    Image greyscale= cur_image.grayscale();
-    grid_image.replace(greyscale, width, height);
-
-    cout << "invert " << cur_name << endl;
-    Image invert= cur_image.invert();
-    grid_image.replace(invert, 2*width, height);
-    
-    cout << "bitmap " << cur_name << endl;
-    Image bitmap= cur_image.bitmap(8);
-    grid_image.replace(bitmap, 3*width, height);
-    
-    cout << "ridge detection " << cur_name << endl;
-    Image ridge= cur_image.ridgeDetection();
-    grid_image.replace(ridge, 0, 2*height);
-
-    cout << "sharpen " << cur_name << endl;
-    Image sharpen= cur_image.sharpen();
-    grid_image.replace(sharpen, width, 2*height);
-
-    cout << "swirl " << cur_name << endl;
-    Image swirl= cur_image.swirl();
-    grid_image.replace(swirl, 2*width, 2*height);
-
-    cout << "flipped " << cur_name << endl;
-    Image flipped= cur_image.rotate90().rotate90();
-    grid_image.replace(flipped, 3*width, 2*height);
+    int cur_image= graph.addImage(images[i]);
+
+    // red/green/blue channels blurred, shared by the -ify and -less effects
+    int redBlur= graph.addNode(cur_image, [](const Image& img) { return img.extractRed().boxBlur(); });
+    int greenBlur= graph.addNode(cur_image, [](const Image& img) { return img.extractGreen().boxBlur(); });
+    int blueBlur= graph.addNode(cur_image, [](const Image& img) { return img.extractBlue().boxBlur(); });
+
+    // grid cells from Top-Left to Bottom-Right, the first one is the original
+    vector<int> cells;
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.gaussianBlur(); }));
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.boxBlur(); }));
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.unsharpMasking(); }));
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.sobel(); }));
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.grayscale(); }));
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.invert(); }));
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.bitmap(8); }));
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.ridgeDetection(); }));
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.sharpen(); }));
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.swirl(); }));
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.rotate90().rotate90(); }));
 
     // got a pixel threshold for white using this reference
     // https://tjosh.medium.com/finding-lane-lines-with-colour-thresholds-beb542e0d839
-    cout << "glow " << cur_name << endl;
-    Image glow= cur_image.glow(Pixel{100, 100, 200}, Pixel{255, 255, 255});
-    grid_image.replace(glow, 0, 3*height);
-
-    cout << "redify " << cur_name << endl;
-    Image redify= cur_image.extractRed().boxBlur().add(cur_image);
-    grid_image.replace(redify, width, 3*height);
-
-    cout << "greenify " << cur_name << endl;
-    Image greenify= cur_image.extractGreen().boxBlur().add(cur_image);
-    grid_image.replace(greenify, 2*width, 3*height);
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) {
+      return img.glow(Pixel{100, 100, 200}, Pixel{255, 255, 255});
+    }));
 
-    cout << "blueify " << cur_name << endl;
-    Image blueify= cur_image.extractBlue().boxBlur().add(cur_image);
-    grid_image.replace(blueify, 3*width, 3*height);
+    auto addOntoSource= [](const vector<const Image*>& in) { return in[1]->add(*in[0]); };
+    cells.push_back(graph.addNode({cur_image, redBlur}, addOntoSource));
+    cells.push_back(graph.addNode({cur_image, greenBlur}, addOntoSource));
+    cells.push_back(graph.addNode({cur_image, blueBlur}, addOntoSource));
 
-    cout << "redless " << cur_name << endl;
-    Image redless= cur_image.subtract(cur_image.extractRed().boxBlur());
-    grid_image.replace(redless, 0, 4*height);
+    auto subtractFromSource= [](const vector<const Image*>& in) { return in[0]->subtract(*in[1]); };
+    cells.push_back(graph.addNode({cur_image, redBlur}, subtractFromSource));
+    cells.push_back(graph.addNode({cur_image, greenBlur}, subtractFromSource));
+    cells.push_back(graph.addNode({cur_image, blueBlur}, subtractFromSource));
 
-    cout << "greenless " << cur_name << endl;
-    Image greenless= cur_image.subtract(cur_image.extractGreen().boxBlur());
-    grid_image.replace(greenless, width, 4*height);
+    cells.push_back(graph.addNode(cur_image, [](const Image& img) { return img.colorJitter(20); }));
 
-    cout << "blueless " << cur_name << endl;
-    Image blueless= cur_image.subtract(cur_image.extractBlue().boxBlur());
-    grid_image.replace(blueless, 2*width, 4*height);
+    for (int cell : cells) graph.keep(cell);
+    grids.push_back(cells);
+  }
 
-    cout << "jitter " << cur_name << endl;
-    Image jitter= cur_image.colorJitter(20);
-    grid_image.replace(jitter, 3*width, 4*height);
+  cout << "applying effects to " << images.size() << " images" << endl;
+  graph.run();
 
-    grid_image.save(cur_name + ".png");
+  for (int i= 0; i < images.size(); i++) {
+    cout << "saving " << names[i] << endl;
+    // 5x4 grid of the source with the effects laid over it
+    int width= images[i].width();
+    int height= images[i].height();
+    MosaicRowSource grid(width * 4, height * 5);
+    grid.place(images[i], 0, 0);
+    for (int cell= 1; cell <= grids[i].size(); cell++) {
+      grid.place(graph.result(grids[i][cell - 1]), (cell % 4) * width, (cell / 4) * height);
+    }
+    writePNG(grid, names[i] + ".png");
   }
 
   Image psyduck_extra= psyduck;
@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "dispatch.h"
+#include "image.h"
+#include "parallel.h"
+#include "quality.h"
+#include "quantize.h"
+#ifdef AGL_DISPATCH_X86
+#include <cpuid.h>
+#endif
+using namespace std;
+using namespace agl;
+
+/**
+ * Regression harness for the Image operations.
+ *
+ * Golden check: runs every operation on each image in images/ and compares
+ * a hash of the output with tests/golden.txt, once per instruction set the
+ * CPU supports, so an optimization that changes any output byte fails. A
+ * failing variant is also compared with the scalar output (max error, PSNR
+ * and SSIM) to tell a rounding slip from a broken kernel.
+ *
+ * Performance check: times every operation on one larger image (best of
+ * several runs) and fails if it is slower than tests/perf_baseline.txt by
+ * more than the tolerance. Timings only compare on the CPU model, build
+ * type, thread count and instruction set they were recorded with;
+ * otherwise the check is skipped with a note and the exit code is 77
+ * (ctest's SKIP_RETURN_CODE), not 0.
+ *
+ *   pixmap_regress [--golden] [--perf] [--update] [--tolerance 0.3]
+ *                  [--only name] [--images dir] [--data dir]
+ *
+ * With neither --golden nor --perf both checks run. --update rewrites the
+ * selected files from this build instead of comparing; review the golden
+ * diff before committing it, it is the record of what changed.
+ */
+
+typedef function<Image(const Image&)> Operation;
+
+struct NamedOperation {
+  string name;  // no spaces: used as a key in the data files
+  Operation run;
+};
+
+// 64-bit FNV-1a over the size and the pixels, row by row
+static unsigned long long hashImage(const Image& image) {
+  unsigned long long hash= 14695981039346656037ULL;
+  auto mix= [&hash](const unsigned char* bytes, size_t count) {
+    for (size_t i= 0; i < count; i++) {
+      hash^= bytes[i];
+      hash*= 1099511628211ULL;
+    }
+  };
+  int size[2]= {image.width(), image.height()};
+  mix((const unsigned char*) size, sizeof(size));
+  for (int i= 0; i < image.height(); i++) {
+    mix(image.rowData(i), (size_t) image.width() * 3);
+  }
+  return hash;
+}
+
+// Packs raw bytes into a 1-row image, for operations that return data
+static Image bytesImage(const void* data, size_t count) {
+  Image result((int) (count + 2) / 3, 1);
+  memset(result.rowData(0), 0, (size_t) result.width() * 3);
+  memcpy(result.rowData(0), data, count);
+  return result;
+}
+
+static vector<NamedOperation> operations() {
+  static int kernel5[25]= {1, 2, 3, 2, 1, 2, 4, 6, 4, 2, 3, 6, 9, 6, 3,
+                           2, 4, 6, 4, 2, 1, 2, 3, 2, 1};
+  static int motion15[15 * 15];
+  for (int k= 0; k < 15; k++) motion15[k * 15 + k]= 1;
+  // one-sided smear with an off-centre tap: not symmetric under any flip,
+  // so a mirrored kernel index in either convolution path changes the result
+  static int smear9[9 * 9];
+  for (int k= 0; k < 5; k++) smear9[4 * 9 + 4 + k]= 5 - k;
+  smear9[1 * 9 + 2]= 2;
+  static unsigned char lut[3][256];
+  for (int c= 0; c < 3; c++) {
+    for (int v= 0; v < 256; v++) lut[c][v]= (unsigned char) ((v * (c + 2) + 17 * c) % 256);
+  }
+  Pixel low{60, 40, 20};
+  Pixel high{220, 200, 255};
+
+  vector<NamedOperation> ops= {
+    {"resize", [](const Image& im) { return im.resize(im.width() * 2 / 3 + 1, im.height() * 3 / 2); }},
+    {"flipHorizontal", [](const Image& im) { return im.flipHorizontal(); }},
+    {"flipVertical", [](const Image& im) { return im.flipVertical(); }},
+    {"flipPositiveDiagonal", [](const Image& im) { return im.flipPositiveDiagonal(); }},
+    {"rotate90", [](const Image& im) { return im.rotate90(); }},
+    {"rotate(7.5)", [](const Image& im) { return im.rotate(7.5f); }},
+    {"rotate(-20,nearest)", [](const Image& im) { return im.rotate(-20.0f, INTERPOLATE_NEAREST); }},
+    {"rotate(33,bicubic)", [](const Image& im) {
+      return im.rotate(33.0f, INTERPOLATE_BICUBIC, Pixel{255, 255, 255});
+    }},
+    {"warp(perspective)", [](const Image& im) {
+      double w= im.width() - 1;
+      double h= im.height() - 1;
+      double corners[8]= {0, 0, w, 0, w, h, 0, h};
+      double skewed[8]= {w * 0.05, h * 0.1, w * 0.9, 0, w, h * 0.95, 0, h * 0.8};
+      Transform transform;
+      Transform::mapQuad(corners, skewed, transform);
+      return im.warp(transform, im.width(), im.height(), INTERPOLATE_BICUBIC);
+    }},
+    {"subimage", [](const Image& im) {
+      return im.subimage(im.width() / 4, im.height() / 4, im.width() / 2, im.height() / 2);
+    }},
+    {"replace", [](const Image& im) {
+      Image result= im;
+      int side= min(im.width(), im.height()) / 2;
+      result.replace(im.rotate90().subimage(0, 0, side, side), im.width() / 3, im.height() / 5);
+      return result;
+    }},
+    {"replaceAlpha", [](const Image& im) {
+      Image result= im;
+      result.replaceAlpha(im.invert(), 0.4f, im.width() / 5, im.height() / 3);
+      return result;
+    }},
+    {"swirl", [](const Image& im) { return im.swirl(); }},
+    {"add", [](const Image& im) { return im.add(im.flipHorizontal()); }},
+    {"subtract", [](const Image& im) { return im.subtract(im.flipHorizontal()); }},
+    {"multiply", [](const Image& im) { return im.multiply(im.flipHorizontal()); }},
+    {"difference", [](const Image& im) { return im.difference(im.flipHorizontal()); }},
+    {"lightest", [](const Image& im) { return im.lightest(im.flipHorizontal()); }},
+    {"darkest", [](const Image& im) { return im.darkest(im.flipHorizontal()); }},
+    {"gammaCorrect", [](const Image& im) { return im.gammaCorrect(2.2f); }},
+    {"alphaBlend", [](const Image& im) { return im.alphaBlend(im.invert(), 0.3f); }},
+    {"invert", [](const Image& im) { return im.invert(); }},
+    {"grayscale", [](const Image& im) { return im.grayscale(); }},
+    {"toHSV", [](const Image& im) { return im.convertColor(COLOR_RGB, COLOR_HSV); }},
+    {"fromHSV", [](const Image& im) {
+      return im.convertColor(COLOR_RGB, COLOR_HSV).convertColor(COLOR_HSV, COLOR_RGB);
+    }},
+    {"toYCbCr", [](const Image& im) { return im.convertColor(COLOR_RGB, COLOR_YCBCR); }},
+    {"fromYCbCr", [](const Image& im) {
+      return im.convertColor(COLOR_RGB, COLOR_YCBCR).convertColor(COLOR_YCBCR, COLOR_RGB);
+    }},
+    {"toLab", [](const Image& im) { return im.convertColor(COLOR_RGB, COLOR_LAB); }},
+    {"fromLab", [](const Image& im) {
+      return im.convertColor(COLOR_RGB, COLOR_LAB).convertColor(COLOR_LAB, COLOR_RGB);
+    }},
+    {"toLinear", [](const Image& im) { return im.convertColor(COLOR_RGB, COLOR_LINEAR); }},
+    {"fromLinear", [](const Image& im) {
+      return im.convertColor(COLOR_RGB, COLOR_LINEAR).convertColor(COLOR_LINEAR, COLOR_RGB);
+    }},
+    {"floatLab", [](const Image& im) {
+      vector<float> lab= im.toFloat(COLOR_LAB);
+      for (size_t i= 0; i < lab.size(); i+= 3) lab[i]*= 0.8f;
+      Image result(im.width(), im.height());
+      result.fromFloat(lab.data(), COLOR_LAB);
+      return result;
+    }},
+    {"adjustHueSaturation", [](const Image& im) { return im.adjustHueSaturation(40.0f, 1.3f); }},
+    {"colorJitter", [](const Image& im) { return im.colorJitter(20, 7); }},
+    {"gaussianNoise", [](const Image& im) { return im.gaussianNoise(20.0f, 7); }},
+    {"saltAndPepper", [](const Image& im) { return im.saltAndPepper(0.05f, 7); }},
+    {"filmGrain", [](const Image& im) { return im.filmGrain(0.3f, 7); }},
+    {"bitmap", [](const Image& im) { return im.bitmap(8); }},
+    {"convolute5", [](const Image& im) { return im.convolute(kernel5, 1.0f / 81, 5); }},
+    {"convoluteDirect15", [](const Image& im) { return im.convoluteDirect(motion15, 1.0f / 15, 15); }},
+    {"convoluteFFT15", [](const Image& im) { return im.convoluteFFT(motion15, 1.0f / 15, 15); }},
+    {"convoluteDirectSmear9", [](const Image& im) { return im.convoluteDirect(smear9, 1.0f / 17, 9); }},
+    {"convoluteFFTSmear9", [](const Image& im) { return im.convoluteFFT(smear9, 1.0f / 17, 9); }},
+    {"sharpen", [](const Image& im) { return im.sharpen(); }},
+    {"identity", [](const Image& im) { return im.identity(); }},
+    {"gaussianBlur", [](const Image& im) { return im.gaussianBlur(); }},
+    {"gaussianBlur(3.5)", [](const Image& im) { return im.gaussianBlur(3.5f); }},
+    {"gaussianBlur(12)", [](const Image& im) { return im.gaussianBlur(12.0f); }},
+    {"boxBlur", [](const Image& im) { return im.boxBlur(); }},
+    {"ridgeDetection", [](const Image& im) { return im.ridgeDetection(); }},
+    {"unsharpMasking", [](const Image& im) { return im.unsharpMasking(); }},
+    {"sobel", [](const Image& im) { return im.sobel(); }},
+    {"sobelOrientation", [](const Image& im) { return im.sobelOrientation(); }},
+    {"gradient", [](const Image& im) {
+      Gradient g= im.gradient();
+      vector<short> both(g.gx);
+      both.insert(both.end(), g.gy.begin(), g.gy.end());
+      return bytesImage(both.data(), both.size() * sizeof(short));
+    }},
+    {"extract", [low, high](const Image& im) { return im.extract(low, high); }},
+    {"extractRed", [](const Image& im) { return im.extractRed(); }},
+    {"extractGreen", [](const Image& im) { return im.extractGreen(); }},
+    {"extractBlue", [](const Image& im) { return im.extractBlue(); }},
+    {"gridCopy", [](const Image& im) { return im.gridCopy(3, 2); }},
+    {"glow", [low, high](const Image& im) { return im.glow(low, high); }},
+    {"statistics", [](const Image& im) {
+      // the means and variances are float sums whose order follows the
+      // thread count, so only their rounded values are compared
+      ImageStats stats= im.statistics();
+      vector<int> values(&stats.histogram[0][0], &stats.histogram[0][0] + 3 * 256);
+      for (int c= 0; c < 3; c++) {
+        values.push_back(stats.min[c]);
+        values.push_back(stats.max[c]);
+        values.push_back(stats.percentile(c, 50.0f));
+        values.push_back((int) lround(stats.mean[c] * 100.0f));
+        values.push_back((int) lround(stats.variance[c]));
+      }
+      return bytesImage(values.data(), values.size() * sizeof(int));
+    }},
+    {"applyLUT", [](const Image& im) { return im.applyLUT(lut); }},
+    {"equalize", [](const Image& im) { return im.equalize(); }},
+    {"autoLevels", [](const Image& im) { return im.autoLevels(1.0f); }},
+    {"medianFilter(1)", [](const Image& im) { return im.medianFilter(1); }},
+    {"medianFilter(2)", [](const Image& im) { return im.medianFilter(2); }},
+    {"medianFilter(4)", [](const Image& im) { return im.medianFilter(4); }},
+    {"minFilter(2)", [](const Image& im) { return im.minFilter(2); }},
+    {"maxFilter(2)", [](const Image& im) { return im.maxFilter(2); }},
+    {"rankFilter(2,0.25)", [](const Image& im) { return im.rankFilter(2, 0.25f); }},
+    {"erode(3)", [](const Image& im) { return im.erode(3); }},
+    {"dilate(3)", [](const Image& im) { return im.dilate(3); }},
+    {"opening(2)", [](const Image& im) { return im.opening(2); }},
+    {"closing(2)", [](const Image& im) { return im.closing(2); }},
+    {"topHat(4)", [](const Image& im) { return im.topHat(4); }},
+    {"blackHat(4)", [](const Image& im) { return im.blackHat(4); }},
+    {"refresh(medianFilter(2))", [](const Image& im) {
+      // the median of the original brought up to date with two edits; the
+      // same as medianFilter(2) of the edited image
+      Image edited= im;
+      Image result= im.medianFilter(2);
+      edited.clearDirty();
+      int side= min(im.width(), im.height()) / 4;
+      edited.replace(im.rotate90().subimage(0, 0, side, side), im.width() / 3, im.height() / 5);
+      edited.replaceAlpha(im.invert().subimage(0, 0, side, side), 0.4f, im.width() / 2, im.height() / 2);
+      edited.refresh([](const Image& in) { return in.medianFilter(2); }, 2, result);
+      return result;
+    }},
+    {"quantize(256)", [](const Image& im) { return quantize(im, 256).toImage(); }},
+  };
+  return ops;
+}
+
+static bool selected(const NamedOperation& op, const string& only) {
+  return only.empty() || op.name.find(only) != string::npos;
+}
+
+static const char* const GOLDEN_IMAGES[]= {"bricks.png", "earth.png", "feep.png",
+  "heimerdinger.png", "jinx.png", "psyduck.png", "scenery.png", "soup.png", "squirrel.png"};
+
+// Timings from debug and optimized builds are not comparable
+#if defined(__OPTIMIZE__) || (defined(_MSC_VER) && defined(NDEBUG))
+static const char* const BUILD= "optimized";
+#else
+static const char* const BUILD= "unoptimized";
+#endif
+
+// Exit code of a run whose only outcome was a skipped check
+static const int EXIT_SKIPPED= 77;
+
+enum CheckResult {CHECK_PASSED, CHECK_FAILED, CHECK_SKIPPED};
+
+// Processor brand string with family and model, e.g. "AMD EPYC (family 26
+// model 2)", so baselines are only compared on the processor they came from
+static string cpuModel() {
+#ifdef AGL_DISPATCH_X86
+  unsigned int regs[12];
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000004 ||
+      __get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
+    return "unknown";
+  }
+  int family= (eax >> 8) & 0xf;
+  int model= (eax >> 4) & 0xf;
+  if (family == 0xf) family+= (eax >> 20) & 0xff;
+  if (family >= 6) model|= ((eax >> 16) & 0xf) << 4;
+
+  for (unsigned int leaf= 0; leaf < 3; leaf++) {
+    __get_cpuid(0x80000002 + leaf, &regs[leaf * 4], &regs[leaf * 4 + 1], &regs[leaf * 4 + 2],
+      &regs[leaf * 4 + 3]);
+  }
+  char brand[49];
+  memcpy(brand, regs, 48);
+  brand[48]= '\0';
+  string name= brand;
+  name.erase(0, name.find_first_not_of(' '));
+  name.erase(name.find_last_not_of(' ') + 1);
+  return name + " (family " + to_string(family) + " model " + to_string(model) + ")";
+#else
+  return "unknown";
+#endif
+}
+
+// Timed on the largest bundled image
+static const char* const PERF_IMAGE= "scenery.png";
+static const int PERF_RUNS= 5;
+
+// Reads "key value" lines, skipping comments; header lines "# key value"
+// go into header
+static map<string, string> readData(const string& filename, map<string, string>* header) {
+  map<string, string> values;
+  ifstream file(filename);
+  string line;
+  while (getline(file, line)) {
+    if (line.empty()) continue;
+    istringstream in(line[0] == '#' ? line.substr(1) : line);
+    string key, value;
+    in >> key >> ws;
+    getline(in, value);
+    if (line[0] != '#') {
+      values[key]= value;
+    } else if (header != nullptr) {
+      (*header)[key]= value;
+    }
+  }
+  return values;
+}
+
+static bool checkGolden(const vector<NamedOperation>& ops, const string& only,
+    const string& imageDir, const string& dataDir, bool update) {
+  string filename= dataDir + "/golden.txt";
+  map<string, string> golden= readData(filename, nullptr);
+  map<string, string> computed;
+  int failures= 0;
+  int checks= 0;
+
+  Isa original= activeIsa();
+  for (const char* name : GOLDEN_IMAGES) {
+    Image image;
+    if (!image.load(imageDir + "/" + name)) {
+      cout << "FAIL cannot load " << imageDir << "/" << name << endl;
+      failures++;
+      continue;
+    }
+    for (const NamedOperation& op : ops) {
+      if (!selected(op, only)) continue;
+      string key= op.name + "/" + name;
+
+      // every supported instruction set must give the same bytes
+      Image scalar;
+      for (int isa= (update ? original : ISA_SCALAR); isa <= original; isa++) {
+        setActiveIsa((Isa) isa);
+        Image output= op.run(image);
+        char hash[32];
+        snprintf(hash, sizeof(hash), "%016llx", hashImage(output));
+        checks++;
+        if (update) {
+          computed[key]= hash;
+        } else if (golden.count(key) == 0) {
+          cout << "FAIL " << key << ": no golden output (run with --update)" << endl;
+          failures++;
+          break;
+        } else if (golden[key] != hash) {
+          cout << "FAIL " << key << " with " << isaName((Isa) isa) << ": " << hash
+            << " expected " << golden[key];
+          if (isa != ISA_SCALAR && output.width() == scalar.width() &&
+              output.height() == scalar.height()) {
+            ImageQuality quality= compareImages(scalar, output);
+            cout << " (against scalar: max error " << quality.maxError << ", PSNR "
+              << quality.psnr << " dB, SSIM " << quality.ssim << ")";
+          }
+          cout << endl;
+          failures++;
+        }
+        if (isa == ISA_SCALAR) scalar= move(output);
+      }
+    }
+  }
+  setActiveIsa(original);
+
+  if (update) {
+    // keep the entries of operations that were not run
+    for (auto& entry : computed) golden[entry.first]= entry.second;
+    ofstream out(filename);
+    out << "# pixmap_regress golden outputs: operation/image, then the FNV-1a 64 hash\n";
+    out << "# of the output size and pixels. Regenerate with pixmap_regress --golden --update\n";
+    for (auto& entry : golden) out << entry.first << " " << entry.second << "\n";
+    cout << "golden: wrote " << computed.size() << " outputs to " << filename << endl;
+    return bool(out);
+  }
+  cout << "golden: " << checks << " checks, " << failures << " failures" << endl;
+  return failures == 0;
+}
+
+static double bestTime(const Operation& run, const Image& image, int runs) {
+  double best= 1e30;
+  run(image);  // warm up caches and allocations
+  for (int r= 0; r < runs; r++) {
+    auto start= chrono::steady_clock::now();
+    run(image);
+    auto stop= chrono::steady_clock::now();
+    best= min(best, chrono::duration<double, milli>(stop - start).count());
+  }
+  return best;
+}
+
+static CheckResult checkPerf(const vector<NamedOperation>& ops, const string& only,
+    const string& imageDir, const string& dataDir, bool update, double tolerance) {
+  string filename= dataDir + "/perf_baseline.txt";
+  Image image;
+  if (!image.load(imageDir + "/" + PERF_IMAGE)) {
+    cout << "FAIL cannot load " << imageDir << "/" << PERF_IMAGE << endl;
+    return CHECK_FAILED;
+  }
+
+  // timings only mean something on the configuration they were taken on
+  map<string, string> header;
+  map<string, string> baseline= readData(filename, &header);
+  string cpu= cpuModel();
+  string configuration= cpu + ", " + BUILD + " build, threads " + to_string(threadCount()) +
+    ", isa " + isaName(activeIsa());
+  string recorded= header["cpu"] + ", " + header["build"] + " build, threads " + header["threads"] +
+    ", isa " + header["isa"];
+  if (!update && (recorded != configuration || cpu == "unknown")) {
+    cout << "perf: baseline was recorded with " << recorded << ", this run has "
+      << configuration << "; skipped (record one here with --perf --update)" << endl;
+    return CHECK_SKIPPED;
+  }
+
+  map<string, double> measured;
+  int failures= 0;
+  for (const NamedOperation& op : ops) {
+    if (!selected(op, only)) continue;
+    double ms= bestTime(op.run, image, PERF_RUNS);
+    if (!update && baseline.count(op.name) != 0) {
+      // small absolute slack for the operations that take well under 1 ms
+      double limit= atof(baseline[op.name].c_str()) * (1.0 + tolerance) + 0.2;
+      if (ms > limit) ms= min(ms, bestTime(op.run, image, 3 * PERF_RUNS));  // rule out noise
+      if (ms > limit) {
+        cout << "FAIL " << op.name << ": " << ms << " ms, baseline " << baseline[op.name]
+          << " ms" << endl;
+        failures++;
+      }
+    } else if (!update) {
+      cout << "FAIL " << op.name << ": no baseline (run with --perf --update)" << endl;
+      failures++;
+    }
+    measured[op.name]= ms;
+  }
+
+  if (update) {
+    ofstream out(filename);
+    out << "# pixmap_regress timings: best of " << PERF_RUNS << " runs in ms on " << PERF_IMAGE << "\n";
+    out << "# cpu " << cpu << "\n";
+    out << "# build " << BUILD << "\n";
+    out << "# threads " << threadCount() << "\n";
+    out << "# isa " << isaName(activeIsa()) << "\n";
+    char line[128];
+    for (auto& entry : measured) {
+      snprintf(line, sizeof(line), "%s %.3f\n", entry.first.c_str(), entry.second);
+      out << line;
+    }
+    cout << "perf: wrote " << measured.size() << " timings to " << filename << endl;
+    return out ? CHECK_PASSED : CHECK_FAILED;
+  }
+  cout << "perf: " << measured.size() << " operations within " << tolerance * 100
+    << "% of baseline, " << failures << " failures" << endl;
+  return failures == 0 ? CHECK_PASSED : CHECK_FAILED;
+}
+
+int main(int argc, char** argv)
+{
+  bool golden= false;
+  bool perf= false;
+  bool update= false;
+  double tolerance= 0.3;
+  string only;
+  string imageDir= "../images";
+  string dataDir= "../tests";
+
+  for (int i= 1; i < argc; i++) {
+    string arg= argv[i];
+    bool hasValue= i + 1 < argc;
+    if (arg == "--golden") golden= true;
+    else if (arg == "--perf") perf= true;
+    else if (arg == "--update") update= true;
+    else if (arg == "--tolerance" && hasValue) tolerance= atof(argv[++i]);
+    else if (arg == "--only" && hasValue) only= argv[++i];
+    else if (arg == "--images" && hasValue) imageDir= argv[++i];
+    else if (arg == "--data" && hasValue) dataDir= argv[++i];
+    else {
+      cout << "usage: pixmap_regress [--golden] [--perf] [--update] [--tolerance 0.3]\n"
+        "                      [--only name] [--images dir] [--data dir]" << endl;
+      return 2;
+    }
+  }
+  if (!golden && !perf) golden= perf= true;
+
+  // glibc serves large blocks with fresh mmaps (page faults on every
+  // image) until it has freed one that size; do that up front so timings
+  // do not depend on which operations happened to run before
+  void* volatile settle= malloc(16 << 20);
+  free(settle);
+
+  vector<NamedOperation> ops= operations();
+  bool ok= true;
+  CheckResult perfResult= CHECK_PASSED;
+  if (golden) ok= checkGolden(ops, only, imageDir, dataDir, update) && ok;
+  if (perf) perfResult= checkPerf(ops, only, imageDir, dataDir, update, tolerance);
+  if (!ok || perfResult == CHECK_FAILED) return 1;
+  return perfResult == CHECK_SKIPPED ? EXIT_SKIPPED : 0;
+}
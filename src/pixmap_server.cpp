@@ -0,0 +1,380 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include "buffer_pool.h"
+#include "image.h"
+#include "op_chain.h"
+#include "parallel.h"
+#include "result_cache.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+using namespace std;
+using namespace agl;
+
+/**
+ * Resident image server: decodes sources once and keeps them, and the
+ * worker threads, warm between requests.
+ *
+ *   pixmap_server [--socket path] [--cache-mb 256] [--result-mb 64]
+ *
+ * Reads requests from stdin (answering on stdout) or, with --socket, from
+ * any number of clients of a Unix domain socket. One request per line:
+ *
+ *   input [input...] : step [step...] > output
+ *
+ * The chain starts from the first input; a step is an operation of
+ * op_chain.h such as gaussianBlur(4) or alphaBlend($1,0.5), where $k
+ * names the k-th input. Results are cached by the content of the inputs
+ * and the chain (see result_cache.h), so a repeated request, or one that
+ * extends an earlier chain, only runs the steps not seen before. Every
+ * request gets one line back:
+ *
+ *   ok output widthxheight milliseconds
+ *   error message
+ *
+ * Other lines: "ops" lists the operations, "stats" reports the caches,
+ * "quit" ends the session; blank lines and # comments are ignored.
+ * Relative paths are relative to the server's working directory.
+ */
+
+// Modification time in nanoseconds since the epoch; whole seconds where
+// the system keeps no finer time
+static long long modifiedTime(const struct stat& info)
+{
+#if defined(__APPLE__)
+  return info.st_mtimespec.tv_sec * 1000000000LL + info.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  return info.st_mtime * 1000000000LL;
+#else
+  return info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+#endif
+}
+
+// Decoded inputs, dropped least recently used first once they take more
+// than the budget. A file is decoded again when its size or modification
+// time changes. Each source is hashed once, when it is decoded, for the
+// result cache.
+//
+// File systems keep modification times as coarsely as whole seconds (two
+// on FAT), so a file rewritten at the same size within that window of
+// being cached looks unchanged. Such entries are not trusted: a file
+// cached less than RACY_WINDOW_NS after it was modified is decoded again
+// on each request until it has stayed unchanged for longer.
+class SourceCache {
+ public:
+  explicit SourceCache(size_t budget): myBudget(budget), myBytes(0), myHits(0), myMisses(0) {}
+
+  // nullptr if the file cannot be loaded
+  shared_ptr<const Image> get(const string& path, uint64_t& hash) {
+    long long checked= chrono::duration_cast<chrono::nanoseconds>(
+      chrono::system_clock::now().time_since_epoch()).count();
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return nullptr;
+    long long modified= modifiedTime(info);
+
+    {
+      lock_guard<mutex> lock(this->myMutex);
+      auto found= this->myEntries.find(path);
+      if (found != this->myEntries.end()) {
+        Entry& entry= found->second;
+        if (entry.modified == modified && entry.size == (long long) info.st_size &&
+          entry.cached - entry.modified >= RACY_WINDOW_NS) {
+          this->myOrder.splice(this->myOrder.begin(), this->myOrder, entry.position);
+          this->myHits++;
+          hash= entry.hash;
+          return entry.image;
+        }
+        this->remove(found);
+      }
+      this->myMisses++;
+    }
+
+    // decoded outside the lock so other requests are not held up; two
+    // requests for the same new file may both decode it
+    shared_ptr<Image> image= make_shared<Image>();
+    if (!image->load(path)) return nullptr;
+    hash= contentHash(*image);
+
+    lock_guard<mutex> lock(this->myMutex);
+    auto found= this->myEntries.find(path);
+    if (found != this->myEntries.end()) this->remove(found);
+    this->myOrder.push_front(path);
+    this->myEntries[path]= Entry{image, hash, modified, (long long) info.st_size, checked, this->myOrder.begin()};
+    this->myBytes+= image->bytes();
+    while (this->myBytes > this->myBudget && this->myOrder.size() > 1) {
+      this->remove(this->myEntries.find(this->myOrder.back()));
+    }
+    return image;
+  }
+
+  string stats() {
+    lock_guard<mutex> lock(this->myMutex);
+    ostringstream out;
+    out << "sources " << this->myEntries.size() << " bytes " << this->myBytes
+      << " hits " << this->myHits << " misses " << this->myMisses;
+    return out.str();
+  }
+
+ private:
+  struct Entry {
+    shared_ptr<const Image> image;
+    uint64_t hash;
+    long long modified;  // ns, see modifiedTime
+    long long size;
+    long long cached;  // ns, when the file was checked before decoding
+    list<string>::iterator position;
+  };
+
+  static const long long RACY_WINDOW_NS= 2000000000LL;
+
+  // requests still using the image keep it alive through their shared_ptr
+  void remove(map<string, Entry>::iterator entry) {
+    this->myBytes-= entry->second.image->bytes();
+    this->myOrder.erase(entry->second.position);
+    this->myEntries.erase(entry);
+  }
+
+  mutex myMutex;
+  map<string, Entry> myEntries;
+  list<string> myOrder;  // most recently used first
+  size_t myBudget;
+  size_t myBytes;
+  long long myHits;
+  long long myMisses;
+};
+
+// Runs one request (or command) line; returns the response line, or an
+// empty string for lines that get none
+static string handle(const string& line, SourceCache& sources)
+{
+  istringstream in(line);
+  vector<string> tokens;
+  for (string token; in >> token; ) tokens.push_back(token);
+  if (tokens.empty() || tokens[0][0] == '#') return "";
+
+  if (tokens.size() == 1 && tokens[0] == "ops") {
+    string names= operationHelp();
+    for (char& c : names) if (c == '\n') c= ' ';
+    return "ok " + names.substr(0, names.size() - 1);
+  }
+  if (tokens.size() == 1 && tokens[0] == "stats") {
+    BufferPoolStats pool= BufferPool::shared().stats();
+    ResultCacheStats results= ResultCache::shared().stats();
+    ostringstream out;
+    out << "ok " << sources.stats() << " results " << results.entries << " bytes " << results.bytes
+      << " hits " << results.hits << " misses " << results.misses
+      << " pool hits " << pool.hits << " misses " << pool.misses;
+    return out.str();
+  }
+
+  auto start= chrono::steady_clock::now();
+  size_t colon= 0;
+  while (colon < tokens.size() && tokens[colon] != ":") colon++;
+  size_t arrow= colon;
+  while (arrow < tokens.size() && tokens[arrow] != ">") arrow++;
+  if (colon == 0 || colon == tokens.size() || arrow + 2 != tokens.size()) {
+    return "error expected: input [input...] : step [step...] > output";
+  }
+
+  // parse the whole chain before loading anything
+  int inputCount= (int) colon;
+  vector<OpStep> steps(arrow - colon - 1);
+  string error;
+  for (size_t k= 0; k < steps.size(); k++) {
+    if (!parseStep(tokens[colon + 1 + k], inputCount, steps[k], error)) return "error " + error;
+  }
+
+  vector<shared_ptr<const Image>> loaded;
+  vector<const Image*> inputs;
+  vector<uint64_t> hashes(inputCount);
+  for (int k= 0; k < inputCount; k++) {
+    loaded.push_back(sources.get(tokens[k], hashes[k]));
+    if (!loaded.back()) return "error cannot load " + tokens[k];
+    inputs.push_back(loaded.back().get());
+  }
+
+  // the result after each step is cached under the first input and the
+  // chain so far, with the other inputs it reads named by their hash
+  vector<string> keys;
+  string chain;
+  for (const OpStep& step : steps) {
+    chain+= step.text();
+    for (int k : step.inputs) {
+      char name[24];
+      snprintf(name, sizeof(name), "#%016llx", (unsigned long long) hashes[k]);
+      chain+= name;
+    }
+    keys.push_back(chain);
+    chain+= " ";
+  }
+
+  // resume after the longest chain already computed
+  ResultCache& results= ResultCache::shared();
+  shared_ptr<const Image> current= loaded[0];
+  size_t done= steps.size();
+  for (; done > 0; done--) {
+    shared_ptr<const Image> found= results.find(hashes[0], keys[done - 1]);
+    if (found) {
+      current= found;
+      break;
+    }
+  }
+  for (; done < steps.size(); done++) {
+    Image next;
+    if (!applyStep(*current, steps[done], inputs, next, error)) {
+      return "error " + steps[done].text() + ": " + error;
+    }
+    current= make_shared<const Image>(move(next));
+    results.insert(hashes[0], keys[done], current);
+  }
+
+  const string& output= tokens.back();
+  if (!current->save(output)) return "error cannot write " + output;
+
+  double ms= chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  ostringstream out;
+  out << "ok " << output << " " << current->width() << "x" << current->height() << " " << ms;
+  return out.str();
+}
+
+#ifndef _WIN32
+// Longest request line a socket client may send; a longer one is answered
+// with an error and skipped up to its newline
+static const size_t MAX_REQUEST_LINE= 64 * 1024;
+
+// false if the client has gone away
+static bool sendLine(int client, const string& response)
+{
+  string line= response + "\n";
+  for (size_t sent= 0; sent < line.size(); ) {
+    ssize_t written= write(client, line.data() + sent, line.size() - sent);
+    if (written <= 0) return false;
+    sent+= written;
+  }
+  return true;
+}
+
+// Answers the requests of one client until it sends quit or disconnects
+static void serveClient(int client, SourceCache& sources)
+{
+  string pending;
+  char buffer[4096];
+  bool open= true;
+  bool skipping= false;  // inside a line that was too long
+  while (open) {
+    ssize_t count= read(client, buffer, sizeof(buffer));
+    if (count <= 0) break;
+    pending.append(buffer, count);
+
+    size_t newline;
+    while (open && (newline= pending.find('\n')) != string::npos) {
+      string line= pending.substr(0, newline);
+      pending.erase(0, newline + 1);
+      if (skipping || line.size() > MAX_REQUEST_LINE) {
+        if (!skipping) open= sendLine(client, "error request line too long");
+        skipping= false;
+        continue;
+      }
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (line == "quit") {
+        open= false;
+        break;
+      }
+
+      string response= handle(line, sources);
+      if (!response.empty()) open= sendLine(client, response);
+    }
+
+    if (open && pending.size() > MAX_REQUEST_LINE) {
+      if (!skipping) open= sendLine(client, "error request line too long");
+      skipping= true;
+      pending.clear();
+    }
+  }
+  close(client);
+}
+
+static int serveSocket(const string& path, SourceCache& sources)
+{
+  // a client that goes away mid-response must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  int listener= socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address= {};
+  address.sun_family= AF_UNIX;
+  if (listener < 0 || path.size() >= sizeof(address.sun_path)) {
+    cerr << "pixmap_server: cannot create socket " << path << endl;
+    return 1;
+  }
+  path.copy(address.sun_path, path.size());
+  unlink(path.c_str());  // left over from a previous run
+  if (bind(listener, (sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+    cerr << "pixmap_server: cannot listen on " << path << endl;
+    close(listener);
+    return 1;
+  }
+
+  cerr << "pixmap_server: listening on " << path << endl;
+  while (true) {
+    int client= accept(listener, nullptr, nullptr);
+    if (client < 0) continue;
+    thread(serveClient, client, ref(sources)).detach();
+  }
+}
+#endif
+
+int main(int argc, char** argv)
+{
+  string socketPath;
+  size_t cacheBytes= (size_t) 256 << 20;
+  size_t resultBytes= ResultCache::shared().budget();
+
+  for (int i= 1; i < argc; i++) {
+    string arg= argv[i];
+    bool hasValue= i + 1 < argc;
+    if (arg == "--socket" && hasValue) socketPath= argv[++i];
+    else if (arg == "--cache-mb" && hasValue) cacheBytes= (size_t) atoll(argv[++i]) << 20;
+    else if (arg == "--result-mb" && hasValue) resultBytes= (size_t) atoll(argv[++i]) << 20;
+    else {
+      cout << "usage: pixmap_server [--socket path] [--cache-mb 256] [--result-mb 64]" << endl;
+      return 2;
+    }
+  }
+
+  // start the worker threads now rather than on the first request
+  parallelFor(threadCount(), [](int, int, int) {}, 1);
+
+  SourceCache sources(cacheBytes);
+  ResultCache::shared().setBudget(resultBytes);
+  if (!socketPath.empty()) {
+#ifndef _WIN32
+    return serveSocket(socketPath, sources);
+#else
+    cerr << "pixmap_server: --socket needs a POSIX system, use stdin" << endl;
+    return 2;
+#endif
+  }
+
+  for (string line; getline(cin, line); ) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line == "quit") break;
+    string response= handle(line, sources);
+    if (!response.empty()) cout << response << endl;
+  }
+  return 0;
+}
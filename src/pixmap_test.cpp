@@ -1,10 +1,82 @@
 // Copyright 2021, Aline Normoyle, alinen
 
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
 #include "image.h"
+#include "buffer_pool.h"
+#include "tiled_image.h"
+#include "row_stream.h"
+#include "async_io.h"
+#include "frame_sequence.h"
+#include "op_chain.h"
+#include "quality.h"
+#include "quantize.h"
+#include "result_cache.h"
+#include "virtual_image.h"
 using namespace std;
 using namespace agl;
 
+// Reads a whole file, empty if it cannot be opened
+static vector<unsigned char> readBytes(const string& filename)
+{
+   ifstream file(filename, ios::binary);
+   return vector<unsigned char>(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+// Decodes an RGB QOI file following the QOI 1.0 specification, to check
+// writeQOI against the format rather than against itself
+static bool loadQOI(const string& filename, Image& image)
+{
+   vector<unsigned char> bytes= readBytes(filename);
+   if (bytes.size() < 22 || memcmp(bytes.data(), "qoif", 4) != 0 || bytes[12] != 3) return false;
+   int width= (bytes[4] << 24) | (bytes[5] << 16) | (bytes[6] << 8) | bytes[7];
+   int height= (bytes[8] << 24) | (bytes[9] << 16) | (bytes[10] << 8) | bytes[11];
+   image= Image(width, height);
+
+   unsigned char seen[64][4]= {};
+   unsigned char px[4]= {0, 0, 0, 255};
+   size_t at= 14;
+   int run= 0;
+   for (int i= 0; i < width * height; i++) {
+      if (run > 0) {
+         run--;
+      } else {
+         if (at >= bytes.size()) return false;
+         int op= bytes[at++];
+         if (op == 0xFE) {
+            memcpy(px, &bytes[at], 3);
+            at+= 3;
+         } else if (op == 0xFF) {
+            memcpy(px, &bytes[at], 4);
+            at+= 4;
+         } else if ((op & 0xC0) == 0x00) {
+            memcpy(px, seen[op], 4);
+         } else if ((op & 0xC0) == 0x40) {
+            px[0]+= ((op >> 4) & 3) - 2;
+            px[1]+= ((op >> 2) & 3) - 2;
+            px[2]+= (op & 3) - 2;
+         } else if ((op & 0xC0) == 0x80) {
+            int dg= (op & 0x3F) - 32;
+            int next= bytes[at++];
+            px[0]+= dg + (next >> 4) - 8;
+            px[1]+= dg;
+            px[2]+= dg + (next & 0xF) - 8;
+         } else {
+            run= op & 0x3F;
+         }
+         memcpy(seen[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px, 4);
+      }
+      image.set(i, Pixel{px[0], px[1], px[2]});
+   }
+   static const unsigned char END[8]= {0, 0, 0, 0, 0, 0, 0, 1};
+   return at + 8 == bytes.size() && memcmp(&bytes[at], END, 8) == 0;
+}
+
 int main(int argc, char** argv)
 {
    Image image;
@@ -149,6 +221,36 @@ int main(int argc, char** argv)
    cout << "guassian blurring squirrel" << endl;
    Image gauss_blur_squirrel= squirrel.gaussianBlur();
    gauss_blur_squirrel.save("gaussian_blurred_squirrel.png");
+   Image gauss8_squirrel= squirrel.gaussianBlur(8.0f);
+   gauss8_squirrel.save("gaussian8_squirrel.png");
+   Image gauss50_squirrel= squirrel.gaussianBlur(50.0f);
+   gauss50_squirrel.save("gaussian50_squirrel.png");
+
+   // should print 1 1, the FFT path agrees with the direct one to within 1,
+   // also for a one-sided kernel that a mirrored index would get wrong
+   cout << "large kernel convolution on squirrel" << endl;
+   std::vector<int> motion(31 * 31, 0);
+   for (int k= 0; k < 31; k++) motion[k * 31 + k]= 1;
+   Image motion_direct= squirrel.convoluteDirect(motion.data(), 1.0f / 31, 31);
+   Image motion_squirrel= squirrel.convoluteFFT(motion.data(), 1.0f / 31, 31);
+   motion_squirrel.save("motion_squirrel.png");
+   std::vector<int> smear(9 * 9, 0);
+   for (int k= 0; k < 5; k++) smear[4 * 9 + 4 + k]= 5 - k;
+   smear[1 * 9 + 2]= 2;
+   Image smear_direct= squirrel.convoluteDirect(smear.data(), 1.0f / 17, 9);
+   Image smear_fft= squirrel.convoluteFFT(smear.data(), 1.0f / 17, 9);
+   cout << "fft matches direct: " << (compareImages(motion_direct, motion_squirrel).maxError <= 1) << " " <<
+      (compareImages(smear_direct, smear_fft).maxError <= 1) << endl;
+
+   cout << "colour spaces on squirrel" << endl;
+   Image hue_squirrel= squirrel.adjustHueSaturation(120.0f, 1.5f);
+   hue_squirrel.save("hue_squirrel.png");
+   Image lab_squirrel= squirrel.convertColor(COLOR_RGB, COLOR_LAB);
+   lab_squirrel.save("lab_squirrel.png");
+
+   // should print 1, YCbCr round trips to within 1
+   Image ycbcr_squirrel= squirrel.convertColor(COLOR_RGB, COLOR_YCBCR).convertColor(COLOR_YCBCR, COLOR_RGB);
+   cout << "ycbcr round trip: " << (compareImages(squirrel, ycbcr_squirrel).maxError <= 1) << endl;
 
    cout << "ridge detection squirrel" << endl;
    Image ridge_squirrel= squirrel.ridgeDetection();
@@ -162,10 +264,260 @@ int main(int argc, char** argv)
    Image sobel_squirrel= squirrel.sobel();
    sobel_squirrel.save("sobel_squirrel.png");
 
+   cout << "sobel orientation on squirrel" << endl;
+   Image sobel_orientation_squirrel= squirrel.sobelOrientation();
+   sobel_orientation_squirrel.save("sobel_orientation_squirrel.png");
+
+   // should print the signed gradients of the top-left pixel's red channel
+   Gradient gradient_squirrel= squirrel.gradient();
+   cout << "gradient at 0,0: " << gradient_squirrel.gx[0] << " " << gradient_squirrel.gy[0] << endl;
+
+   // should print the channel ranges and means of squirrel
+   ImageStats stats= squirrel.statistics();
+   cout << "squirrel stats:";
+   for (int c= 0; c < 3; c++) {
+      cout << " [" << (int) stats.min[c] << "-" << (int) stats.max[c] << 
+         " mean " << stats.mean[c] << " median " << (int) stats.percentile(c, 50) << "]";
+   }
+   cout << endl;
+
+   cout << "equalizing squirrel" << endl;
+   Image equalized_squirrel= squirrel.equalize();
+   equalized_squirrel.save("equalized_squirrel.png");
+
+   cout << "auto levels squirrel" << endl;
+   Image levels_squirrel= squirrel.autoLevels(1.0f);
+   levels_squirrel.save("auto_levels_squirrel.png");
+
+   cout << "noise on squirrel" << endl;
+   Image noisy_squirrel= squirrel.gaussianNoise(20.0f, 7);
+   noisy_squirrel.save("gaussian_noise_squirrel.png");
+   Image salt_squirrel= squirrel.saltAndPepper(0.05f, 7);
+   salt_squirrel.save("salt_and_pepper_squirrel.png");
+   Image grain_squirrel= squirrel.filmGrain(25.0f, 7);
+   grain_squirrel.save("film_grain_squirrel.png");
+
+   // should print 1, the same seed gives the same jitter
+   Image jitter1= squirrel.colorJitter(10, 42);
+   Image jitter2= squirrel.colorJitter(10, 42);
+   cout << "jitter reproducible: " << 
+      (jitter1 == jitter2) << endl;
+
+   // should print 1, tiles with a halo match the whole-image filter
+   cout << "tiled unsharp masking squirrel" << endl;
+   TiledImage tiled_squirrel;
+   TiledImage tiled_result;
+   tiled_squirrel.fromImage(squirrel, 32);
+   tiled_squirrel.apply([](const Image& tile) { return tile.unsharpMasking(); }, 2, tiled_result);
+   tiled_result.save("tiled_unsharp_squirrel.ppm");
+   Image untiled= tiled_result.toImage();
+   cout << "tiled matches: " << 
+      (untiled == unsharp_masking_squirrel) << endl;
+
+   // should print 1, streaming stages match the whole-image chain
+   cout << "streaming blur -> sobel -> extract on squirrel" << endl;
+   int gaussian[] {1, 2, 1, 2, 4, 2, 1, 2, 1};
+   PPMRowReader squirrel_rows;
+   squirrel_rows.open("tiled_unsharp_squirrel.ppm");
+   ConvolveStage blur_stage(squirrel_rows, gaussian, 1.0f / 16.0f, 3);
+   SobelStage sobel_stage(blur_stage);
+   RowMapStage extract_stage(sobel_stage, [](const unsigned char* in, unsigned char* out, int width) {
+      for (int i= 0; i < width * 3; i+= 3) {
+         bool keep= in[i] >= 40 && in[i + 1] >= 40 && in[i + 2] >= 40;
+         for (int c= 0; c < 3; c++) out[i + c]= keep ? in[i + c] : 0;
+      }
+   });
+   Image streamed= toImage(extract_stage);
+   Image chained= unsharp_masking_squirrel.gaussianBlur().sobel().extract(Pixel{40, 40, 40}, Pixel{255, 255, 255});
+   cout << "streamed matches: " << (streamed == chained) << endl;
+
+   // should print 1 1 0, the second load waits for the first one's bytes
+   cout << "async load/save" << endl;
+   IOPool io(2, squirrel.bytes());
+   AsyncLoad earth_load= io.loadAsync("../images/earth.png");
+   AsyncLoad squirrel_load= io.loadAsync("../images/squirrel.png");
+   AsyncLoad cancelled_load= io.loadAsync("../images/scenery.png");
+   cancelled_load.cancel();
+   Image async_earth;
+   Image async_squirrel;
+   Image async_scenery;
+   bool loaded_earth= earth_load.get(async_earth);
+   bool loaded_squirrel= squirrel_load.get(async_squirrel);
+   cout << loaded_earth << " " << loaded_squirrel << " " << cancelled_load.get(async_scenery) << endl;
+   AsyncSave invert_save= io.saveAsync(async_earth.invert(), "async_invert_earth.png");
+   cout << "async save: " << invert_save.get() << endl;
+
+   // should print 1 1, loads waiting for budget leave the workers free for a save
+   AsyncLoad holding_load= io.loadAsync("../images/squirrel.png");
+   AsyncLoad waiting_load= io.loadAsync("../images/earth.png");
+   AsyncLoad waiting_load2= io.loadAsync("../images/squirrel.png");
+   AsyncSave queued_save= io.saveAsync(squirrel.invert(), "async_invert_squirrel.png");
+   bool saved_behind_loads= queued_save.get();
+   Image waited_squirrel;
+   Image waited_earth;
+   bool all_loaded= holding_load.get(waited_squirrel) && waiting_load.get(waited_earth) &&
+      waiting_load2.get(waited_squirrel);
+   cout << "async save behind waiting loads: " << saved_behind_loads << " " << all_loaded << endl;
+
+   // should print 1 twice, row spans and the pixel iterator see the same data as get()
+   long long row_sum= 0;
+   for (int i= 0; i < squirrel.height(); i++) {
+      const Pixel* pixels= squirrel.row(i);
+      for (int j= 0; j < squirrel.width(); j++) row_sum+= pixels[j].g;
+   }
+   long long iterator_sum= 0;
+   for (const Pixel& p : squirrel) iterator_sum+= p.g;
+   long long get_sum= 0;
+   for (int i= 0; i < squirrel.pixelCount(); i++) get_sum+= squirrel.get(i).g;
+   cout << "row spans: " << (row_sum == get_sum) << " " << (iterator_sum == get_sum) << endl;
+
+   // should print 1, the sorting network and the histograms agree
+   cout << "median filtering noisy squirrel" << endl;
+   Image median_squirrel= salt_squirrel.medianFilter(2);
+   median_squirrel.save("median_squirrel.png");
+   Image rank_squirrel= salt_squirrel.rankFilter(2, 0.5f);
+   cout << "median paths match: " << 
+      (median_squirrel == rank_squirrel) << endl;
+   Image median10_squirrel= salt_squirrel.medianFilter(10);
+   median10_squirrel.save("median10_squirrel.png");
+   Image rank_min_squirrel= squirrel.rankFilter(3, 0.0f);
+   Image min_squirrel= squirrel.minFilter(3);
+   min_squirrel.save("min_squirrel.png");
+   Image max_squirrel= squirrel.maxFilter(3);
+   max_squirrel.save("max_squirrel.png");
+
+   // should print 1, van Herk erosion and the histogram minimum agree
+   cout << "morphology on squirrel" << endl;
+   cout << "erode matches: " << 
+      (min_squirrel == rank_min_squirrel) << endl;
+   Image bright_mask= squirrel.extract(Pixel{100, 100, 100}, Pixel{255, 255, 255});
+   Image cleaned_mask= bright_mask.opening(2).closing(2);
+   cleaned_mask.save("cleaned_mask_squirrel.png");
+   Image top_hat_squirrel= squirrel.topHat(5);
+   top_hat_squirrel.save("top_hat_squirrel.png");
+
    cout << "invert operator on squirrel" << endl;
    Image invert_squirrel= squirrel.invert();
    invert_squirrel.save("invert_squirrel.png");
 
+   // should print 1, the median of noisy frames is closer to the original
+   cout << "frame sequence of noisy squirrels" << endl;
+   FrameSequence frames(squirrel.width(), squirrel.height(), 5);
+   Image frame_average, frame_median, frame_motion;
+   for (unsigned int seed= 1; seed <= 8; seed++) {
+      frames.push(squirrel.gaussianNoise(25.0f, seed));
+      frames.average(frame_average);
+      frames.median(frame_median);
+      if (frames.size() > 1) frames.motionMask(frame_motion, 60);
+   }
+   frame_average.save("frame_average_squirrel.png");
+   frame_median.save("frame_median_squirrel.png");
+   frame_motion.save("frame_motion_squirrel.png");
+   cout << "median denoises: " <<
+      (compareImages(squirrel, frame_median).mse < compareImages(squirrel, frames.frame(0)).mse) << endl;
+
+   // should print 1 1, rows are found through the stride whatever it is
+   Image padded(squirrel.width(), squirrel.height(), squirrel.width() * 3 + 5);
+   for (int i= 0; i < squirrel.height(); i++) {
+      memcpy(padded.rowData(i), squirrel.rowData(i), squirrel.width() * 3);
+   }
+   cout << "padded rows: " << (padded == squirrel) << " " <<
+      (padded.erode(3) == squirrel.erode(3) && padded.sobel() == squirrel.sobel()) << endl;
+
+   // should print 0 1, a repeated filter reuses the buffers of the first call
+   BufferPool& pool= BufferPool::shared();
+   squirrel.glow(Pixel{100, 100, 100}, Pixel{255, 255, 255});
+   pool.resetStats();
+   squirrel.glow(Pixel{100, 100, 100}, Pixel{255, 255, 255});
+   BufferPoolStats pooled= pool.stats();
+   cout << "pool misses, hits: " << pooled.misses << " " << (pooled.hits > 0) << endl;
+
+   // should print 1 1, a parsed chain step runs the same operation as a direct call
+   OpStep step;
+   string stepError;
+   Image stepped;
+   bool parsed= parseStep("alphaBlend($1,0.25)", 2, step, stepError);
+   cout << "op chain: " << (parsed && step.text() == "alphaBlend($1,0.25)") << " " <<
+      (applyStep(squirrel, step, {&squirrel, &padded}, stepped, stepError) &&
+      stepped == squirrel.alphaBlend(padded, 0.25f)) << endl;
+
+   // should print 1 1 1, the second request is a lookup and the row padding is not hashed
+   int computed= 0;
+   auto blurRed= [&computed](const Image& in) { computed++; return in.extractRed().boxBlur(); };
+   Image memoRed= memoize(squirrel, "extractRed.boxBlur", blurRed);
+   bool sameRed= memoize(squirrel, "extractRed.boxBlur", blurRed) == memoRed;
+   cout << "result cache: " << sameRed << " " << (computed == 1) << " " <<
+      (contentHash(padded) == contentHash(squirrel)) << endl;
+
+   // should print 1 1, a blurred canvas refreshed after an edit matches a full blur
+   Image canvas= squirrel.gridCopy(3, 3);
+   Image canvasBlur= canvas.boxBlur();
+   canvas.clearDirty();
+   canvas.replace(padded.subimage(0, 0, 20, 20), 90, 95);
+   canvas.refresh([](const Image& in) { return in.boxBlur(); }, 1, canvasBlur);
+   cout << "dirty refresh: " << (canvas.dirtyRegions().size() == 1) << " " <<
+      (canvasBlur == canvas.boxBlur()) << endl;
+
+   // should print 1 1, flat art keeps its own colours through a palette PNG
+   Image flat= squirrel.bitmap(8);
+   Image reloaded;
+   flat.saveIndexed("squirrel-bitmap-indexed.png");
+   cout << "indexed png: " << (quantize(flat).toImage() == flat) << " " <<
+      (reloaded.load("squirrel-bitmap-indexed.png") && reloaded == flat) << endl;
+
+   // should print 1 1, an image is perfect against itself and a blur loses quality
+   ImageQuality same= compareImages(squirrel, squirrel);
+   ImageQuality blurred= compareImages(squirrel, squirrel.boxBlur());
+   cout << "quality: " << (same.mse == 0 && same.ssim == 1) << " " <<
+      (blurred.psnr > 20 && blurred.psnr < 60 && blurred.ssim < 1) << endl;
+
+   // should print 1 1, rotating by 0 changes nothing and -90 turns like rotate90
+   cout << "rotate: " << (squirrel.rotate(0) == squirrel) << " " <<
+      (squirrel.rotate(-90, INTERPOLATE_NEAREST) == squirrel.rotate90()) << endl;
+
+   // should print 1 1, a streamed tiling and mosaic load back as the grid they stand for
+   TiledRowSource tiles(squirrel, 3, 2);
+   MosaicRowSource mosaic(squirrel.width() * 2, squirrel.height() * 3);
+   for (int cell= 0; cell < 6; cell++) {
+      mosaic.place(squirrel, (cell % 2) * squirrel.width(), (cell / 2) * squirrel.height());
+   }
+   Image tiled, laidOut;
+   cout << "virtual images: " <<
+      (writePNG(tiles, "squirrel-tiled.png") && tiled.load("squirrel-tiled.png") &&
+      tiled == squirrel.gridCopy(3, 2)) << " " <<
+      (writeImage(mosaic, "squirrel-mosaic.ppm") && laidOut.load("squirrel-mosaic.ppm") &&
+      laidOut == tiled) << endl;
+
+   // should print 1 1, a QOI file decodes back to its image, and a tiny one
+   // codes a run, a difference and a full colour
+   ImageRowSource squirrelRows(squirrel);
+   Image decoded;
+   Image tiny(3, 1);
+   tiny.set(0, Pixel{0, 0, 0});
+   tiny.set(1, Pixel{1, 1, 1});
+   tiny.set(2, Pixel{200, 10, 10});
+   ImageRowSource tinyRows(tiny);
+   const unsigned char tinyQOI[]= {'q', 'o', 'i', 'f', 0, 0, 0, 3, 0, 0, 0, 1, 3, 0,
+      0xC0, 0x7F, 0xFE, 200, 10, 10, 0, 0, 0, 0, 0, 0, 0, 1};
+   cout << "qoi: " <<
+      (writeQOI(squirrelRows, "squirrel.qoi") && loadQOI("squirrel.qoi", decoded) &&
+      decoded == squirrel) << " " <<
+      (writeQOI(tinyRows, "tiny.qoi") &&
+      readBytes("tiny.qoi") == vector<unsigned char>(tinyQOI, tinyQOI + sizeof(tinyQOI))) << endl;
+
+   // should print 1, every multi-versioned kernel matches its scalar build
+   cout << "kernels use " << isaName(activeIsa()) << endl;
+   setVerifyKernels(true);
+   squirrel.erode(3);
+   squirrel.dilate(3);
+   squirrel.medianFilter(2);
+   squirrel.gaussianBlur(4.0f);
+   squirrel.convoluteFFT(motion.data(), 1.0f / 31, 31);
+   squirrel.convertColor(COLOR_RGB, COLOR_HSV);
+   squirrel.convertColor(COLOR_RGB, COLOR_YCBCR);
+   setVerifyKernels(false);
+   cout << "kernels match scalar: " << (verifyMismatches() == 0) << endl;
+
 
    return 0;
 }
@@ -0,0 +1,423 @@
+#include "png_writer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// stb_image_write's deflate, compiled into image.cpp with the rest of it;
+// returns a zlib stream allocated with malloc
+extern "C" unsigned char* stbi_zlib_compress(unsigned char* data, int data_len,
+  int* out_len, int quality);
+
+namespace agl {
+
+// same effort stbi_write_png uses
+static const int ZLIB_QUALITY= 8;
+
+static const unsigned char SIGNATURE[8]= {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+// Streaming deflate: matches are looked up within the last WINDOW_SIZE
+// bytes, following at most MAX_CHAIN earlier positions with the same hash
+static const int WINDOW_SIZE= 1 << 15;
+static const int HASH_BITS= 15;
+static const int MIN_MATCH= 3;
+static const int MAX_MATCH= 258;
+static const int MAX_CHAIN= 16;
+
+// compressed bytes gathered before they go out as an IDAT chunk
+static const size_t IDAT_BYTES= 1 << 16;
+
+uint32_t pngCrc(const unsigned char* data, size_t bytes, uint32_t crc) {
+  static const struct Table {
+    uint32_t entries[256];
+    Table() {
+      for (uint32_t n= 0; n < 256; n++) {
+        uint32_t c= n;
+        for (int k= 0; k < 8; k++) c= (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        this->entries[n]= c;
+      }
+    }
+  } table;
+
+  crc= ~crc;
+  for (size_t i= 0; i < bytes; i++) {
+    crc= table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static void putBigEndian(unsigned char* out, uint32_t value) {
+  out[0]= (unsigned char) (value >> 24);
+  out[1]= (unsigned char) (value >> 16);
+  out[2]= (unsigned char) (value >> 8);
+  out[3]= (unsigned char) value;
+}
+
+// length, type, data and the CRC of type and data
+static bool writeChunk(FILE* file, const char* type, const unsigned char* data, size_t bytes) {
+  unsigned char header[8];
+  putBigEndian(header, (uint32_t) bytes);
+  std::memcpy(header + 4, type, 4);
+  unsigned char footer[4];
+  putBigEndian(footer, pngCrc(data, bytes, pngCrc(header + 4, 4)));
+
+  return std::fwrite(header, 1, 8, file) == 8 &&
+    (bytes == 0 || std::fwrite(data, 1, bytes, file) == bytes) &&
+    std::fwrite(footer, 1, 4, file) == 4;
+}
+
+bool writeIndexedPng(const std::string& filename, int width, int height,
+  const unsigned char* indices, const std::vector<Pixel>& palette) {
+  if (width <= 0 || height <= 0 || palette.empty() || palette.size() > 256) return false;
+
+  int depth= palette.size() <= 2 ? 1 : palette.size() <= 4 ? 2 : palette.size() <= 16 ? 4 : 8;
+  int perByte= 8 / depth;
+  size_t rowBytes= ((size_t) width + perByte - 1) / perByte;
+
+  // each row is a filter byte (0, none) and the indices packed high bits first
+  std::vector<unsigned char> raw((rowBytes + 1) * height, 0);
+  for (int i= 0; i < height; i++) {
+    unsigned char* dst= &raw[i * (rowBytes + 1) + 1];
+    const unsigned char* src= indices + (size_t) i * width;
+    if (depth == 8) {
+      std::memcpy(dst, src, width);
+      continue;
+    }
+    for (int j= 0; j < width; j++) {
+      int shift= 8 - depth * (j % perByte + 1);
+      dst[j / perByte]|= (unsigned char) (src[j] << shift);
+    }
+  }
+
+  int compressedBytes= 0;
+  unsigned char* compressed= stbi_zlib_compress(raw.data(), (int) raw.size(),
+    &compressedBytes, ZLIB_QUALITY);
+  if (compressed == nullptr) return false;
+
+  unsigned char header[13];
+  putBigEndian(header, width);
+  putBigEndian(header + 4, height);
+  header[8]= (unsigned char) depth;
+  header[9]= 3;   // palette
+  header[10]= 0;  // deflate
+  header[11]= 0;  // adaptive filtering
+  header[12]= 0;  // not interlaced
+
+  std::vector<unsigned char> colors;
+  for (const Pixel& color : palette) {
+    colors.push_back(color.r);
+    colors.push_back(color.g);
+    colors.push_back(color.b);
+  }
+
+  FILE* file= std::fopen(filename.c_str(), "wb");
+  bool success= file != nullptr &&
+    std::fwrite(SIGNATURE, 1, 8, file) == 8 &&
+    writeChunk(file, "IHDR", header, sizeof(header)) &&
+    writeChunk(file, "PLTE", colors.data(), colors.size()) &&
+    writeChunk(file, "IDAT", compressed, compressedBytes) &&
+    writeChunk(file, "IEND", nullptr, 0);
+  if (file != nullptr && std::fclose(file) != 0) success= false;
+  std::free(compressed);
+
+  return success;
+}
+
+static const int LENGTH_BASE[29]= {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const int LENGTH_EXTRA[29]= {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const int DISTANCE_BASE[30]= {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const int DISTANCE_EXTRA[30]= {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static uint32_t reverseBits(uint32_t code, int length) {
+  uint32_t reversed= 0;
+  for (int k= 0; k < length; k++, code>>= 1) reversed= (reversed << 1) | (code & 1);
+  return reversed;
+}
+
+namespace {
+
+// The fixed Huffman codes of RFC 1951 3.2.6, bit reversed for LSB-first
+// output, and the length and distance symbols of every match
+struct FixedCodes {
+  uint16_t literal[288];
+  unsigned char literalLength[288];
+  uint16_t distance[30];
+  unsigned char lengthSymbol[MAX_MATCH + 1];
+  unsigned char distanceSymbol[512];  // distance - 1 below 256, else 256 + ((distance - 1) >> 7)
+
+  FixedCodes() {
+    for (int k= 0; k < 288; k++) {
+      int length= k < 144 ? 8 : k < 256 ? 9 : k < 280 ? 7 : 8;
+      int code= k < 144 ? 0x30 + k : k < 256 ? 0x190 + k - 144 : k < 280 ? k - 256 : 0xC0 + k - 280;
+      this->literal[k]= (uint16_t) reverseBits(code, length);
+      this->literalLength[k]= (unsigned char) length;
+    }
+    for (int k= 0; k < 30; k++) this->distance[k]= (uint16_t) reverseBits(k, 5);
+
+    for (int length= MIN_MATCH, symbol= 0; length <= MAX_MATCH; length++) {
+      while (symbol < 28 && LENGTH_BASE[symbol + 1] <= length) symbol++;
+      this->lengthSymbol[length]= (unsigned char) symbol;
+    }
+    for (int k= 0; k < 512; k++) {
+      int distance= k < 256 ? k + 1 : ((k - 256) << 7) + 1;
+      int symbol= 0;
+      while (symbol < 29 && DISTANCE_BASE[symbol + 1] <= distance) symbol++;
+      this->distanceSymbol[k]= (unsigned char) symbol;
+    }
+  }
+};
+
+/**
+ * Incremental zlib stream: greedy LZ77 over hash chains, coded as a single
+ * fixed Huffman block so nothing has to wait for the end of the input.
+ * Matches stop at the end of the bytes written so far.
+ */
+class ZlibStream {
+ public:
+  ZlibStream() : myBase(0), myDone(0), myHashed(0), myBits(0), myBitCount(0),
+    myAdlerA(1), myAdlerB(0), myHead(1 << HASH_BITS, -1), myPrev(WINDOW_SIZE, -1) {
+    // 32K window, no preset dictionary, check bits for 0x7801
+    this->myOutput.push_back(0x78);
+    this->myOutput.push_back(0x01);
+    this->putBits(1, 1);  // final block
+    this->putBits(1, 2);  // fixed codes
+  }
+
+  void write(const unsigned char* data, size_t bytes) {
+    this->updateAdler(data, bytes);
+    this->myWindow.insert(this->myWindow.end(), data, data + bytes);
+
+    size_t end= this->myWindow.size();
+    while (this->myDone < end) {
+      size_t pos= this->myDone;
+      this->hashUpTo(pos);
+
+      int best= 0;
+      int bestDistance= 0;
+      int limit= (int) std::min<size_t>(MAX_MATCH, end - pos);
+      if (limit >= MIN_MATCH) {
+        const unsigned char* here= &this->myWindow[pos];
+        long long absolute= this->myBase + (long long) pos;
+        long long candidate= this->myHead[hash(here)];
+        for (int depth= 0; depth < MAX_CHAIN && candidate >= this->myBase; depth++) {
+          long long distance= absolute - candidate;
+          if (distance > WINDOW_SIZE) break;
+
+          const unsigned char* there= &this->myWindow[candidate - this->myBase];
+          if (there[best] == here[best]) {
+            int length= 0;
+            while (length < limit && there[length] == here[length]) length++;
+            if (length > best) {
+              best= length;
+              bestDistance= (int) distance;
+              if (length == limit) break;
+            }
+          }
+          candidate= this->myPrev[candidate & (WINDOW_SIZE - 1)];
+        }
+      }
+
+      if (best >= MIN_MATCH) {
+        this->putMatch(best, bestDistance);
+        this->myDone+= best;
+      } else {
+        this->putSymbol(this->myWindow[pos]);
+        this->myDone++;
+      }
+    }
+
+    // keep the last WINDOW_SIZE bytes once twice that has built up
+    if (this->myWindow.size() > 2 * (size_t) WINDOW_SIZE) {
+      size_t drop= this->myWindow.size() - WINDOW_SIZE;
+      this->hashUpTo(this->myDone);
+      drop= std::min(drop, this->myHashed);
+      this->myWindow.erase(this->myWindow.begin(), this->myWindow.begin() + drop);
+      this->myBase+= (long long) drop;
+      this->myDone-= drop;
+      this->myHashed-= drop;
+    }
+  }
+
+  // Ends the block and appends the Adler-32 checksum
+  void finish() {
+    this->putSymbol(256);
+    if (this->myBitCount > 0) this->putBits(0, 8 - this->myBitCount);
+    uint32_t adler= (this->myAdlerB << 16) | this->myAdlerA;
+    unsigned char footer[4];
+    putBigEndian(footer, adler);
+    this->myOutput.insert(this->myOutput.end(), footer, footer + 4);
+  }
+
+  // Compressed bytes not yet taken
+  std::vector<unsigned char>& output() {
+    return this->myOutput;
+  }
+
+ private:
+  static const FixedCodes& codes() {
+    static const FixedCodes fixed;
+    return fixed;
+  }
+
+  static uint32_t hash(const unsigned char* p) {
+    uint32_t key= ((uint32_t) p[0] << 16) | (p[1] << 8) | p[2];
+    return (key * 2654435761u) >> (32 - HASH_BITS);
+  }
+
+  // Enters positions up to pos in the hash chains, as far as three bytes are known
+  void hashUpTo(size_t pos) {
+    size_t last= this->myWindow.size() < MIN_MATCH ? 0 : this->myWindow.size() - MIN_MATCH + 1;
+    pos= std::min(pos, last);
+    for (; this->myHashed < pos; this->myHashed++) {
+      long long absolute= this->myBase + (long long) this->myHashed;
+      uint32_t h= hash(&this->myWindow[this->myHashed]);
+      this->myPrev[absolute & (WINDOW_SIZE - 1)]= this->myHead[h];
+      this->myHead[h]= absolute;
+    }
+  }
+
+  void putBits(uint32_t value, int count) {
+    this->myBits|= value << this->myBitCount;
+    this->myBitCount+= count;
+    while (this->myBitCount >= 8) {
+      this->myOutput.push_back((unsigned char) this->myBits);
+      this->myBits>>= 8;
+      this->myBitCount-= 8;
+    }
+  }
+
+  void putSymbol(int symbol) {
+    this->putBits(codes().literal[symbol], codes().literalLength[symbol]);
+  }
+
+  void putMatch(int length, int distance) {
+    const FixedCodes& fixed= codes();
+    int symbol= fixed.lengthSymbol[length];
+    this->putSymbol(257 + symbol);
+    this->putBits(length - LENGTH_BASE[symbol], LENGTH_EXTRA[symbol]);
+
+    int code= fixed.distanceSymbol[distance <= 256 ? distance - 1 : 256 + ((distance - 1) >> 7)];
+    this->putBits(fixed.distance[code], 5);
+    this->putBits(distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+  }
+
+  void updateAdler(const unsigned char* data, size_t bytes) {
+    // 5552 bytes is the most that cannot overflow before the modulo
+    while (bytes > 0) {
+      size_t block= std::min<size_t>(bytes, 5552);
+      for (size_t i= 0; i < block; i++) {
+        this->myAdlerA+= data[i];
+        this->myAdlerB+= this->myAdlerA;
+      }
+      this->myAdlerA%= 65521;
+      this->myAdlerB%= 65521;
+      data+= block;
+      bytes-= block;
+    }
+  }
+
+  std::vector<unsigned char> myWindow;
+  long long myBase;   // stream position of myWindow[0]
+  size_t myDone;      // next byte of myWindow to code
+  size_t myHashed;    // next byte of myWindow to enter in the chains
+  uint32_t myBits;
+  int myBitCount;
+  uint32_t myAdlerA;
+  uint32_t myAdlerB;
+  std::vector<long long> myHead;  // latest stream position per hash
+  std::vector<long long> myPrev;  // previous position with the same hash
+  std::vector<unsigned char> myOutput;
+};
+
+}  // namespace
+
+// PNG filter type of one row of n bytes, 3 bytes per pixel, into out
+static void filterRow(int type, const unsigned char* row, const unsigned char* above, size_t n,
+  unsigned char* out) {
+  for (size_t i= 0; i < n; i++) {
+    int a= i >= 3 ? row[i - 3] : 0;
+    int b= above[i];
+    int c= i >= 3 ? above[i - 3] : 0;
+    int predicted= 0;
+    if (type == 1) {
+      predicted= a;
+    } else if (type == 2) {
+      predicted= b;
+    } else if (type == 3) {
+      predicted= (a + b) >> 1;
+    } else if (type == 4) {
+      int pa= std::abs(b - c);
+      int pb= std::abs(a - c);
+      int pc= std::abs(a + b - 2 * c);
+      predicted= (pa <= pb && pa <= pc) ? a : pb <= pc ? b : c;
+    }
+    out[i]= (unsigned char) (row[i] - predicted);
+  }
+}
+
+bool writePNG(RowSource& source, const std::string& filename) {
+  int width= source.width();
+  int height= source.height();
+  if (width <= 0 || height <= 0) return false;
+
+  unsigned char header[13];
+  putBigEndian(header, width);
+  putBigEndian(header + 4, height);
+  header[8]= 8;   // bits per channel
+  header[9]= 2;   // RGB
+  header[10]= 0;  // deflate
+  header[11]= 0;  // adaptive filtering
+  header[12]= 0;  // not interlaced
+
+  FILE* file= std::fopen(filename.c_str(), "wb");
+  if (file == nullptr) return false;
+  bool success= std::fwrite(SIGNATURE, 1, 8, file) == 8 &&
+    writeChunk(file, "IHDR", header, sizeof(header));
+
+  // as stbi_write_png does, each row takes the filter whose output has the
+  // smallest sum of magnitudes
+  size_t n= (size_t) width * 3;
+  std::vector<unsigned char> above(n, 0);
+  std::vector<unsigned char> trial(n + 1);
+  std::vector<unsigned char> best(n + 1);
+  ZlibStream zlib;
+
+  for (int y= 0; y < height && success; y++) {
+    const unsigned char* row= source.row(y);
+    long long bestCost= -1;
+    for (int type= 0; type < 5; type++) {
+      trial[0]= (unsigned char) type;
+      filterRow(type, row, above.data(), n, &trial[1]);
+      long long cost= 0;
+      for (size_t i= 1; i <= n; i++) cost+= std::abs((signed char) trial[i]);
+      if (bestCost < 0 || cost < bestCost) {
+        bestCost= cost;
+        best.swap(trial);
+      }
+    }
+    std::memcpy(above.data(), row, n);
+
+    zlib.write(best.data(), best.size());
+    std::vector<unsigned char>& compressed= zlib.output();
+    if (compressed.size() >= IDAT_BYTES) {
+      success= writeChunk(file, "IDAT", compressed.data(), compressed.size());
+      compressed.clear();
+    }
+  }
+
+  if (success) {
+    zlib.finish();
+    std::vector<unsigned char>& compressed= zlib.output();
+    success= writeChunk(file, "IDAT", compressed.data(), compressed.size()) &&
+      writeChunk(file, "IEND", nullptr, 0);
+  }
+  if (std::fclose(file) != 0) success= false;
+
+  return success;
+}
+
+}  // namespace agl
@@ -0,0 +1,38 @@
+#ifndef AGL_PNG_WRITER_H_
+#define AGL_PNG_WRITER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "image.h"
+#include "row_stream.h"
+
+namespace agl {
+
+// CRC-32 of a PNG chunk (ISO 3309), continued from crc for data in pieces
+uint32_t pngCrc(const unsigned char* data, size_t bytes, uint32_t crc = 0);
+
+/**
+ * @brief Writes a palette PNG (colour type 3)
+ * @param indices width * height palette indices, row by row
+ * @param palette 1 to 256 colours
+ *
+ * Uses the smallest bit depth (1, 2, 4 or 8) that holds the palette.
+ * Rows are unfiltered, as the PNG spec recommends for indexed colour.
+ */
+bool writeIndexedPng(const std::string& filename, int width, int height,
+  const unsigned char* indices, const std::vector<Pixel>& palette);
+
+/**
+ * @brief Writes an RGB PNG (colour type 2) row by row as source yields them
+ *
+ * Memory stays at a few rows plus the 32K deflate window whatever the
+ * image size, so virtual images far larger than RAM can be exported.
+ * Rows get the adaptive filter stbi_write_png picks; the deflate is this
+ * file's own incremental LZ77 with fixed Huffman codes, so files come out
+ * a little larger than save() makes them.
+ */
+bool writePNG(RowSource& source, const std::string& filename);
+
+}  // namespace agl
+#endif  // AGL_PNG_WRITER_H_
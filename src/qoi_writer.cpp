@@ -0,0 +1,124 @@
+#include "qoi_writer.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace agl {
+
+// opcodes of the QOI specification 1.0
+static const unsigned char QOI_OP_INDEX= 0x00;
+static const unsigned char QOI_OP_DIFF= 0x40;
+static const unsigned char QOI_OP_LUMA= 0x80;
+static const unsigned char QOI_OP_RUN= 0xC0;
+static const unsigned char QOI_OP_RGB= 0xFE;
+static const int QOI_MAX_RUN= 62;
+
+// encoded bytes gathered before each fwrite
+static const size_t QOI_BUFFER_BYTES= 1 << 16;
+
+static void putBigEndian(unsigned char* out, uint32_t value) {
+  out[0]= (unsigned char) (value >> 24);
+  out[1]= (unsigned char) (value >> 16);
+  out[2]= (unsigned char) (value >> 8);
+  out[3]= (unsigned char) value;
+}
+
+// Index of a colour in the table of recent colours; alpha is always 255
+static inline int colorHash(int r, int g, int b) {
+  return (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+}
+
+bool writeQOI(RowSource& source, const std::string& filename) {
+  int width= source.width();
+  int height= source.height();
+  if (width <= 0 || height <= 0) return false;
+
+  FILE* file= std::fopen(filename.c_str(), "wb");
+  if (file == nullptr) return false;
+
+  unsigned char header[14]= {'q', 'o', 'i', 'f'};
+  putBigEndian(header + 4, width);
+  putBigEndian(header + 8, height);
+  header[12]= 3;  // RGB
+  header[13]= 0;  // sRGB with linear alpha
+  bool success= std::fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+  // the worst case is 4 bytes per pixel, plus a pending run
+  std::vector<unsigned char> out;
+  out.reserve(QOI_BUFFER_BYTES + (size_t) width * 4 + 1);
+  auto flush= [&]() {
+    if (!out.empty() && std::fwrite(out.data(), 1, out.size(), file) != out.size()) success= false;
+    out.clear();
+  };
+
+  unsigned char seen[64][3];
+  bool seenValid[64];
+  std::memset(seen, 0, sizeof(seen));
+  std::memset(seenValid, 0, sizeof(seenValid));
+  // all zero entries hold transparent black, which an opaque image never matches
+  int pr= 0, pg= 0, pb= 0;
+  int run= 0;
+
+  for (int y= 0; y < height && success; y++) {
+    const unsigned char* row= source.row(y);
+    for (int x= 0; x < width; x++, row+= 3) {
+      int r= row[0];
+      int g= row[1];
+      int b= row[2];
+      if (r == pr && g == pg && b == pb) {
+        if (++run == QOI_MAX_RUN) {
+          out.push_back((unsigned char) (QOI_OP_RUN | (run - 1)));
+          run= 0;
+        }
+        continue;
+      }
+      if (run > 0) {
+        out.push_back((unsigned char) (QOI_OP_RUN | (run - 1)));
+        run= 0;
+      }
+
+      int index= colorHash(r, g, b);
+      if (seenValid[index] && seen[index][0] == r && seen[index][1] == g && seen[index][2] == b) {
+        out.push_back((unsigned char) (QOI_OP_INDEX | index));
+      } else {
+        seen[index][0]= (unsigned char) r;
+        seen[index][1]= (unsigned char) g;
+        seen[index][2]= (unsigned char) b;
+        seenValid[index]= true;
+
+        // differences wrap around, as the decoder adds them modulo 256
+        int dr= (signed char) (r - pr);
+        int dg= (signed char) (g - pg);
+        int db= (signed char) (b - pb);
+        int drg= dr - dg;
+        int dbg= db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+          out.push_back((unsigned char) (QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)));
+        } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+          out.push_back((unsigned char) (QOI_OP_LUMA | (dg + 32)));
+          out.push_back((unsigned char) (((drg + 8) << 4) | (dbg + 8)));
+        } else {
+          out.push_back(QOI_OP_RGB);
+          out.push_back((unsigned char) r);
+          out.push_back((unsigned char) g);
+          out.push_back((unsigned char) b);
+        }
+      }
+      pr= r;
+      pg= g;
+      pb= b;
+    }
+    if (out.size() >= QOI_BUFFER_BYTES) flush();
+  }
+
+  if (run > 0) out.push_back((unsigned char) (QOI_OP_RUN | (run - 1)));
+  static const unsigned char END[8]= {0, 0, 0, 0, 0, 0, 0, 1};
+  out.insert(out.end(), END, END + 8);
+  if (success) flush();
+  if (std::fclose(file) != 0) success= false;
+
+  return success;
+}
+
+}  // namespace agl
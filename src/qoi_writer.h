@@ -0,0 +1,19 @@
+#ifndef AGL_QOI_WRITER_H_
+#define AGL_QOI_WRITER_H_
+
+#include <string>
+#include "row_stream.h"
+
+namespace agl {
+
+/**
+ * @brief Writes a QOI image (3 channels, sRGB) row by row as source yields them
+ *
+ * QOI codes each pixel against the previous one and a 64-entry table of
+ * recent colours, so the encoder keeps no rows at all. Runs carry on from
+ * the end of one row into the next, as the format specifies.
+ */
+bool writeQOI(RowSource& source, const std::string& filename);
+
+}  // namespace agl
+#endif  // AGL_QOI_WRITER_H_
@@ -0,0 +1,162 @@
+#include "quality.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include "dispatch.h"
+#include "parallel.h"
+
+namespace agl {
+
+static const int SSIM_WINDOW= 7;
+static const double SSIM_C1= (0.01 * 255) * (0.01 * 255);
+static const double SSIM_C2= (0.03 * 255) * (0.03 * 255);
+
+// Sum of squared differences and largest difference of n values
+static AGL_INLINE void errorRow(const unsigned char* a, const unsigned char* b, int n,
+  long long* squared, int* largest) {
+  long long sum= 0;
+  int big= 0;
+  for (int i= 0; i < n; i++) {
+    int d= a[i] - b[i];
+    sum+= d * d;
+    big= std::max(big, std::abs(d));
+  }
+  *squared= sum;
+  *largest= big;
+}
+
+// Adds (sign 1) or removes (sign -1) a row of both images from the
+// per-value column sums of a, b, a * a, b * b and a * b
+static AGL_INLINE void columnRow(const unsigned char* a, const unsigned char* b, int n, int sign,
+  int* sumA, int* sumB, int* sumAA, int* sumBB, int* sumAB) {
+  AGL_IVDEP
+  for (int i= 0; i < n; i++) {
+    int x= a[i];
+    int y= b[i];
+    sumA[i]+= sign * x;
+    sumB[i]+= sign * y;
+    sumAA[i]+= sign * x * x;
+    sumBB[i]+= sign * y * y;
+    sumAB[i]+= sign * x * y;
+  }
+}
+
+AGL_VARIANTS(errorRow, (const unsigned char* a, const unsigned char* b, int n,
+  long long* squared, int* largest), (a, b, n, squared, largest))
+AGL_VARIANTS(columnRow, (const unsigned char* a, const unsigned char* b, int n, int sign,
+  int* sumA, int* sumB, int* sumAA, int* sumBB, int* sumAB), (a, b, n, sign, sumA, sumB, sumAA, sumBB, sumAB))
+
+// Column sums of windowHeight rows, one per channel value of a row
+struct ColumnSums {
+  std::vector<int> a;
+  std::vector<int> b;
+  std::vector<int> aa;
+  std::vector<int> bb;
+  std::vector<int> ab;
+};
+
+// SSIM of one window from its sums over count values
+static double windowSsim(long long a, long long b, long long aa, long long bb, long long ab,
+  long long count) {
+  double n2= (double) count * count;
+  double means= 2.0 * a * b + SSIM_C1 * n2;
+  double covariance= 2.0 * (count * ab - a * b) + SSIM_C2 * n2;
+  double squares= (double) (a * a + b * b) + SSIM_C1 * n2;
+  double variances= (double) (count * aa - a * a + count * bb - b * b) + SSIM_C2 * n2;
+  return means * covariance / (squares * variances);
+}
+
+// Sum of the SSIM of every window across one row of windows, all channels
+static double windowRow(const ColumnSums& sums, int width, int windowWidth, long long count) {
+  double total= 0;
+  int across= width - windowWidth + 1;
+  for (int c= 0; c < 3; c++) {
+    long long a= 0, b= 0, aa= 0, bb= 0, ab= 0;
+    for (int k= 0; k < windowWidth; k++) {
+      int i= k * 3 + c;
+      a+= sums.a[i];
+      b+= sums.b[i];
+      aa+= sums.aa[i];
+      bb+= sums.bb[i];
+      ab+= sums.ab[i];
+    }
+    for (int x= 0; x < across; x++) {
+      total+= windowSsim(a, b, aa, bb, ab, count);
+      if (x + 1 == across) break;
+
+      // slide one pixel right
+      int in= (x + windowWidth) * 3 + c;
+      int out= x * 3 + c;
+      a+= sums.a[in] - sums.a[out];
+      b+= sums.b[in] - sums.b[out];
+      aa+= sums.aa[in] - sums.aa[out];
+      bb+= sums.bb[in] - sums.bb[out];
+      ab+= sums.ab[in] - sums.ab[out];
+    }
+  }
+  return total;
+}
+
+ImageQuality compareImages(const Image& reference, const Image& test) {
+  assert(reference.width() == test.width() && reference.height() == test.height());
+  int width= reference.width();
+  int height= reference.height();
+  ImageQuality quality= {0.0, INFINITY, 1.0, 0};
+  if (width == 0 || height == 0) return quality;
+
+  Isa isa= activeIsa();
+  int n= width * 3;
+  int windowWidth= std::min(SSIM_WINDOW, width);
+  int windowHeight= std::min(SSIM_WINDOW, height);
+  int windowsDown= height - windowHeight + 1;
+  long long count= (long long) windowWidth * windowHeight;
+
+  // per-row results, added up in order afterwards so the sums do not
+  // depend on how the rows were split
+  std::vector<long long> squared(height);
+  std::vector<int> largest(height);
+  std::vector<double> ssim(windowsDown);
+
+  // a band owns its rows' errors and the windows whose top row it owns;
+  // those windows read up to windowHeight - 1 rows past the band
+  parallelFor(height, [&](int, int begin, int end) {
+    for (int i= begin; i < end; i++) {
+      errorRowVariants[isa](reference.rowData(i), test.rowData(i), n, &squared[i], &largest[i]);
+    }
+
+    int last= std::min(end, windowsDown);
+    if (begin >= last) return;
+    ColumnSums sums= {std::vector<int>(n), std::vector<int>(n), std::vector<int>(n),
+      std::vector<int>(n), std::vector<int>(n)};
+    auto addRow= [&](int row, int sign) {
+      columnRowVariants[isa](reference.rowData(row), test.rowData(row), n, sign,
+        sums.a.data(), sums.b.data(), sums.aa.data(), sums.bb.data(), sums.ab.data());
+    };
+
+    for (int i= begin; i < begin + windowHeight; i++) addRow(i, 1);
+    for (int top= begin; top < last; top++) {
+      if (top > begin) {
+        addRow(top - 1, -1);
+        addRow(top + windowHeight - 1, 1);
+      }
+      ssim[top]= windowRow(sums, width, windowWidth, count);
+    }
+  }, SSIM_WINDOW * 4);
+
+  long long totalSquared= 0;
+  for (int i= 0; i < height; i++) {
+    totalSquared+= squared[i];
+    quality.maxError= std::max(quality.maxError, largest[i]);
+  }
+  double totalSsim= 0;
+  for (double value : ssim) totalSsim+= value;
+
+  quality.mse= (double) totalSquared / ((double) n * height);
+  if (quality.mse > 0) quality.psnr= 10.0 * std::log10(255.0 * 255.0 / quality.mse);
+  quality.ssim= totalSsim / ((double) windowsDown * (width - windowWidth + 1) * 3);
+  return quality;
+}
+
+}  // namespace agl
@@ -0,0 +1,32 @@
+#ifndef AGL_QUALITY_H_
+#define AGL_QUALITY_H_
+
+#include "image.h"
+
+namespace agl {
+
+/**
+ * @brief How far an image is from a reference of the same size
+ *
+ * All measures are over the R, G and B values alike.
+ */
+struct ImageQuality {
+  double mse;    // mean squared difference of a channel value
+  double psnr;   // 10 log10(255^2 / mse) in dB, infinity for equal images
+  double ssim;   // mean SSIM of all 7x7 windows, 1 for equal images
+  int maxError;  // largest difference of any channel value
+};
+
+/**
+ * @brief Compares test with reference in one pass over both
+ *
+ * SSIM uses uniform 7x7 windows (smaller images use one window as large as
+ * they are) and the usual constants (0.01 * 255)^2 and (0.03 * 255)^2. The
+ * window sums slide down and across integer column sums, so the cost per
+ * pixel does not depend on the window. Bands of rows run in parallel; the
+ * result does not depend on the thread count.
+ */
+ImageQuality compareImages(const Image& reference, const Image& test);
+
+}  // namespace agl
+#endif  // AGL_QUALITY_H_
@@ -0,0 +1,259 @@
+#include "quantize.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <unordered_set>
+#include "parallel.h"
+#include "png_writer.h"
+
+namespace agl {
+
+// 5 bits per channel
+static const int CELL_BITS= 5;
+static const int CELLS= 1 << (3 * CELL_BITS);
+
+static inline int cellOf(const Pixel& p) {
+  return ((p.r >> 3) << (2 * CELL_BITS)) | ((p.g >> 3) << CELL_BITS) | (p.b >> 3);
+}
+
+// Pixels falling into one cell, with their colour sums
+struct CellBin {
+  uint32_t count;
+  uint64_t sum[3];
+};
+
+// Bins every pixel of image by cell; chunks of rows fill private
+// histograms that are added up afterwards
+static std::vector<CellBin> cellHistogram(const Image& image) {
+  int chunks= parallelChunks(image.height());
+  std::vector<std::vector<CellBin>> partial(chunks);
+
+  parallelFor(image.height(), [&](int chunk, int begin, int end) {
+    std::vector<CellBin>& bins= partial[chunk];
+    bins.assign(CELLS, CellBin{0, {0, 0, 0}});
+    for (int i= begin; i < end; i++) {
+      const Pixel* row= image.row(i);
+      for (int j= 0; j < image.width(); j++) {
+        CellBin& bin= bins[cellOf(row[j])];
+        bin.count++;
+        bin.sum[0]+= row[j].r;
+        bin.sum[1]+= row[j].g;
+        bin.sum[2]+= row[j].b;
+      }
+    }
+  });
+
+  std::vector<CellBin> bins= std::move(partial[0]);
+  for (int c= 1; c < chunks; c++) {
+    for (int k= 0; k < CELLS; k++) {
+      bins[k].count+= partial[c][k].count;
+      for (int ch= 0; ch < 3; ch++) bins[k].sum[ch]+= partial[c][k].sum[ch];
+    }
+  }
+  return bins;
+}
+
+static Pixel meanColor(uint32_t count, const uint64_t sum[3]) {
+  return Pixel{(unsigned char) ((sum[0] + count / 2) / count),
+    (unsigned char) ((sum[1] + count / 2) / count), (unsigned char) ((sum[2] + count / 2) / count)};
+}
+
+// The distinct colours of image, or an empty list if there are more than limit
+static std::vector<Pixel> distinctColors(const Image& image, int limit) {
+  std::unordered_set<uint32_t> seen;
+  for (int i= 0; i < image.height(); i++) {
+    const Pixel* row= image.row(i);
+    for (int j= 0; j < image.width(); j++) {
+      seen.insert(((uint32_t) row[j].r << 16) | (row[j].g << 8) | row[j].b);
+      if ((int) seen.size() > limit) return std::vector<Pixel>();
+    }
+  }
+
+  std::vector<uint32_t> sorted(seen.begin(), seen.end());
+  std::sort(sorted.begin(), sorted.end());
+  std::vector<Pixel> colors;
+  for (uint32_t c : sorted) {
+    colors.push_back(Pixel{(unsigned char) (c >> 16), (unsigned char) (c >> 8), (unsigned char) c});
+  }
+  return colors;
+}
+
+namespace {
+
+struct Cell {
+  unsigned char coord[3];
+  uint32_t count;
+  const uint64_t* sum;
+};
+
+// A box of cells [begin, end) and its extent on each axis
+struct Box {
+  int begin;
+  int end;
+  uint64_t count;
+  int low[3];
+  int high[3];
+
+  int longestAxis() const {
+    int axis= 0;
+    for (int a= 1; a < 3; a++) {
+      if (this->high[a] - this->low[a] > this->high[axis] - this->low[axis]) axis= a;
+    }
+    return axis;
+  }
+
+  uint64_t priority() const {
+    if (this->end - this->begin < 2) return 0;
+    int axis= this->longestAxis();
+    return this->count * (uint64_t) (this->high[axis] - this->low[axis]);
+  }
+};
+
+}  // namespace
+
+static Box makeBox(const std::vector<Cell>& cells, int begin, int end) {
+  Box box= {begin, end, 0, {255, 255, 255}, {0, 0, 0}};
+  for (int k= begin; k < end; k++) {
+    box.count+= cells[k].count;
+    for (int a= 0; a < 3; a++) {
+      box.low[a]= std::min(box.low[a], (int) cells[k].coord[a]);
+      box.high[a]= std::max(box.high[a], (int) cells[k].coord[a]);
+    }
+  }
+  return box;
+}
+
+std::vector<Pixel> medianCutPalette(const Image& image, int colors) {
+  assert(colors >= 1 && colors <= 256);
+  if (image.pixelCount() == 0) return std::vector<Pixel>();
+
+  std::vector<CellBin> bins= cellHistogram(image);
+  std::vector<Cell> cells;
+  for (int k= 0; k < CELLS; k++) {
+    if (bins[k].count == 0) continue;
+    Cell cell= {{(unsigned char) (k >> (2 * CELL_BITS)), (unsigned char) ((k >> CELL_BITS) & 31),
+      (unsigned char) (k & 31)}, bins[k].count, bins[k].sum};
+    cells.push_back(cell);
+  }
+
+  // fewer occupied cells than entries: there may be few enough colours
+  // to keep them all
+  if ((int) cells.size() <= colors) {
+    std::vector<Pixel> exact= distinctColors(image, colors);
+    if (!exact.empty()) return exact;
+  }
+
+  std::vector<Box> boxes(1, makeBox(cells, 0, (int) cells.size()));
+  while ((int) boxes.size() < colors) {
+    int widest= 0;
+    for (int b= 1; b < (int) boxes.size(); b++) {
+      if (boxes[b].priority() > boxes[widest].priority()) widest= b;
+    }
+    Box box= boxes[widest];
+    if (box.priority() == 0) break;
+
+    // split at the weighted median of the longest axis, leaving at least
+    // one cell on each side
+    int axis= box.longestAxis();
+    std::sort(cells.begin() + box.begin, cells.begin() + box.end, [axis](const Cell& a, const Cell& b) {
+      return a.coord[axis] < b.coord[axis];
+    });
+    uint64_t below= 0;
+    int split= box.begin + 1;
+    while (split < box.end - 1 && (below+= cells[split - 1].count) * 2 < box.count) split++;
+
+    boxes[widest]= makeBox(cells, box.begin, split);
+    boxes.push_back(makeBox(cells, split, box.end));
+  }
+
+  std::vector<Pixel> palette;
+  for (const Box& box : boxes) {
+    uint64_t sum[3]= {0, 0, 0};
+    for (int k= box.begin; k < box.end; k++) {
+      for (int ch= 0; ch < 3; ch++) sum[ch]+= cells[k].sum[ch];
+    }
+    palette.push_back(meanColor((uint32_t) std::min<uint64_t>(box.count, UINT32_MAX), sum));
+  }
+  return palette;
+}
+
+static inline int distance2(const Pixel& a, const Pixel& b) {
+  int dr= a.r - b.r;
+  int dg= a.g - b.g;
+  int db= a.b - b.b;
+  return dr * dr + dg * dg + db * db;
+}
+
+IndexedImage mapToPalette(const Image& image, const std::vector<Pixel>& palette) {
+  assert(!palette.empty() && palette.size() <= 256);
+  IndexedImage result;
+  result.width= image.width();
+  result.height= image.height();
+  result.palette= palette;
+  result.indices.resize((size_t) image.pixelCount());
+  if (image.pixelCount() == 0) return result;
+
+  // palette entries by cell, as linked lists, for the exact matches
+  std::vector<short> firstEntry(CELLS, -1);
+  std::vector<short> nextEntry(palette.size(), -1);
+  for (int e= (int) palette.size() - 1; e >= 0; e--) {
+    nextEntry[e]= firstEntry[cellOf(palette[e])];
+    firstEntry[cellOf(palette[e])]= (short) e;
+  }
+
+  // nearest entry to the mean colour of every occupied cell
+  std::vector<CellBin> bins= cellHistogram(image);
+  std::vector<unsigned char> nearest(CELLS, 0);
+  parallelFor(CELLS, [&](int, int begin, int end) {
+    for (int k= begin; k < end; k++) {
+      if (bins[k].count == 0) continue;
+      Pixel mean= meanColor(bins[k].count, bins[k].sum);
+      int best= 0;
+      for (int e= 1; e < (int) palette.size(); e++) {
+        if (distance2(mean, palette[e]) < distance2(mean, palette[best])) best= e;
+      }
+      nearest[k]= (unsigned char) best;
+    }
+  }, 1024);
+
+  parallelFor(image.height(), [&](int, int begin, int end) {
+    for (int i= begin; i < end; i++) {
+      const Pixel* row= image.row(i);
+      unsigned char* dst= &result.indices[(size_t) i * image.width()];
+      for (int j= 0; j < image.width(); j++) {
+        int cell= cellOf(row[j]);
+        int index= nearest[cell];
+        for (int e= firstEntry[cell]; e >= 0; e= nextEntry[e]) {
+          if (palette[e].r == row[j].r && palette[e].g == row[j].g && palette[e].b == row[j].b) {
+            index= e;
+            break;
+          }
+        }
+        dst[j]= (unsigned char) index;
+      }
+    }
+  });
+
+  return result;
+}
+
+IndexedImage quantize(const Image& image, int colors) {
+  if (image.pixelCount() == 0) return IndexedImage{image.width(), image.height(), {}, {}};
+  return mapToPalette(image, medianCutPalette(image, colors));
+}
+
+Image IndexedImage::toImage() const {
+  Image result(this->width, this->height);
+  for (int i= 0; i < this->height; i++) {
+    Pixel* dst= result.row(i);
+    const unsigned char* src= &this->indices[(size_t) i * this->width];
+    for (int j= 0; j < this->width; j++) dst[j]= this->palette[src[j]];
+  }
+  return result;
+}
+
+bool IndexedImage::save(const std::string& filename) const {
+  return writeIndexedPng(filename, this->width, this->height, this->indices.data(), this->palette);
+}
+
+}  // namespace agl
@@ -0,0 +1,51 @@
+#ifndef AGL_QUANTIZE_H_
+#define AGL_QUANTIZE_H_
+
+#include <string>
+#include <vector>
+#include "image.h"
+
+namespace agl {
+
+/**
+ * @brief An image stored as indices into a palette of at most 256 colours
+ */
+struct IndexedImage {
+  int width;
+  int height;
+  std::vector<Pixel> palette;
+  std::vector<unsigned char> indices; // width * height, row by row
+
+  // The RGB image the indices stand for
+  Image toImage() const;
+
+  // Saves a palette PNG, see writeIndexedPng
+  bool save(const std::string& filename) const;
+};
+
+/**
+ * @brief Picks a palette of at most colors (1 to 256) entries for image
+ *
+ * An image with no more distinct colours than that gets exactly its own
+ * colours. Otherwise colours are binned to 5 bits per channel and the
+ * bins split by median cut: the box with the most pixels times its
+ * longest side is halved at its weighted median until there are colors
+ * boxes, and each entry is the mean of the pixels in its box.
+ */
+std::vector<Pixel> medianCutPalette(const Image& image, int colors = 256);
+
+/**
+ * @brief Maps every pixel of image to the nearest palette entry
+ *
+ * The nearest entry is searched once per 5-bit-per-channel cell that
+ * occurs in the image (for the mean colour of its pixels) and kept in a
+ * 32x32x32 lookup table, so mapping costs one lookup per pixel. Pixels
+ * that are themselves in the palette always map to it exactly.
+ */
+IndexedImage mapToPalette(const Image& image, const std::vector<Pixel>& palette);
+
+// mapToPalette(image, medianCutPalette(image, colors))
+IndexedImage quantize(const Image& image, int colors = 256);
+
+}  // namespace agl
+#endif  // AGL_QUANTIZE_H_
@@ -0,0 +1,50 @@
+#ifndef AGL_RANDOM_H_
+#define AGL_RANDOM_H_
+
+#include <cmath>
+#include <cstdint>
+
+namespace agl {
+
+/**
+ * Counter-based random numbers
+ *
+ * Instead of advancing a shared generator, each random value is a hash of
+ * (seed, a, b, c) where a, b, c are coordinates such as row, column and
+ * channel, or block row and block column. The same inputs always give the
+ * same value, so any tile of an effect can be computed on any thread, in
+ * any order, and still match a serial run with the same seed.
+ */
+
+// SplitMix64 finalizer: a fast bijective 64-bit mix
+inline uint64_t mix64(uint64_t z) {
+  z= (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z= (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Random 64-bit value for the counter (a, b, c) under the given seed
+inline uint64_t counterRandom(uint64_t seed, uint64_t a, uint64_t b, uint64_t c = 0) {
+  uint64_t key= mix64(seed + 0x9e3779b97f4a7c15ULL);
+  uint64_t z= mix64(key ^ (a * 0x9e3779b97f4a7c15ULL));
+  z= mix64(z ^ (b * 0xc2b2ae3d27d4eb4fULL));
+  return mix64(z ^ (c * 0x165667b19e3779f9ULL));
+}
+
+// Uniform float in [0, 1) for the counter (a, b, c)
+inline float counterUniform(uint64_t seed, uint64_t a, uint64_t b, uint64_t c = 0) {
+  // top 24 bits fill a float mantissa exactly
+  return (counterRandom(seed, a, b, c) >> 40) * (1.0f / 16777216.0f);
+}
+
+// Standard normal sample (mean 0, deviation 1) for the counter (a, b, c)
+inline float counterNormal(uint64_t seed, uint64_t a, uint64_t b, uint64_t c = 0) {
+  // Box-Muller on two 24-bit fields of one random value, bits 40-63 and 8-31
+  uint64_t bits= counterRandom(seed, a, b, c);
+  float u1= ((bits >> 40) + 1) * (1.0f / 16777217.0f); // (0, 1), avoids log(0)
+  float u2= ((bits >> 8) & 0xffffff) * (1.0f / 16777216.0f);
+  return std::sqrt(-2.0f * std::log(u1)) * std::cos(6.28318531f * u2);
+}
+
+}  // namespace agl
+#endif  // AGL_RANDOM_H_
@@ -0,0 +1,192 @@
+#include "result_cache.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace agl {
+
+static const uint64_t PRIME1= 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2= 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3= 0x165667B19E3779F9ULL;
+
+static inline uint64_t rotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t readWord(const unsigned char* bytes) {
+  uint64_t word;
+  memcpy(&word, bytes, sizeof(word));
+  return word;
+}
+
+static inline uint64_t mixLane(uint64_t lane, uint64_t word) {
+  return rotateLeft(lane + word * PRIME2, 31) * PRIME1;
+}
+
+ContentHasher::ContentHasher(): myPendingBytes(0), myLength(0) {
+  this->myLanes[0]= PRIME1 + PRIME2;
+  this->myLanes[1]= PRIME2;
+  this->myLanes[2]= 0;
+  this->myLanes[3]= 0 - PRIME1;
+}
+
+void ContentHasher::round(const unsigned char* block) {
+  for (int lane= 0; lane < 4; lane++) {
+    this->myLanes[lane]= mixLane(this->myLanes[lane], readWord(block + lane * 8));
+  }
+}
+
+void ContentHasher::update(const void* data, size_t bytes) {
+  const unsigned char* in= (const unsigned char*) data;
+  this->myLength+= bytes;
+
+  if (this->myPendingBytes > 0) {
+    size_t fill= std::min(bytes, sizeof(this->myPending) - this->myPendingBytes);
+    memcpy(this->myPending + this->myPendingBytes, in, fill);
+    this->myPendingBytes+= fill;
+    in+= fill;
+    bytes-= fill;
+    if (this->myPendingBytes < sizeof(this->myPending)) return;
+    this->round(this->myPending);
+    this->myPendingBytes= 0;
+  }
+
+  for (; bytes >= 32; in+= 32, bytes-= 32) {
+    this->round(in);
+  }
+  memcpy(this->myPending, in, bytes);
+  this->myPendingBytes= bytes;
+}
+
+uint64_t ContentHasher::digest() const {
+  uint64_t hash= rotateLeft(this->myLanes[0], 1) + rotateLeft(this->myLanes[1], 7) +
+    rotateLeft(this->myLanes[2], 12) + rotateLeft(this->myLanes[3], 18);
+  for (int lane= 0; lane < 4; lane++) {
+    hash= (hash ^ mixLane(0, this->myLanes[lane])) * PRIME1 + PRIME3;
+  }
+  hash+= this->myLength;
+
+  size_t i= 0;
+  for (; i + 8 <= this->myPendingBytes; i+= 8) {
+    hash= rotateLeft(hash ^ mixLane(0, readWord(this->myPending + i)), 27) * PRIME1 + PRIME3;
+  }
+  for (; i < this->myPendingBytes; i++) {
+    hash= rotateLeft(hash ^ (this->myPending[i] * PRIME3), 11) * PRIME1;
+  }
+
+  // final avalanche so every input bit reaches every output bit
+  hash^= hash >> 33;
+  hash*= PRIME2;
+  hash^= hash >> 29;
+  hash*= PRIME3;
+  hash^= hash >> 32;
+  return hash;
+}
+
+uint64_t contentHash(const Image& image) {
+  ContentHasher hasher;
+  int size[2]= {image.width(), image.height()};
+  hasher.update(size, sizeof(size));
+
+  // row by row, the padding after each row is not part of the image
+  for (int i= 0; i < image.height(); i++) {
+    hasher.update(image.rowData(i), (size_t) image.width() * 3);
+  }
+  return hasher.digest();
+}
+
+ResultCache::ResultCache(size_t budget): myBudget(budget), myBytes(0), myHits(0),
+  myMisses(0), myInserted(0), myEvicted(0) {
+}
+
+std::shared_ptr<const Image> ResultCache::find(uint64_t source, const std::string& operation) {
+  std::lock_guard<std::mutex> lock(this->myMutex);
+  auto found= this->myEntries.find(Key(source, operation));
+  if (found == this->myEntries.end()) {
+    this->myMisses++;
+    return nullptr;
+  }
+
+  this->myOrder.splice(this->myOrder.begin(), this->myOrder, found->second.position);
+  this->myHits++;
+  return found->second.image;
+}
+
+void ResultCache::insert(uint64_t source, const std::string& operation,
+  std::shared_ptr<const Image> result) {
+  std::lock_guard<std::mutex> lock(this->myMutex);
+  Key key(source, operation);
+  auto found= this->myEntries.find(key);
+  if (found != this->myEntries.end()) this->remove(found);
+  if (!result || result->bytes() > this->myBudget) return;
+
+  this->myOrder.push_front(key);
+  this->myBytes+= result->bytes();
+  this->myEntries[key]= Entry{std::move(result), this->myOrder.begin()};
+  this->myInserted++;
+  this->shrinkTo(this->myBudget);
+}
+
+void ResultCache::remove(std::map<Key, Entry>::iterator entry) {
+  this->myBytes-= entry->second.image->bytes();
+  this->myOrder.erase(entry->second.position);
+  this->myEntries.erase(entry);
+}
+
+void ResultCache::shrinkTo(size_t bytes) {
+  while (this->myBytes > bytes) {
+    this->remove(this->myEntries.find(this->myOrder.back()));
+    this->myEvicted++;
+  }
+}
+
+void ResultCache::setBudget(size_t bytes) {
+  std::lock_guard<std::mutex> lock(this->myMutex);
+  this->myBudget= bytes;
+  this->shrinkTo(bytes);
+}
+
+size_t ResultCache::budget() const {
+  std::lock_guard<std::mutex> lock(this->myMutex);
+  return this->myBudget;
+}
+
+void ResultCache::clear() {
+  std::lock_guard<std::mutex> lock(this->myMutex);
+  this->myEntries.clear();
+  this->myOrder.clear();
+  this->myBytes= 0;
+}
+
+ResultCacheStats ResultCache::stats() const {
+  std::lock_guard<std::mutex> lock(this->myMutex);
+  ResultCacheStats stats;
+  stats.hits= this->myHits;
+  stats.misses= this->myMisses;
+  stats.inserted= this->myInserted;
+  stats.evicted= this->myEvicted;
+  stats.bytes= this->myBytes;
+  stats.entries= this->myEntries.size();
+  return stats;
+}
+
+void ResultCache::resetStats() {
+  std::lock_guard<std::mutex> lock(this->myMutex);
+  this->myHits= 0;
+  this->myMisses= 0;
+  this->myInserted= 0;
+  this->myEvicted= 0;
+}
+
+ResultCache& ResultCache::shared() {
+  static ResultCache* cache= []() {
+    size_t budget= (size_t) 64 << 20;
+    const char* env= std::getenv("PIXMAP_RESULT_CACHE_BYTES");
+    if (env != nullptr && *env != '\0') budget= std::strtoull(env, nullptr, 10);
+    return new ResultCache(budget);
+  }();
+
+  return *cache;
+}
+
+}  // namespace agl
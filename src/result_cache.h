@@ -0,0 +1,144 @@
+#ifndef AGL_RESULT_CACHE_H_
+#define AGL_RESULT_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include "image.h"
+
+namespace agl {
+
+/**
+ * @brief Streaming 64-bit hash of a byte sequence
+ *
+ * Data can be fed in pieces of any size; the digest only depends on the
+ * bytes, not on how they were split. Four independent multiply-rotate
+ * lanes take 32 bytes per round, so it runs near memory bandwidth. Not
+ * cryptographic.
+ */
+class ContentHasher {
+ public:
+  ContentHasher();
+
+  void update(const void* data, size_t bytes);
+
+  // Hash of everything fed so far; more can be added afterwards
+  uint64_t digest() const;
+
+ private:
+  void round(const unsigned char* block);
+
+  uint64_t myLanes[4];
+  unsigned char myPending[32];  // bytes of an unfinished round
+  size_t myPendingBytes;
+  uint64_t myLength;
+};
+
+// Hash of the size and pixels of image; equal images (operator==) hash equal
+uint64_t contentHash(const Image& image);
+
+/**
+ * @brief Counters of a ResultCache since it was made (or last reset)
+ */
+struct ResultCacheStats {
+  size_t hits;
+  size_t misses;
+  size_t inserted;
+  size_t evicted;
+  size_t bytes;    // held by the cached results now (not reset)
+  size_t entries;
+};
+
+/**
+ * @brief Least recently used cache of operation results
+ *
+ * A result is keyed by the contentHash() of its source and a string naming
+ * the operation with all of its parameters (e.g. "gaussianBlur(4)"), which
+ * must also identify any other image it reads. Once the results take more
+ * than the budget the least recently used are dropped. Results are shared,
+ * so one that is still in use survives being evicted. Safe to use from
+ * several threads.
+ */
+class ResultCache {
+ public:
+  explicit ResultCache(size_t budget);
+
+  ResultCache(const ResultCache&) = delete;
+  ResultCache& operator=(const ResultCache&) = delete;
+
+  // nullptr if there is no result for this source and operation
+  std::shared_ptr<const Image> find(uint64_t source, const std::string& operation);
+
+  // Replaces any earlier result; results larger than the budget are not kept
+  void insert(uint64_t source, const std::string& operation, std::shared_ptr<const Image> result);
+
+  // Lowering the budget evicts until the cache fits; 0 turns caching off
+  void setBudget(size_t bytes);
+  size_t budget() const;
+
+  void clear();
+
+  ResultCacheStats stats() const;
+  void resetStats();
+
+  /**
+   * @brief The cache memoize() uses by default
+   *
+   * Its budget is 64 MB unless the PIXMAP_RESULT_CACHE_BYTES environment
+   * variable gives another (0 disables it). It is never destroyed.
+   */
+  static ResultCache& shared();
+
+ private:
+  typedef std::pair<uint64_t, std::string> Key;
+  struct Entry {
+    std::shared_ptr<const Image> image;
+    std::list<Key>::iterator position;
+  };
+
+  // drops least recently used results until at most bytes are held
+  void shrinkTo(size_t bytes);
+  void remove(std::map<Key, Entry>::iterator entry);
+
+  mutable std::mutex myMutex;
+  std::map<Key, Entry> myEntries;
+  std::list<Key> myOrder;  // most recently used first
+  size_t myBudget;
+  size_t myBytes;
+  size_t myHits;
+  size_t myMisses;
+  size_t myInserted;
+  size_t myEvicted;
+};
+
+/**
+ * @brief Returns compute(source), or the result cached for it
+ *
+ *   Image edges= memoize(image, "gaussianBlur(2).sobel", [](const Image& in) {
+ *     return in.gaussianBlur(2).sobel();
+ *   });
+ *
+ * operation must name everything compute depends on besides source.
+ * Hashing the source costs a pass over its pixels, far less than any
+ * filter; callers that reuse a source can hash it once and call the
+ * cache directly.
+ */
+template <class Compute>
+Image memoize(const Image& source, const std::string& operation, Compute compute,
+  ResultCache& cache = ResultCache::shared()) {
+  uint64_t hash= contentHash(source);
+  std::shared_ptr<const Image> found= cache.find(hash, operation);
+  if (found) return *found;
+
+  Image result= compute(source);
+  cache.insert(hash, operation, std::make_shared<const Image>(result));
+  return result;
+}
+
+}  // namespace agl
+#endif  // AGL_RESULT_CACHE_H_
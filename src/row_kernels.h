@@ -0,0 +1,35 @@
+#ifndef AGL_ROW_KERNELS_H_
+#define AGL_ROW_KERNELS_H_
+
+namespace agl {
+
+/**
+ * Row kernels shared by the whole-image operations (image.cpp) and the
+ * streaming stages (row_stream.cpp), so both paths produce identical
+ * pixels. Rows are packed RGB, width * 3 bytes.
+ */
+
+/**
+ * @brief Convolve one output row
+ * @param rows sideLength row pointers for rows y - sideLength/2 and
+ *   onwards, already clamped to the image
+ * @param out Receives width * 3 bytes
+ *
+ * Columns are clamped at the borders, as in Image::convolute
+ */
+void convolveRow(const unsigned char* const* rows, int width, const int* kernel,
+  float kernelScale, int sideLength, unsigned char* out);
+
+/**
+ * @brief Fused Sobel kernel for one output row
+ * @param up, mid, down The rows above, at and below (clamped)
+ *
+ * Writes whichever of magnitude, orientation, gx, gy are not nullptr,
+ * each width * 3 values
+ */
+void sobelRow(const unsigned char* up, const unsigned char* mid,
+  const unsigned char* down, int width, unsigned char* magnitude,
+  unsigned char* orientation, short* gx, short* gy);
+
+}  // namespace agl
+#endif  // AGL_ROW_KERNELS_H_
@@ -0,0 +1,275 @@
+/**
+ * Scanline streaming
+ *
+ * Stages pull rows from their upstream stage on demand, so a filter chain
+ * runs from a row-incremental decoder to a row-incremental encoder
+ * without ever holding a whole frame.
+ */
+
+#include "row_stream.h"
+#include "row_kernels.h"
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <climits>
+#include <cstring>
+
+#define NUM_CHANNELS 3
+
+namespace agl {
+
+ImageRowSource::ImageRowSource(const Image& image): myImage(image) {
+}
+
+int ImageRowSource::width() const {
+  return this->myImage.width();
+}
+
+int ImageRowSource::height() const {
+  return this->myImage.height();
+}
+
+const unsigned char* ImageRowSource::row(int y) {
+  assert(y >= 0 && y < this->myImage.height());
+  return this->myImage.rowData(y);
+}
+
+// Larger header values are rejected, so that width * 3 cannot overflow
+static const long long PPM_MAX_HEADER_VALUE= 1LL << 48;
+
+// Reads one P6 header field, skipping whitespace and # comments
+static bool readPPMHeaderValue(FILE* file, long long& value) {
+  int c= fgetc(file);
+  while (c == '#' || isspace(c)) {
+    if (c == '#') {
+      while (c != '\n' && c != EOF) c= fgetc(file);
+    }
+    c= fgetc(file);
+  }
+  if (!isdigit(c)) return false;
+
+  value= 0;
+  while (isdigit(c)) {
+    value= value * 10 + (c - '0');
+    if (value > PPM_MAX_HEADER_VALUE) return false;
+    c= fgetc(file);
+  }
+  // c was the single whitespace character that ends the field
+  return true;
+}
+
+PPMRowReader::PPMRowReader(): myFile(nullptr), myWidth(0), myHeight(0), myGood(false) {
+}
+
+PPMRowReader::~PPMRowReader() {
+  this->close();
+}
+
+bool PPMRowReader::open(const std::string& filename) {
+  this->close();
+  this->myFile= fopen(filename.c_str(), "rb");
+  if (this->myFile == nullptr) return false;
+
+  char magic[2]= {0, 0};
+  long long width, height, maxValue;
+  this->myGood= fread(magic, 1, 2, this->myFile) == 2 && magic[0] == 'P' && magic[1] == '6' &&
+    readPPMHeaderValue(this->myFile, width) && readPPMHeaderValue(this->myFile, height) &&
+    readPPMHeaderValue(this->myFile, maxValue) && maxValue == 255 && width > 0 && height > 0;
+
+  if (!this->myGood) {
+    this->close();
+    return false;
+  }
+  this->myWidth= width;
+  this->myHeight= height;
+  // the row buffer is allocated by the first read, after the caller has
+  // had a chance to reject the dimensions
+  this->myRow.clear();
+
+  return true;
+}
+
+void PPMRowReader::close() {
+  if (this->myFile != nullptr) fclose(this->myFile);
+  this->myFile= nullptr;
+}
+
+bool PPMRowReader::good() const {
+  return this->myGood;
+}
+
+int64_t PPMRowReader::fileWidth() const {
+  return this->myWidth;
+}
+
+int64_t PPMRowReader::fileHeight() const {
+  return this->myHeight;
+}
+
+int PPMRowReader::width() const {
+  assert(this->myWidth * NUM_CHANNELS <= INT_MAX);
+  return (int) this->myWidth;
+}
+
+int PPMRowReader::height() const {
+  assert(this->myHeight <= INT_MAX);
+  return (int) this->myHeight;
+}
+
+const unsigned char* PPMRowReader::row(int y) {
+  assert(y >= 0 && y < this->height());
+  return this->nextRow();
+}
+
+const unsigned char* PPMRowReader::nextRow() {
+  this->myRow.resize((size_t) this->myWidth * NUM_CHANNELS);
+  // rows arrive in file order; a short read leaves the row black
+  if (this->myFile == nullptr ||
+      fread(this->myRow.data(), 1, this->myRow.size(), this->myFile) != this->myRow.size()) {
+    std::memset(this->myRow.data(), 0, this->myRow.size());
+    this->myGood= false;
+  }
+
+  return this->myRow.data();
+}
+
+PPMRowWriter::PPMRowWriter(): myFile(nullptr), myRowBytes(0), myGood(false) {
+}
+
+PPMRowWriter::~PPMRowWriter() {
+  this->close();
+}
+
+bool PPMRowWriter::open(const std::string& filename, long long width, long long height) {
+  this->close();
+  this->myFile= fopen(filename.c_str(), "wb");
+  if (this->myFile == nullptr) return false;
+
+  this->myRowBytes= width * NUM_CHANNELS;
+  this->myGood= fprintf(this->myFile, "P6\n%lld %lld\n255\n", width, height) > 0;
+
+  return this->myGood;
+}
+
+bool PPMRowWriter::writeRow(const unsigned char* row) {
+  if (this->myFile == nullptr) return false;
+  if (fwrite(row, 1, this->myRowBytes, this->myFile) != (size_t) this->myRowBytes) {
+    this->myGood= false;
+  }
+
+  return this->myGood;
+}
+
+bool PPMRowWriter::close() {
+  if (this->myFile == nullptr) return false;
+  bool success= fclose(this->myFile) == 0 && this->myGood;
+  this->myFile= nullptr;
+
+  return success;
+}
+
+WindowStage::WindowStage(RowSource& upstream, int radius): myUpstream(upstream),
+  myRadius(radius), myFetched(0) {
+  size_t rowBytes= (size_t) upstream.width() * NUM_CHANNELS;
+  this->myOutput.resize(rowBytes);
+  this->myRing.resize((2 * radius + 1) * rowBytes);
+  this->myWindow.resize(2 * radius + 1);
+}
+
+int WindowStage::width() const {
+  return this->myUpstream.width();
+}
+
+int WindowStage::height() const {
+  return this->myUpstream.height();
+}
+
+const unsigned char* const* WindowStage::window(int y) {
+  int ringRows= 2 * this->myRadius + 1;
+  size_t rowBytes= this->myOutput.size();
+  int lastRow= this->height() - 1;
+
+  // pull until row y + radius is in the ring; the ring is just large
+  // enough that row y - radius has not been overwritten yet
+  while (this->myFetched <= std::min(y + this->myRadius, lastRow)) {
+    std::memcpy(this->myRing.data() + (this->myFetched % ringRows) * rowBytes,
+      this->myUpstream.row(this->myFetched), rowBytes);
+    this->myFetched++;
+  }
+
+  for (int k= 0; k < ringRows; k++) {
+    int source= std::min(std::max(y - this->myRadius + k, 0), lastRow);
+    assert(source < this->myFetched && source > this->myFetched - 1 - ringRows);
+    this->myWindow[k]= this->myRing.data() + (source % ringRows) * rowBytes;
+  }
+
+  return this->myWindow.data();
+}
+
+ConvolveStage::ConvolveStage(RowSource& upstream, const int* kernel, float kernelScale,
+  int sideLength): WindowStage(upstream, sideLength / 2),
+  myKernel(kernel, kernel + sideLength * sideLength), myScale(kernelScale),
+  mySideLength(sideLength) {
+  // an even side length has one more row below than above
+  assert(sideLength % 2 == 1);
+}
+
+const unsigned char* ConvolveStage::row(int y) {
+  convolveRow(this->window(y), this->width(), this->myKernel.data(), this->myScale,
+    this->mySideLength, this->myOutput.data());
+
+  return this->myOutput.data();
+}
+
+SobelStage::SobelStage(RowSource& upstream): WindowStage(upstream, 1) {
+}
+
+const unsigned char* SobelStage::row(int y) {
+  const unsigned char* const* rows= this->window(y);
+  sobelRow(rows[0], rows[1], rows[2], this->width(), this->myOutput.data(),
+    nullptr, nullptr, nullptr);
+
+  return this->myOutput.data();
+}
+
+RowMapStage::RowMapStage(RowSource& upstream,
+  const std::function<void(const unsigned char*, unsigned char*, int)>& fn):
+  myUpstream(upstream), myFn(fn), myOutput((size_t) upstream.width() * NUM_CHANNELS) {
+}
+
+int RowMapStage::width() const {
+  return this->myUpstream.width();
+}
+
+int RowMapStage::height() const {
+  return this->myUpstream.height();
+}
+
+const unsigned char* RowMapStage::row(int y) {
+  this->myFn(this->myUpstream.row(y), this->myOutput.data(), this->width());
+  return this->myOutput.data();
+}
+
+bool writePPM(RowSource& source, const std::string& filename) {
+  PPMRowWriter writer;
+  if (!writer.open(filename, source.width(), source.height())) return false;
+
+  for (int y= 0; y < source.height(); y++) {
+    if (!writer.writeRow(source.row(y))) break;
+  }
+
+  return writer.close();
+}
+
+Image toImage(RowSource& source) {
+  Image result(source.width(), source.height());
+  size_t rowBytes= (size_t) source.width() * NUM_CHANNELS;
+
+  for (int y= 0; y < source.height(); y++) {
+    std::memcpy(result.rowData(y), source.row(y), rowBytes);
+  }
+
+  return result;
+}
+
+}  // namespace agl
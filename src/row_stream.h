@@ -0,0 +1,174 @@
+#ifndef AGL_ROW_STREAM_H_
+#define AGL_ROW_STREAM_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include "image.h"
+
+namespace agl {
+
+/**
+ * @brief Pull-based source of image rows for scanline streaming
+ *
+ * A filter chain is a list of stages, each pulling rows from the one
+ * before it, e.g.
+ *
+ *   PPMRowReader input;           input.open("scan.ppm");
+ *   ConvolveStage blur(input, gaussianKernel, 1.0f / 16, 3);
+ *   SobelStage edges(blur);
+ *   RowMapStage mask(edges, ...);
+ *   writePPM(mask, "edges.ppm");
+ *
+ * Rows must be requested in order 0, 1, ..., height - 1, each once. The
+ * returned pointer holds width * 3 packed RGB bytes and stays valid until
+ * the next call to row(). Stages only keep the rows their kernel needs, so
+ * peak memory is a few rows per stage rather than whole images.
+ */
+class RowSource {
+ public:
+  virtual ~RowSource() {}
+  virtual int width() const = 0;
+  virtual int height() const = 0;
+  virtual const unsigned char* row(int y) = 0;
+};
+
+// Streams the rows of an in-memory image
+class ImageRowSource : public RowSource {
+ public:
+  explicit ImageRowSource(const Image& image);
+  int width() const override;
+  int height() const override;
+  const unsigned char* row(int y) override;
+
+ private:
+  const Image& myImage;
+};
+
+/**
+ * @brief Row-incremental binary PPM (P6) decoder
+ *
+ * Header dimensions are 64-bit, so files larger than a RowSource can
+ * describe (e.g. for TiledImage) are read with fileWidth(), fileHeight()
+ * and nextRow(); width() and height() require both to fit in an int.
+ */
+class PPMRowReader : public RowSource {
+ public:
+  PPMRowReader();
+  virtual ~PPMRowReader();
+
+  // Opens the file and reads its header
+  bool open(const std::string& filename);
+  void close();
+
+  // False once a row could not be read (e.g. truncated file)
+  bool good() const;
+
+  int64_t fileWidth() const;
+  int64_t fileHeight() const;
+
+  // Reads the next row of the file, fileWidth() * 3 bytes
+  const unsigned char* nextRow();
+
+  int width() const override;
+  int height() const override;
+  const unsigned char* row(int y) override;
+
+ private:
+  FILE* myFile;
+  int64_t myWidth;
+  int64_t myHeight;
+  bool myGood;
+  std::vector<unsigned char> myRow;
+};
+
+// Row-incremental binary PPM (P6) encoder
+class PPMRowWriter {
+ public:
+  PPMRowWriter();
+  virtual ~PPMRowWriter();
+
+  // Creates the file and writes the header
+  bool open(const std::string& filename, long long width, long long height);
+
+  // Appends the next row of width * 3 bytes
+  bool writeRow(const unsigned char* row);
+
+  // Flushes and closes the file, returns false if anything failed
+  bool close();
+
+ private:
+  FILE* myFile;
+  long long myRowBytes;
+  bool myGood;
+};
+
+/**
+ * @brief Base for stages that need a window of upstream rows
+ *
+ * Keeps a ring buffer of 2 * radius + 1 rows copied from upstream
+ */
+class WindowStage : public RowSource {
+ public:
+  WindowStage(RowSource& upstream, int radius);
+  int width() const override;
+  int height() const override;
+
+ protected:
+  // Returns pointers to rows y - radius ... y + radius, clamped to the image
+  const unsigned char* const* window(int y);
+
+  RowSource& myUpstream;
+  std::vector<unsigned char> myOutput; // one output row
+
+ private:
+  int myRadius;
+  int myFetched; // next upstream row to pull
+  std::vector<unsigned char> myRing;
+  std::vector<const unsigned char*> myWindow;
+};
+
+// Streaming Image::convolute
+class ConvolveStage : public WindowStage {
+ public:
+  ConvolveStage(RowSource& upstream, const int* kernel, float kernelScale, int sideLength);
+  const unsigned char* row(int y) override;
+
+ private:
+  std::vector<int> myKernel;
+  float myScale;
+  int mySideLength;
+};
+
+// Streaming Image::sobel (gradient magnitude)
+class SobelStage : public WindowStage {
+ public:
+  explicit SobelStage(RowSource& upstream);
+  const unsigned char* row(int y) override;
+};
+
+// Streaming per-pixel operation: fn(in, out, width) maps one row to another
+class RowMapStage : public RowSource {
+ public:
+  RowMapStage(RowSource& upstream,
+    const std::function<void(const unsigned char*, unsigned char*, int)>& fn);
+  int width() const override;
+  int height() const override;
+  const unsigned char* row(int y) override;
+
+ private:
+  RowSource& myUpstream;
+  std::function<void(const unsigned char*, unsigned char*, int)> myFn;
+  std::vector<unsigned char> myOutput;
+};
+
+// Drains source into a binary PPM file
+bool writePPM(RowSource& source, const std::string& filename);
+
+// Drains source into an in-memory image
+Image toImage(RowSource& source);
+
+}  // namespace agl
+#endif  // AGL_ROW_STREAM_H_
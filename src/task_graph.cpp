@@ -0,0 +1,245 @@
+/**
+ * Work-stealing task graph for Image operations
+ */
+
+#include "task_graph.h"
+#include "parallel.h"
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace agl {
+
+struct TaskGraph::Node {
+  Operation op;
+  std::vector<int> inputs;
+  std::vector<int> consumers;
+  Image image;
+  bool kept;
+  bool done;
+  bool freed;                        // image was dropped after its last consumer
+  std::atomic<int> pendingInputs;    // inputs that have not finished yet
+  std::atomic<int> pendingConsumers; // consumers that still need image
+};
+
+struct TaskGraph::Scheduler {
+  // one deque per worker: the owner pushes and pops at the back,
+  // thieves take from the front
+  struct Queue {
+    std::mutex mutex;
+    std::deque<int> nodes;
+  };
+
+  explicit Scheduler(int workers): queues(workers), queued(0), remaining(0) {
+  }
+
+  void push(int worker, int node) {
+    {
+      std::lock_guard<std::mutex> lock(this->queues[worker].mutex);
+      this->queues[worker].nodes.push_back(node);
+    }
+    {
+      // counted under the sleep mutex so a worker going to sleep cannot
+      // miss it
+      std::lock_guard<std::mutex> lock(this->sleepMutex);
+      this->queued++;
+    }
+    this->wakeup.notify_one();
+  }
+
+  bool pop(int worker, int& node) {
+    Queue& queue= this->queues[worker];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.nodes.empty()) return false;
+    node= queue.nodes.back();
+    queue.nodes.pop_back();
+    this->queued--;
+
+    return true;
+  }
+
+  bool steal(int worker, int& node) {
+    int count= (int) this->queues.size();
+    for (int i= 1; i < count; i++) {
+      Queue& victim= this->queues[(worker + i) % count];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (victim.nodes.empty()) continue;
+      node= victim.nodes.front();
+      victim.nodes.pop_front();
+      this->queued--;
+
+      return true;
+    }
+    return false;
+  }
+
+  std::vector<Queue> queues;
+  std::mutex sleepMutex;
+  std::condition_variable wakeup;
+  std::atomic<int> queued;
+  std::atomic<int> remaining;
+};
+
+TaskGraph::TaskGraph() {
+}
+
+TaskGraph::~TaskGraph() {
+}
+
+int TaskGraph::addImage(Image image) {
+  std::unique_ptr<Node> node(new Node());
+  node->image= std::move(image);
+  node->kept= false;
+  node->done= true;
+  node->freed= false;
+  node->pendingInputs= 0;
+  node->pendingConsumers= 0;
+  this->myNodes.push_back(std::move(node));
+
+  return (int) this->myNodes.size() - 1;
+}
+
+int TaskGraph::addNode(int input, const UnaryOperation& op) {
+  return this->addNode(std::vector<int>{input},
+    [op](const std::vector<const Image*>& inputs) { return op(*inputs[0]); });
+}
+
+int TaskGraph::addNode(const std::vector<int>& inputs, const Operation& op) {
+  int id= (int) this->myNodes.size();
+  std::unique_ptr<Node> node(new Node());
+  node->op= op;
+  node->inputs= inputs;
+  node->kept= false;
+  node->done= false;
+  node->freed= false;
+  node->pendingInputs= 0;
+  node->pendingConsumers= 0;
+
+  for (int input : inputs) {
+    assert(input >= 0 && input < id);
+    this->myNodes[input]->consumers.push_back(id);
+  }
+  this->myNodes.push_back(std::move(node));
+
+  return id;
+}
+
+void TaskGraph::keep(int node) {
+  assert(node >= 0 && node < this->size());
+  this->myNodes[node]->kept= true;
+}
+
+int TaskGraph::size() const {
+  return (int) this->myNodes.size();
+}
+
+const Image& TaskGraph::result(int node) const {
+  assert(node >= 0 && node < this->size());
+  assert(this->myNodes[node]->done);
+  return this->myNodes[node]->image;
+}
+
+Image TaskGraph::take(int node) {
+  assert(node >= 0 && node < this->size());
+  assert(this->myNodes[node]->done);
+  return std::move(this->myNodes[node]->image);
+}
+
+void TaskGraph::finish(int node, Scheduler& scheduler, int worker) {
+  Node& finished= *this->myNodes[node];
+
+  // consumers whose last input this was are ready; they go on this
+  // worker's own deque since their inputs are hot in its cache
+  for (int consumer : finished.consumers) {
+    Node& next= *this->myNodes[consumer];
+    if (--next.pendingInputs == 0) scheduler.push(worker, consumer);
+  }
+
+  // drop inputs nobody needs anymore
+  for (int input : finished.inputs) {
+    Node& source= *this->myNodes[input];
+    if (--source.pendingConsumers == 0 && !source.kept) {
+      source.image= Image();
+      source.freed= true;
+    }
+  }
+
+  if (--scheduler.remaining == 0) {
+    std::lock_guard<std::mutex> lock(scheduler.sleepMutex);
+    scheduler.wakeup.notify_all();
+  }
+}
+
+bool TaskGraph::run(int threads) {
+  // an earlier run may have freed what new nodes read
+  for (const std::unique_ptr<Node>& node : this->myNodes) {
+    if (node->done) continue;
+    for (int input : node->inputs) {
+      if (this->myNodes[input]->freed) return false;
+    }
+  }
+
+  int workers= threads > 0 ? threads : threadCount();
+  Scheduler scheduler(workers);
+
+  // count what each pending node waits for and who still reads each result
+  std::vector<int> pending;
+  for (int id= 0; id < this->size(); id++) {
+    Node& node= *this->myNodes[id];
+    int consumers= 0;
+    for (int consumer : node.consumers) {
+      if (!this->myNodes[consumer]->done) consumers++;
+    }
+    node.pendingConsumers= consumers;
+    if (node.done) continue;
+
+    int inputs= 0;
+    for (int input : node.inputs) {
+      if (!this->myNodes[input]->done) inputs++;
+    }
+    node.pendingInputs= inputs;
+    pending.push_back(id);
+  }
+
+  scheduler.remaining= (int) pending.size();
+  int next= 0;
+  for (int id : pending) {
+    if (this->myNodes[id]->pendingInputs == 0) scheduler.push(next++ % workers, id);
+  }
+
+  auto work= [&](int worker) {
+    // the graph already fills the cores, so operations run serially inside
+    SerialRegion serial;
+    while (true) {
+      int id;
+      if (scheduler.pop(worker, id) || scheduler.steal(worker, id)) {
+        Node& node= *this->myNodes[id];
+        std::vector<const Image*> inputs;
+        for (int input : node.inputs) inputs.push_back(&this->myNodes[input]->image);
+
+        node.image= node.op(inputs);
+        node.done= true;
+        this->finish(id, scheduler, worker);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(scheduler.sleepMutex);
+      scheduler.wakeup.wait(lock, [&]() {
+        return scheduler.queued > 0 || scheduler.remaining == 0;
+      });
+      if (scheduler.remaining == 0) return;
+    }
+  };
+
+  std::vector<std::thread> helpers;
+  for (int worker= 1; worker < workers; worker++) helpers.emplace_back(work, worker);
+  work(0);
+  for (std::thread& helper : helpers) helper.join();
+
+  return true;
+}
+
+}  // namespace agl
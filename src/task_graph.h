@@ -0,0 +1,79 @@
+#ifndef AGL_TASK_GRAPH_H_
+#define AGL_TASK_GRAPH_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "image.h"
+
+namespace agl {
+
+/**
+ * @brief Dependency graph of Image operations run by a work-stealing scheduler
+ *
+ * Each node is an operation on the results of its input nodes. Nodes whose
+ * inputs are ready run concurrently; every worker thread has its own deque
+ * of ready nodes and steals from the others when it runs dry. A node's
+ * result is freed as soon as its last consumer has finished, unless it was
+ * marked with keep().
+ *
+ *   TaskGraph graph;
+ *   int source= graph.addImage(image);
+ *   int blur= graph.addNode(source, [](const Image& in) { return in.gaussianBlur(); });
+ *   int edges= graph.addNode(blur, [](const Image& in) { return in.sobel(); });
+ *   graph.keep(edges);
+ *   graph.run();
+ *   graph.result(edges).save("edges.png");
+ */
+class TaskGraph {
+ public:
+  typedef std::function<Image(const Image&)> UnaryOperation;
+  typedef std::function<Image(const std::vector<const Image*>&)> Operation;
+
+  TaskGraph();
+  virtual ~TaskGraph();
+
+  TaskGraph(const TaskGraph&) = delete;
+  TaskGraph& operator=(const TaskGraph&) = delete;
+
+  // Adds a node that already holds an image, returns its id
+  int addImage(Image image);
+
+  // Adds a node computing op from one input node, returns its id
+  int addNode(int input, const UnaryOperation& op);
+
+  // Adds a node computing op from its input nodes (passed in the same order)
+  int addNode(const std::vector<int>& inputs, const Operation& op);
+
+  // Keeps the node's result after run() instead of freeing it
+  void keep(int node);
+
+  /**
+   * @brief Runs every node that has not run yet
+   * @param threads Worker count, 0 for threadCount()
+   * @return false, without running anything, if a node added since the
+   * last run reads a result that run freed; keep() such inputs instead
+   */
+  bool run(int threads = 0);
+
+  // Result of a node marked with keep(), valid after run()
+  const Image& result(int node) const;
+
+  // Moves a kept result out of the graph
+  Image take(int node);
+
+  // Number of nodes in the graph
+  int size() const;
+
+ private:
+  struct Node;
+  struct Scheduler;
+
+  void finish(int node, Scheduler& scheduler, int worker);
+
+  std::vector<std::unique_ptr<Node>> myNodes;
+};
+
+}  // namespace agl
+#endif  // AGL_TASK_GRAPH_H_
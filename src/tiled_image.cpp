@@ -0,0 +1,343 @@
+/**
+ * Out-of-core tiled images
+ *
+ * Pixel data lives in a scratch file mapped into the address space, so the
+ * image can be much larger than physical memory: the OS keeps the tiles
+ * that are being touched resident and writes the others back to the file.
+ */
+
+#include "tiled_image.h"
+#include "parallel.h"
+#include "row_stream.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define NUM_CHANNELS 3
+
+namespace agl {
+
+static int64_t clamp64(int64_t value, int64_t low, int64_t hi) {
+  return std::min(std::max(value, low), hi);
+}
+
+TiledImage::TiledImage(): myWidth(0), myHeight(0), myTileSize(0),
+  myTilesAcross(0), myTilesDown(0), myMappedBytes(0), myData(nullptr) {
+#ifdef _WIN32
+  this->myFile= nullptr;
+  this->myMapping= nullptr;
+#else
+  this->myFile= -1;
+#endif
+}
+
+TiledImage::~TiledImage() {
+  this->release();
+}
+
+void TiledImage::release() {
+#ifdef _WIN32
+  if (this->myData != nullptr) UnmapViewOfFile(this->myData);
+  if (this->myMapping != nullptr) CloseHandle((HANDLE) this->myMapping);
+  // the file was opened with FILE_FLAG_DELETE_ON_CLOSE
+  if (this->myFile != nullptr) CloseHandle((HANDLE) this->myFile);
+  this->myMapping= nullptr;
+  this->myFile= nullptr;
+#else
+  if (this->myData != nullptr) munmap(this->myData, this->myMappedBytes);
+  // the file was unlinked right after it was created
+  if (this->myFile >= 0) close(this->myFile);
+  this->myFile= -1;
+#endif
+  this->myData= nullptr;
+  this->myMappedBytes= 0;
+  this->myWidth= 0;
+  this->myHeight= 0;
+}
+
+bool TiledImage::create(int64_t width, int64_t height, int tileSize,
+  const std::string& scratchDir) {
+  this->release();
+  if (width <= 0 || height <= 0 || tileSize <= 0) return false;
+
+  int64_t tilesAcross= (width + tileSize - 1) / tileSize;
+  int64_t tilesDown= (height + tileSize - 1) / tileSize;
+  int64_t bytes= tilesAcross * tilesDown * tileSize * tileSize * NUM_CHANNELS;
+
+  std::string dir= scratchDir;
+  if (dir.empty()) {
+    const char* tmp= std::getenv("TMPDIR");
+#ifdef _WIN32
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    dir= (tmp != nullptr) ? tmp : tempPath;
+#else
+    dir= (tmp != nullptr) ? tmp : "/tmp";
+#endif
+  }
+
+#ifdef _WIN32
+  char path[MAX_PATH];
+  if (GetTempFileNameA(dir.c_str(), "pix", 0, path) == 0) return false;
+  HANDLE file= CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+    CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  HANDLE mapping= CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+    (DWORD) (bytes >> 32), (DWORD) (bytes & 0xffffffff), nullptr);
+  if (mapping == nullptr) {
+    CloseHandle(file);
+    return false;
+  }
+  void* view= MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T) bytes);
+  if (view == nullptr) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  this->myFile= file;
+  this->myMapping= mapping;
+#else
+  std::string path= dir + "/pixmap-tiles-XXXXXX";
+  std::vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+  int file= mkstemp(name.data());
+  if (file < 0) return false;
+  unlink(name.data()); // removed from disk as soon as we close it
+
+  // a sparse file of zeros, so a new image is black
+  if (ftruncate(file, (off_t) bytes) != 0) {
+    close(file);
+    return false;
+  }
+  void* view= mmap(nullptr, (size_t) bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+  if (view == MAP_FAILED) {
+    close(file);
+    return false;
+  }
+  this->myFile= file;
+#endif
+
+  this->myData= (unsigned char*) view;
+  this->myMappedBytes= bytes;
+  this->myWidth= width;
+  this->myHeight= height;
+  this->myTileSize= tileSize;
+  this->myTilesAcross= tilesAcross;
+  this->myTilesDown= tilesDown;
+  this->myScratchDir= scratchDir;
+
+  return true;
+}
+
+bool TiledImage::load(const std::string& filename, int tileSize) {
+  PPMRowReader reader;
+  if (!reader.open(filename)) {
+    // not a binary PPM, let stb decode it in memory
+    Image image;
+    return image.load(filename) && this->fromImage(image, tileSize);
+  }
+
+  // 64-bit dimensions, beyond what the reader can offer as a RowSource
+  if (!this->create(reader.fileWidth(), reader.fileHeight(), tileSize)) return false;
+  for (int64_t i= 0; i < reader.fileHeight() && reader.good(); i++) {
+    this->writeRow(i, reader.nextRow());
+  }
+
+  return reader.good();
+}
+
+bool TiledImage::save(const std::string& filename) const {
+  PPMRowWriter writer;
+  if (this->myData == nullptr || !writer.open(filename, this->myWidth, this->myHeight)) {
+    return false;
+  }
+
+  std::vector<unsigned char> row(this->myWidth * NUM_CHANNELS);
+  for (int64_t i= 0; i < this->myHeight; i++) {
+    this->readRow(i, row.data());
+    if (!writer.writeRow(row.data())) break;
+  }
+
+  return writer.close();
+}
+
+bool TiledImage::fromImage(const Image& image, int tileSize) {
+  if (!this->create(image.width(), image.height(), tileSize)) return false;
+  this->writeRegion(image, 0, 0);
+
+  return true;
+}
+
+Image TiledImage::toImage() const {
+  return this->readRegion(0, 0, (int) this->myWidth, (int) this->myHeight);
+}
+
+int64_t TiledImage::width() const {
+  return this->myWidth;
+}
+
+int64_t TiledImage::height() const {
+  return this->myHeight;
+}
+
+int TiledImage::tileSize() const {
+  return this->myTileSize;
+}
+
+int64_t TiledImage::tilesAcross() const {
+  return this->myTilesAcross;
+}
+
+int64_t TiledImage::tilesDown() const {
+  return this->myTilesDown;
+}
+
+int64_t TiledImage::tileBytes() const {
+  return (int64_t) this->myTileSize * this->myTileSize * NUM_CHANNELS;
+}
+
+unsigned char* TiledImage::tile(int64_t tileRow, int64_t tileCol) const {
+  assert(tileRow >= 0 && tileRow < this->myTilesDown);
+  assert(tileCol >= 0 && tileCol < this->myTilesAcross);
+
+  return this->myData + (tileRow * this->myTilesAcross + tileCol) * this->tileBytes();
+}
+
+void TiledImage::readRow(int64_t row, unsigned char* out) const {
+  assert(row >= 0 && row < this->myHeight);
+  int64_t tileRow= row / this->myTileSize;
+  int64_t offset= (row % this->myTileSize) * this->myTileSize * NUM_CHANNELS;
+
+  for (int64_t tc= 0; tc < this->myTilesAcross; tc++) {
+    int64_t cols= std::min<int64_t>(this->myTileSize, this->myWidth - tc * this->myTileSize);
+    std::memcpy(out + tc * this->myTileSize * NUM_CHANNELS,
+      this->tile(tileRow, tc) + offset, cols * NUM_CHANNELS);
+  }
+}
+
+void TiledImage::writeRow(int64_t row, const unsigned char* in) {
+  assert(row >= 0 && row < this->myHeight);
+  int64_t tileRow= row / this->myTileSize;
+  int64_t offset= (row % this->myTileSize) * this->myTileSize * NUM_CHANNELS;
+
+  for (int64_t tc= 0; tc < this->myTilesAcross; tc++) {
+    int64_t cols= std::min<int64_t>(this->myTileSize, this->myWidth - tc * this->myTileSize);
+    std::memcpy(this->tile(tileRow, tc) + offset,
+      in + tc * this->myTileSize * NUM_CHANNELS, cols * NUM_CHANNELS);
+  }
+}
+
+Image TiledImage::readRegion(int64_t x, int64_t y, int w, int h) const {
+  assert(this->myData != nullptr);
+  Image result(w, h);
+  int ts= this->myTileSize;
+
+  // columns [first, last) are inside the image, the ones to the left
+  // repeat column 0 and the ones to the right repeat column width - 1
+  int64_t first= std::max<int64_t>(x, 0);
+  int64_t last= std::min<int64_t>(x + w, this->myWidth);
+
+  for (int r= 0; r < h; r++) {
+    int64_t row= clamp64(y + r, 0, this->myHeight - 1);
+    int64_t offset= (row % ts) * ts;
+    unsigned char* dst= result.rowData(r);
+
+    // copy the inside span a tile at a time
+    for (int64_t col= first; col < last; ) {
+      int64_t tc= col / ts;
+      int64_t count= std::min(last, (tc + 1) * ts) - col;
+      std::memcpy(dst + (col - x) * NUM_CHANNELS,
+        this->tile(row / ts, tc) + (offset + col % ts) * NUM_CHANNELS, count * NUM_CHANNELS);
+      col+= count;
+    }
+
+    const unsigned char* leftPixel= this->tile(row / ts, 0) + offset * NUM_CHANNELS;
+    for (int64_t col= x; col < std::min<int64_t>(0, x + w); col++) {
+      std::memcpy(dst + (col - x) * NUM_CHANNELS, leftPixel, NUM_CHANNELS);
+    }
+    int64_t lastCol= this->myWidth - 1;
+    const unsigned char* rightPixel= this->tile(row / ts, lastCol / ts) + (offset + lastCol % ts) * NUM_CHANNELS;
+    for (int64_t col= std::max(this->myWidth, x); col < x + w; col++) {
+      std::memcpy(dst + (col - x) * NUM_CHANNELS, rightPixel, NUM_CHANNELS);
+    }
+  }
+
+  return result;
+}
+
+void TiledImage::writeRegion(const Image& image, int64_t x, int64_t y) {
+  assert(this->myData != nullptr);
+  int ts= this->myTileSize;
+
+  // only the part of image that lands inside this one is written
+  int64_t first= std::max<int64_t>(x, 0);
+  int64_t last= std::min<int64_t>(x + image.width(), this->myWidth);
+
+  for (int r= 0; r < image.height(); r++) {
+    int64_t row= y + r;
+    if (row < 0 || row >= this->myHeight) continue;
+    int64_t offset= (row % ts) * ts;
+    const unsigned char* src= image.rowData(r);
+
+    for (int64_t col= first; col < last; ) {
+      int64_t tc= col / ts;
+      int64_t count= std::min(last, (tc + 1) * ts) - col;
+      std::memcpy(this->tile(row / ts, tc) + (offset + col % ts) * NUM_CHANNELS,
+        src + (col - x) * NUM_CHANNELS, count * NUM_CHANNELS);
+      col+= count;
+    }
+  }
+}
+
+bool TiledImage::apply(const std::function<Image(const Image&)>& op, int halo,
+  TiledImage& output) const {
+  assert(&output != this);
+  if (this->myData == nullptr) return false;
+  if (output.width() != this->myWidth || output.height() != this->myHeight ||
+      output.tileSize() != this->myTileSize) {
+    if (!output.create(this->myWidth, this->myHeight, this->myTileSize, this->myScratchDir)) {
+      return false;
+    }
+  }
+
+  int ts= this->myTileSize;
+  int tiles= (int) (this->myTilesAcross * this->myTilesDown);
+
+  // every tile only reads this image and only writes its own output tile
+  parallelFor(tiles, [&](int, int begin, int end) {
+    for (int t= begin; t < end; t++) {
+      int64_t tileRow= t / this->myTilesAcross;
+      int64_t tileCol= t % this->myTilesAcross;
+      int64_t x= tileCol * ts;
+      int64_t y= tileRow * ts;
+      int w= (int) std::min<int64_t>(ts, this->myWidth - x);
+      int h= (int) std::min<int64_t>(ts, this->myHeight - y);
+
+      Image region= this->readRegion(x - halo, y - halo, w + 2 * halo, h + 2 * halo);
+      Image processed= op(region);
+      assert(processed.width() == region.width() && processed.height() == region.height());
+
+      // crop the halo off again
+      unsigned char* dst= output.tile(tileRow, tileCol);
+      for (int r= 0; r < h; r++) {
+        std::memcpy(dst + (int64_t) r * ts * NUM_CHANNELS,
+          processed.rowData(r + halo) + halo * NUM_CHANNELS, w * NUM_CHANNELS);
+      }
+    }
+  }, 1);
+
+  return true;
+}
+
+}  // namespace agl
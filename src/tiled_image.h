@@ -0,0 +1,120 @@
+#ifndef AGL_TILED_IMAGE_H_
+#define AGL_TILED_IMAGE_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "image.h"
+
+namespace agl {
+
+/**
+ * @brief RGB image stored as fixed-size square tiles in a memory-mapped
+ * scratch file, for images that do not fit in RAM
+ *
+ * Tiles are stored one after another (tile-major) so that a tile is a
+ * contiguous block of tileSize * tileSize * 3 bytes. Only the tiles being
+ * worked on need to be resident; the OS pages the rest out to the scratch
+ * file, which is removed when the TiledImage is destroyed. Dimensions and
+ * offsets are 64-bit.
+ */
+class TiledImage {
+ public:
+  TiledImage();
+  virtual ~TiledImage();
+
+  TiledImage(const TiledImage&) = delete;
+  TiledImage& operator=(const TiledImage&) = delete;
+
+  /**
+   * @brief Allocate a black image backed by a new scratch file
+   * @param width The image width in pixels
+   * @param height The image height in pixels
+   * @param tileSize The tile edge length in pixels
+   * @param scratchDir Where to put the scratch file (default: TMPDIR or /tmp)
+   */
+  bool create(int64_t width, int64_t height, int tileSize = 512,
+    const std::string& scratchDir = "");
+
+  /**
+   * @brief Load the given file
+   *
+   * Binary PPM (P6) files are streamed row by row into the tiles; other
+   * formats are decoded in memory first
+   */
+  bool load(const std::string& filename, int tileSize = 512);
+
+  /**
+   * @brief Save the image, streaming it row by row as a binary PPM (P6)
+   */
+  bool save(const std::string& filename) const;
+
+  // Copy an in-memory image into a new tiled image
+  bool fromImage(const Image& image, int tileSize = 512);
+
+  // Copy the whole image into memory (only sensible when it fits)
+  Image toImage() const;
+
+  int64_t width() const;
+  int64_t height() const;
+  int tileSize() const;
+  int64_t tilesAcross() const;
+  int64_t tilesDown() const;
+
+  // Bytes of one tile: tileSize * tileSize * 3
+  int64_t tileBytes() const;
+
+  // Returns the packed RGB data of a tile, rows are tileSize * 3 bytes
+  // Tiles on the right and bottom edges are only partly used
+  unsigned char* tile(int64_t tileRow, int64_t tileCol) const;
+
+  // Copy one image row (width * 3 bytes) out of / into the tiles
+  void readRow(int64_t row, unsigned char* out) const;
+  void writeRow(int64_t row, const unsigned char* in);
+
+  /**
+   * @brief Copy the region with top-left (x, y) and size (w, h) into an Image
+   *
+   * Coordinates outside the image are clamped to the nearest border pixel,
+   * the same edge handling as Image::convolute
+   */
+  Image readRegion(int64_t x, int64_t y, int w, int h) const;
+
+  // Write image with its top-left at (x, y), clipped to this image
+  void writeRegion(const Image& image, int64_t x, int64_t y);
+
+  /**
+   * @brief Apply an operation tile by tile
+   * @param op Operation returning an image the same size as its input
+   * @param halo Pixels of context needed on each side (e.g. 1 for 3x3
+   *   kernels, 2 for 5x5)
+   * @param output Receives the result, created if it is not the same size
+   *
+   * Each tile is read together with its halo, processed, and the halo is
+   * cropped off again, so neighbourhood filters match a whole-image run.
+   * Tiles are processed in parallel.
+   */
+  bool apply(const std::function<Image(const Image&)>& op, int halo,
+    TiledImage& output) const;
+
+ private:
+  void release();
+
+  int64_t myWidth;
+  int64_t myHeight;
+  int myTileSize;
+  int64_t myTilesAcross;
+  int64_t myTilesDown;
+  int64_t myMappedBytes;
+  unsigned char* myData; // start of the mapped scratch file
+  std::string myScratchDir;
+#ifdef _WIN32
+  void* myFile;
+  void* myMapping;
+#else
+  int myFile;
+#endif
+};
+
+}  // namespace agl
+#endif  // AGL_TILED_IMAGE_H_
@@ -0,0 +1,117 @@
+#include "virtual_image.h"
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstring>
+
+#define NUM_CHANNELS 3
+
+namespace agl {
+
+TiledRowSource::TiledRowSource(const Image& tile, int m, int n)
+  : myTile(tile), myRows(m), myColumns(n) {
+  assert(m >= 0 && n >= 0);
+  this->myRow.resize((size_t) this->width() * NUM_CHANNELS);
+}
+
+int TiledRowSource::width() const {
+  return this->myTile.width() * this->myColumns;
+}
+
+int TiledRowSource::height() const {
+  return this->myTile.height() * this->myRows;
+}
+
+const unsigned char* TiledRowSource::row(int y) {
+  assert(y >= 0 && y < this->height());
+  const unsigned char* src= this->myTile.rowData(y % this->myTile.height());
+  size_t widthBytes= (size_t) this->myTile.width() * NUM_CHANNELS;
+  for (int j= 0; j < this->myColumns; j++) {
+    std::memcpy(&this->myRow[j * widthBytes], src, widthBytes);
+  }
+  return this->myRow.data();
+}
+
+MosaicRowSource::MosaicRowSource(int width, int height, const Pixel& background)
+  : myWidth(width), myHeight(height), myStarted(0), myNextRow(-1) {
+  assert(width >= 0 && height >= 0);
+  this->myBackground.resize((size_t) width * NUM_CHANNELS);
+  for (int j= 0; j < width; j++) {
+    this->myBackground[j * NUM_CHANNELS]= background.r;
+    this->myBackground[j * NUM_CHANNELS + 1]= background.g;
+    this->myBackground[j * NUM_CHANNELS + 2]= background.b;
+  }
+  this->myRow.resize(this->myBackground.size());
+}
+
+void MosaicRowSource::place(const Image& image, int x, int y) {
+  this->myPlacements.push_back(Placement{&image, x, y});
+  this->myNextRow= -1;
+}
+
+int MosaicRowSource::width() const {
+  return this->myWidth;
+}
+
+int MosaicRowSource::height() const {
+  return this->myHeight;
+}
+
+const unsigned char* MosaicRowSource::row(int y) {
+  assert(y >= 0 && y < this->myHeight);
+  const std::vector<Placement>& placements= this->myPlacements;
+
+  if (y != this->myNextRow) {
+    // out of order: sort by top row again and skip to y
+    this->myOrder.resize(placements.size());
+    for (int k= 0; k < (int) placements.size(); k++) this->myOrder[k]= k;
+    std::stable_sort(this->myOrder.begin(), this->myOrder.end(), [&](int a, int b) {
+      return placements[a].y < placements[b].y;
+    });
+    this->myActive.clear();
+    this->myStarted= 0;
+  }
+  this->myNextRow= y + 1;
+
+  bool added= false;
+  while (this->myStarted < (int) this->myOrder.size() &&
+    placements[this->myOrder[this->myStarted]].y <= y) {
+    this->myActive.push_back(this->myOrder[this->myStarted++]);
+    added= true;
+  }
+  // paint in placement order so later images come out on top
+  if (added) std::sort(this->myActive.begin(), this->myActive.end());
+  this->myActive.erase(std::remove_if(this->myActive.begin(), this->myActive.end(), [&](int k) {
+    return y >= placements[k].y + placements[k].image->height();
+  }), this->myActive.end());
+
+  std::memcpy(this->myRow.data(), this->myBackground.data(), this->myRow.size());
+  for (int k : this->myActive) {
+    const Placement& p= placements[k];
+    int begin= std::max(p.x, 0);
+    int end= std::min(p.x + p.image->width(), this->myWidth);
+    if (begin >= end) continue;
+    std::memcpy(&this->myRow[(size_t) begin * NUM_CHANNELS],
+      p.image->rowData(y - p.y) + (size_t) (begin - p.x) * NUM_CHANNELS,
+      (size_t) (end - begin) * NUM_CHANNELS);
+  }
+  return this->myRow.data();
+}
+
+// Lower case extension of filename, without the dot
+static std::string extensionOf(const std::string& filename) {
+  size_t dot= filename.find_last_of('.');
+  if (dot == std::string::npos) return "";
+  std::string extension= filename.substr(dot + 1);
+  for (char& c : extension) c= (char) std::tolower((unsigned char) c);
+  return extension;
+}
+
+bool writeImage(RowSource& source, const std::string& filename) {
+  std::string extension= extensionOf(filename);
+  if (extension == "ppm") return writePPM(source, filename);
+  if (extension == "qoi") return writeQOI(source, filename);
+  return writePNG(source, filename);
+}
+
+}  // namespace agl
@@ -0,0 +1,81 @@
+#ifndef AGL_VIRTUAL_IMAGE_H_
+#define AGL_VIRTUAL_IMAGE_H_
+
+#include <string>
+#include <vector>
+#include "image.h"
+#include "png_writer.h"
+#include "qoi_writer.h"
+#include "row_stream.h"
+
+namespace agl {
+
+/**
+ * Virtual images: row sources that compose their rows on demand from
+ * images they reference, so a mosaic can go straight to an encoder, e.g.
+ *
+ *   TiledRowSource sheet(tile, 50, 80);   // tile.gridCopy(50, 80), never built
+ *   writePNG(sheet, "sheet.png");
+ *
+ * Memory is one output row. Referenced images must outlive the source.
+ */
+
+// The image repeated in an m x n grid, as Image::gridCopy(m, n)
+class TiledRowSource : public RowSource {
+ public:
+  TiledRowSource(const Image& tile, int m, int n);
+  int width() const override;
+  int height() const override;
+  const unsigned char* row(int y) override;
+
+ private:
+  const Image& myTile;
+  int myRows;
+  int myColumns;
+  std::vector<unsigned char> myRow;
+};
+
+/**
+ * @brief Images laid out on a canvas of one background colour
+ *
+ * Images placed later cover those placed earlier, and may lie partly or
+ * wholly off the canvas. Rows requested in order only visit the images
+ * that cross them, so canvases of many thousands of images stay cheap;
+ * other rows are allowed too, at the cost of a scan of every image.
+ */
+class MosaicRowSource : public RowSource {
+ public:
+  MosaicRowSource(int width, int height, const Pixel& background = Pixel{0, 0, 0});
+
+  // Puts image with its top left corner at column x, row y
+  void place(const Image& image, int x, int y);
+
+  int width() const override;
+  int height() const override;
+  const unsigned char* row(int y) override;
+
+ private:
+  struct Placement {
+    const Image* image;
+    int x;
+    int y;
+  };
+
+  int myWidth;
+  int myHeight;
+  std::vector<Placement> myPlacements;
+  std::vector<unsigned char> myBackground; // one row of the background colour
+  std::vector<unsigned char> myRow;
+
+  // images by top row, and those crossing the last row made
+  std::vector<int> myOrder;
+  std::vector<int> myActive;
+  int myStarted; // images of myOrder that have been made active
+  int myNextRow; // row an in-order request would ask for next
+};
+
+// Writes source as PNG, PPM or QOI by the extension of filename
+bool writeImage(RowSource& source, const std::string& filename);
+
+}  // namespace agl
+#endif  // AGL_VIRTUAL_IMAGE_H_
@@ -0,0 +1,265 @@
+#include "warp.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+namespace agl {
+
+static const double PI= 3.14159265358979323846;
+
+// Source coordinates are stepped in 16.16 fixed point, and interpolation
+// weights use the top 8 bits of the fraction
+static const int FRACTION_BITS= 16;
+static const double FIXED_ONE= 1 << FRACTION_BITS;
+static const int PHASES= 256;
+
+// Catmull-Rom weights in 11 bits, summing to exactly 2048 for each phase
+static const int CUBIC_BITS= 11;
+
+// Source coordinates further out than this are outside any image, and
+// still fit the fixed point format after many steps
+static const double FAR_AWAY= 1e9;
+
+Transform Transform::identity() {
+  return Transform{{1, 0, 0, 0, 1, 0, 0, 0, 1}};
+}
+
+Transform Transform::translation(double dx, double dy) {
+  return Transform{{1, 0, dx, 0, 1, dy, 0, 0, 1}};
+}
+
+Transform Transform::scale(double sx, double sy) {
+  return Transform{{sx, 0, 0, 0, sy, 0, 0, 0, 1}};
+}
+
+Transform Transform::rotation(double degrees, double cx, double cy) {
+  // the usual rotation matrix with the angle negated, since y points down
+  double radians= degrees * PI / 180.0;
+  double c= std::cos(radians);
+  double s= std::sin(radians);
+  return Transform{{c, s, cx - c * cx - s * cy, -s, c, cy + s * cx - c * cy, 0, 0, 1}};
+}
+
+Transform Transform::affine(double a, double b, double c, double d, double e, double f) {
+  return Transform{{a, b, c, d, e, f, 0, 0, 1}};
+}
+
+bool Transform::mapQuad(const double from[8], const double to[8], Transform& result) {
+  // m8 = 1 and each point pair gives two linear equations in m0..m7:
+  //   m0 x + m1 y + m2 - m6 x X - m7 y X = X, likewise for Y
+  double system[8][9];
+  for (int p= 0; p < 4; p++) {
+    double x= from[2 * p];
+    double y= from[2 * p + 1];
+    double tx= to[2 * p];
+    double ty= to[2 * p + 1];
+    double rowX[9]= {x, y, 1, 0, 0, 0, -x * tx, -y * tx, tx};
+    double rowY[9]= {0, 0, 0, x, y, 1, -x * ty, -y * ty, ty};
+    std::memcpy(system[2 * p], rowX, sizeof(rowX));
+    std::memcpy(system[2 * p + 1], rowY, sizeof(rowY));
+  }
+
+  // Gaussian elimination with partial pivoting
+  for (int col= 0; col < 8; col++) {
+    int pivot= col;
+    for (int r= col + 1; r < 8; r++) {
+      if (std::fabs(system[r][col]) > std::fabs(system[pivot][col])) pivot= r;
+    }
+    if (std::fabs(system[pivot][col]) < 1e-12) return false;
+    std::swap(system[col], system[pivot]);
+
+    for (int r= 0; r < 8; r++) {
+      if (r == col) continue;
+      double factor= system[r][col] / system[col][col];
+      for (int k= col; k < 9; k++) system[r][k]-= factor * system[col][k];
+    }
+  }
+
+  for (int k= 0; k < 8; k++) result.m[k]= system[k][8] / system[k][k];
+  result.m[8]= 1;
+  return true;
+}
+
+Transform Transform::operator*(const Transform& other) const {
+  Transform product;
+  for (int r= 0; r < 3; r++) {
+    for (int c= 0; c < 3; c++) {
+      product.m[r * 3 + c]= this->m[r * 3] * other.m[c] + this->m[r * 3 + 1] * other.m[3 + c] +
+        this->m[r * 3 + 2] * other.m[6 + c];
+    }
+  }
+  return product;
+}
+
+bool Transform::inverse(Transform& result) const {
+  const double* a= this->m;
+  double cofactors[9]= {
+    a[4] * a[8] - a[5] * a[7], a[2] * a[7] - a[1] * a[8], a[1] * a[5] - a[2] * a[4],
+    a[5] * a[6] - a[3] * a[8], a[0] * a[8] - a[2] * a[6], a[2] * a[3] - a[0] * a[5],
+    a[3] * a[7] - a[4] * a[6], a[1] * a[6] - a[0] * a[7], a[0] * a[4] - a[1] * a[3]};
+  double determinant= a[0] * cofactors[0] + a[1] * cofactors[3] + a[2] * cofactors[6];
+  if (std::fabs(determinant) < 1e-12) return false;
+
+  for (int k= 0; k < 9; k++) result.m[k]= cofactors[k] / determinant;
+  return true;
+}
+
+bool Transform::isAffine() const {
+  return this->m[6] == 0 && this->m[7] == 0 && this->m[8] == 1;
+}
+
+void Transform::apply(double x, double y, double& outX, double& outY) const {
+  double w= this->m[6] * x + this->m[7] * y + this->m[8];
+  outX= (this->m[0] * x + this->m[1] * y + this->m[2]) / w;
+  outY= (this->m[3] * x + this->m[4] * y + this->m[5]) / w;
+}
+
+static inline long long toFixed(double value) {
+  value= std::max(-FAR_AWAY, std::min(FAR_AWAY, value));
+  return (long long) std::floor(value * FIXED_ONE + 0.5);
+}
+
+static inline const unsigned char* pixelAt(const WarpSource& source, int x, int y) {
+  x= std::max(0, std::min(x, source.width - 1));
+  y= std::max(0, std::min(y, source.height - 1));
+  return source.data + (size_t) y * source.stride + x * 3;
+}
+
+namespace {
+
+struct CubicWeights {
+  int w[PHASES][4];
+
+  CubicWeights() {
+    for (int phase= 0; phase < PHASES; phase++) {
+      double t= (double) phase / PHASES;
+      double exact[4]= {(-t * t * t + 2 * t * t - t) / 2, (3 * t * t * t - 5 * t * t + 2) / 2,
+        (-3 * t * t * t + 4 * t * t + t) / 2, (t * t * t - t * t) / 2};
+      int sum= 0;
+      for (int k= 0; k < 4; k++) {
+        this->w[phase][k]= (int) std::lround(exact[k] * (1 << CUBIC_BITS));
+        sum+= this->w[phase][k];
+      }
+      // rounding slack goes to the largest tap so flat areas stay flat
+      int largest= t < 0.5 ? 1 : 2;
+      this->w[phase][largest]+= (1 << CUBIC_BITS) - sum;
+    }
+  }
+};
+
+}  // namespace
+
+static const CubicWeights& cubicWeights() {
+  static const CubicWeights weights;
+  return weights;
+}
+
+// One interpolated pixel; x and y are 16.16 source coordinates
+static inline void samplePixel(const WarpSource& source, long long x, long long y,
+  Interpolation interpolation, const CubicWeights& cubic, unsigned char* out) {
+  if (interpolation == INTERPOLATE_NEAREST) {
+    const unsigned char* p= pixelAt(source, (int) ((x + (1 << (FRACTION_BITS - 1))) >> FRACTION_BITS),
+      (int) ((y + (1 << (FRACTION_BITS - 1))) >> FRACTION_BITS));
+    out[0]= p[0];
+    out[1]= p[1];
+    out[2]= p[2];
+    return;
+  }
+
+  int ix= (int) (x >> FRACTION_BITS);
+  int iy= (int) (y >> FRACTION_BITS);
+  int fx= (int) (x >> (FRACTION_BITS - 8)) & (PHASES - 1);
+  int fy= (int) (y >> (FRACTION_BITS - 8)) & (PHASES - 1);
+
+  // away from the edges the neighbours need no clamping
+  bool interior= ix >= 1 && iy >= 1 && ix + 2 < source.width && iy + 2 < source.height;
+
+  if (interpolation == INTERPOLATE_BILINEAR) {
+    const unsigned char* p00= pixelAt(source, ix, iy);
+    const unsigned char* p01= interior ? p00 + 3 : pixelAt(source, ix + 1, iy);
+    const unsigned char* p10= interior ? p00 + source.stride : pixelAt(source, ix, iy + 1);
+    const unsigned char* p11= interior ? p10 + 3 : pixelAt(source, ix + 1, iy + 1);
+    for (int c= 0; c < 3; c++) {
+      int top= p00[c] * (PHASES - fx) + p01[c] * fx;
+      int bottom= p10[c] * (PHASES - fx) + p11[c] * fx;
+      out[c]= (unsigned char) ((top * (PHASES - fy) + bottom * fy + (1 << 15)) >> 16);
+    }
+    return;
+  }
+
+  // bicubic: four rows filtered across, then one filter down
+  const int* wx= cubic.w[fx];
+  const int* wy= cubic.w[fy];
+  int sum[3]= {0, 0, 0};
+  for (int r= 0; r < 4; r++) {
+    const unsigned char* p[4];
+    if (interior) {
+      p[0]= source.data + (size_t) (iy - 1 + r) * source.stride + (ix - 1) * 3;
+      p[1]= p[0] + 3;
+      p[2]= p[0] + 6;
+      p[3]= p[0] + 9;
+    } else {
+      for (int k= 0; k < 4; k++) p[k]= pixelAt(source, ix - 1 + k, iy - 1 + r);
+    }
+    for (int c= 0; c < 3; c++) {
+      int across= p[0][c] * wx[0] + p[1][c] * wx[1] + p[2][c] * wx[2] + p[3][c] * wx[3];
+      sum[c]+= across * wy[r];
+    }
+  }
+  for (int c= 0; c < 3; c++) {
+    int value= (sum[c] + (1 << (2 * CUBIC_BITS - 1))) >> (2 * CUBIC_BITS);
+    out[c]= (unsigned char) std::max(0, std::min(value, 255));
+  }
+}
+
+void warpSpan(const WarpSource& source, const Transform& toSource, int x, int y, int count,
+  Interpolation interpolation, const unsigned char background[3], unsigned char* out) {
+  const double* m= toSource.m;
+  const CubicWeights& cubic= cubicWeights();
+
+  // inside while within half a pixel of the source
+  long long half= 1 << (FRACTION_BITS - 1);
+  long long right= ((long long) source.width << FRACTION_BITS) - half;
+  long long bottom= ((long long) source.height << FRACTION_BITS) - half;
+
+  double X= m[0] * x + m[1] * y + m[2];
+  double Y= m[3] * x + m[4] * y + m[5];
+  double W= m[6] * x + m[7] * y + m[8];
+  bool affine= toSource.isAffine();
+  long long sx= toFixed(X);
+  long long sy= toFixed(Y);
+  long long stepX= toFixed(m[0]);
+  long long stepY= toFixed(m[3]);
+
+  for (int k= 0; k < count; k++, out+= 3) {
+    bool visible= true;
+    if (!affine) {
+      // one division per pixel; W <= 0 is behind the viewer
+      visible= W > 0;
+      if (visible) {
+        double inverseW= 1.0 / W;
+        sx= toFixed(X * inverseW);
+        sy= toFixed(Y * inverseW);
+      }
+      X+= m[0];
+      Y+= m[3];
+      W+= m[6];
+    }
+
+    if (visible && sx >= -half && sx < right && sy >= -half && sy < bottom) {
+      samplePixel(source, sx, sy, interpolation, cubic, out);
+    } else {
+      out[0]= background[0];
+      out[1]= background[1];
+      out[2]= background[2];
+    }
+
+    if (affine) {
+      sx+= stepX;
+      sy+= stepY;
+    }
+  }
+}
+
+}  // namespace agl
@@ -0,0 +1,80 @@
+#ifndef AGL_WARP_H_
+#define AGL_WARP_H_
+
+#include <cstddef>
+
+namespace agl {
+
+/**
+ * Geometric transforms for Image::warp. Coordinates are in pixels with
+ * pixel centres on integers, x to the right and y down.
+ */
+
+enum Interpolation {INTERPOLATE_NEAREST, INTERPOLATE_BILINEAR, INTERPOLATE_BICUBIC};
+
+/**
+ * @brief 3x3 projective transform, row major
+ *
+ * Maps (x, y) to ((m0 x + m1 y + m2) / w, (m3 x + m4 y + m5) / w) with
+ * w = m6 x + m7 y + m8; affine transforms have m6 = m7 = 0 and m8 = 1.
+ * a * b applies b first, then a.
+ */
+struct Transform {
+  double m[9];
+
+  static Transform identity();
+  static Transform translation(double dx, double dy);
+  static Transform scale(double sx, double sy);
+
+  // Counterclockwise on screen by degrees about (cx, cy)
+  static Transform rotation(double degrees, double cx, double cy);
+
+  // (x, y) to (a x + b y + c, d x + e y + f)
+  static Transform affine(double a, double b, double c, double d, double e, double f);
+
+  /**
+   * @brief The perspective transform taking four points onto four others
+   * @param from x0, y0, ..., x3, y3, e.g. the corners of a skewed page
+   * @param to Where they go, e.g. the corners of the output rectangle
+   * @return false if no such transform exists (three points in a line)
+   */
+  static bool mapQuad(const double from[8], const double to[8], Transform& result);
+
+  Transform operator*(const Transform& other) const;
+
+  // false if the transform is singular
+  bool inverse(Transform& result) const;
+
+  bool isAffine() const;
+
+  void apply(double x, double y, double& outX, double& outY) const;
+};
+
+/**
+ * @brief Packed RGB rows a warp reads from
+ */
+struct WarpSource {
+  const unsigned char* data;
+  int width;
+  int height;
+  size_t stride; // bytes from one row to the next
+};
+
+/**
+ * @brief Samples count output pixels of row y, from column x on
+ * @param toSource Maps output coordinates to source coordinates
+ * @param background Colour of pixels that map outside the source
+ * @param out count * 3 bytes
+ *
+ * Source coordinates are exact at the first pixel and stepped across the
+ * span in 16.16 fixed point (the projective part stays in floating point,
+ * one division per pixel), so spans should stay short, e.g. a tile wide.
+ * Weights have 8 bits of subpixel precision. A pixel is background when
+ * its source point is more than half a pixel outside the source;
+ * neighbours past the edge repeat the border.
+ */
+void warpSpan(const WarpSource& source, const Transform& toSource, int x, int y, int count,
+  Interpolation interpolation, const unsigned char background[3], unsigned char* out);
+
+}  // namespace agl
+#endif  // AGL_WARP_H_